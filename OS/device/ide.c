@@ -0,0 +1,137 @@
+#include "ide.h"
+#include "io.h"
+#include "print.h"
+#include "debug.h"
+#include "interrupt.h"
+
+/*************************  IDE 硬盘（ATA PIO）  ***************************
+ * 以查询方式驱动 primary 通道上的主盘（即存放内核的 hd60M.img），28 位 LBA 寻址。
+ * 不使用硬盘中断：发出命令后轮询状态寄存器，每个扇区在 DRQ 置位后用 insw/outsw 传送 256 个字。
+ * 换页常在关中断时（缺页异常、palloc_order 中）读写硬盘，轮询期间临时开中断，时钟和调度在等盘时照常进行；
+ * 因此调用者须在线程上下文中，并自行保证同一时刻只有一个线程在操作硬盘（目前只有 swap.c 使用，由 swap_lock 串行化）。
+ ***************************************************************************/
+#define ATA_PORT_BASE 0x1f0               // primary 通道命令块寄存器的基端口号
+#define ATA_REG_DATA (ATA_PORT_BASE + 0)  // 数据寄存器（16 位）
+#define ATA_REG_ERROR (ATA_PORT_BASE + 1) // 错误寄存器
+#define ATA_REG_SECT_CNT (ATA_PORT_BASE + 2)
+#define ATA_REG_LBA_L (ATA_PORT_BASE + 3) // LBA 的 0~7 位
+#define ATA_REG_LBA_M (ATA_PORT_BASE + 4) // LBA 的 8~15 位
+#define ATA_REG_LBA_H (ATA_PORT_BASE + 5) // LBA 的 16~23 位
+#define ATA_REG_DEV (ATA_PORT_BASE + 6)   // device 寄存器，低 4 位为 LBA 的 24~27 位
+#define ATA_REG_STATUS (ATA_PORT_BASE + 7)
+#define ATA_REG_CMD ATA_REG_STATUS
+#define ATA_REG_CTL 0x3f6 // 控制块的 device control 寄存器
+
+#define BIT_STAT_BSY 0x80  // 硬盘忙
+#define BIT_STAT_DRDY 0x40 // 驱动器准备好
+#define BIT_STAT_DF 0x20   // 驱动器故障
+#define BIT_STAT_DRQ 0x08  // 数据已准备好传送
+#define BIT_STAT_ERR 0x01  // 上一条命令出错
+
+#define BIT_DEV_MBS 0xa0 // device 寄存器的第 7 位和第 5 位固定为 1
+#define BIT_DEV_LBA 0x40 // 以 LBA 方式寻址
+#define BIT_CTL_NIEN 0x02 // 置 1 时硬盘不发中断
+
+#define CMD_READ_SECTOR 0x20
+#define CMD_WRITE_SECTOR 0x30
+
+#define IDE_WAIT_LOOPS 10000000 // 轮询状态寄存器的最大次数，超过则认为硬盘没有响应
+
+/**
+ * @brief 轮询状态寄存器，直到 BSY 为 0 且 (status & mask) == value，轮询期间开中断，返回前恢复原来的中断状态
+ *
+ * @return bool 等到时返回 true；出错（ERR 或 DF）或超时返回 false
+ */
+static bool ide_wait(uint8_t mask, uint8_t value)
+{
+    enum intr_status old_status = intr_enable();
+    uint8_t status = BIT_STAT_BSY;
+    uint32_t loops;
+    for (loops = 0; loops < IDE_WAIT_LOOPS; loops++)
+    {
+        status = inb(ATA_REG_STATUS);
+        if (!(status & BIT_STAT_BSY) && ((status & (BIT_STAT_ERR | BIT_STAT_DF)) || (status & mask) == value))
+        {
+            break;
+        }
+    }
+    intr_set_status(old_status);
+    return loops < IDE_WAIT_LOOPS && !(status & (BIT_STAT_ERR | BIT_STAT_DF));
+}
+
+/**
+ * @brief 选中主盘，写入起始扇区 lba 和扇区数 sec_cnt（0 表示 256）
+ */
+static void ide_select(uint32_t lba, uint8_t sec_cnt)
+{
+    ASSERT(lba <= 0x0fffffff);
+    outb(ATA_REG_DEV, BIT_DEV_MBS | BIT_DEV_LBA | (lba >> 24));
+    outb(ATA_REG_SECT_CNT, sec_cnt);
+    outb(ATA_REG_LBA_L, lba);
+    outb(ATA_REG_LBA_M, lba >> 8);
+    outb(ATA_REG_LBA_H, lba >> 16);
+}
+
+/**
+ * ide_read - 从主盘的 lba 扇区起读出 sec_cnt 个扇区到 buf
+ * @sec_cnt: 1~256
+ *
+ * @return: 硬盘报错或不响应时返回 false
+ */
+bool ide_read(uint32_t lba, void *buf, uint32_t sec_cnt)
+{
+    ASSERT(sec_cnt >= 1 && sec_cnt <= 256);
+    if (!ide_wait(BIT_STAT_DRDY, BIT_STAT_DRDY))
+    {
+        return false;
+    }
+    ide_select(lba, sec_cnt);
+    outb(ATA_REG_CMD, CMD_READ_SECTOR);
+    uint32_t sec_idx;
+    for (sec_idx = 0; sec_idx < sec_cnt; sec_idx++)
+    {
+        if (!ide_wait(BIT_STAT_DRQ, BIT_STAT_DRQ))
+        {
+            return false;
+        }
+        insw(ATA_REG_DATA, (uint8_t *)buf + sec_idx * SECTOR_SIZE, SECTOR_SIZE / 2);
+    }
+    return true;
+}
+
+/**
+ * ide_write - 把 buf 中的 sec_cnt 个扇区写入主盘的 lba 扇区起
+ * @sec_cnt: 1~256
+ *
+ * @return: 硬盘报错或不响应时返回 false
+ */
+bool ide_write(uint32_t lba, const void *buf, uint32_t sec_cnt)
+{
+    ASSERT(sec_cnt >= 1 && sec_cnt <= 256);
+    if (!ide_wait(BIT_STAT_DRDY, BIT_STAT_DRDY))
+    {
+        return false;
+    }
+    ide_select(lba, sec_cnt);
+    outb(ATA_REG_CMD, CMD_WRITE_SECTOR);
+    uint32_t sec_idx;
+    for (sec_idx = 0; sec_idx < sec_cnt; sec_idx++)
+    {
+        if (!ide_wait(BIT_STAT_DRQ, BIT_STAT_DRQ))
+        {
+            return false;
+        }
+        outsw(ATA_REG_DATA, (const uint8_t *)buf + sec_idx * SECTOR_SIZE, SECTOR_SIZE / 2);
+    }
+    return ide_wait(BIT_STAT_DRQ, 0); // 等最后一个扇区写完
+}
+
+/**
+ * @brief 初始化硬盘：关闭 primary 通道的硬盘中断，只用查询方式
+ */
+void ide_init(void)
+{
+    put_str("ide_init start\n");
+    outb(ATA_REG_CTL, BIT_CTL_NIEN);
+    put_str("ide_init done\n");
+}
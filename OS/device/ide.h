@@ -0,0 +1,15 @@
+#ifndef __DEVICE_IDE_H
+#define __DEVICE_IDE_H
+
+#include "stdint.h"
+#include "bitmap.h"
+
+#define SECTOR_SIZE 512 // 扇区大小（字节）
+
+void ide_init(void);
+static bool ide_wait(uint8_t mask, uint8_t value);
+static void ide_select(uint32_t lba, uint8_t sec_cnt);
+bool ide_read(uint32_t lba, void *buf, uint32_t sec_cnt);
+bool ide_write(uint32_t lba, const void *buf, uint32_t sec_cnt);
+
+#endif
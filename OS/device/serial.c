@@ -0,0 +1,80 @@
+#include "serial.h"
+#include "io.h"
+
+/******************************  串口 COM1  ********************************
+ * 以查询方式驱动 8250/16550 UART，只用于输出，供调试信息和统计数据送到宿主机（如 qemu -serial stdio）。
+ * 不使用串口中断，发送前轮询线路状态寄存器，直到发送保持寄存器为空。
+ ***************************************************************************/
+#define COM1_PORT 0x3f8             // COM1 的基端口号
+#define UART_DATA (COM1_PORT + 0)   // 数据寄存器（DLAB=1 时为除数低 8 位）
+#define UART_IER (COM1_PORT + 1)    // 中断允许寄存器（DLAB=1 时为除数高 8 位）
+#define UART_FCR (COM1_PORT + 2)    // FIFO 控制寄存器
+#define UART_LCR (COM1_PORT + 3)    // 线路控制寄存器
+#define UART_MCR (COM1_PORT + 4)    // Modem 控制寄存器
+#define UART_LSR (COM1_PORT + 5)    // 线路状态寄存器
+#define UART_LCR_DLAB 0x80          // LCR 的第 7 位，置 1 后前两个端口用于写波特率除数
+#define UART_LCR_8N1 0x03           // 8 位数据位、无校验、1 位停止位
+#define UART_LSR_THRE 0x20          // LSR 的第 5 位，发送保持寄存器为空
+#define UART_BAUD_DIVISOR 3         // 115200 / 3 = 38400 波特
+
+/**
+ * @brief 初始化串口 COM1：38400 波特，8N1，开启 FIFO，关闭串口中断
+ */
+void serial_init(void)
+{
+    outb(UART_IER, 0x00);                        // 关闭串口中断，只用查询方式
+    outb(UART_LCR, UART_LCR_DLAB);               // 打开 DLAB，设置波特率除数
+    outb(UART_DATA, UART_BAUD_DIVISOR & 0xff);   // 除数低 8 位
+    outb(UART_IER, UART_BAUD_DIVISOR >> 8);      // 除数高 8 位
+    outb(UART_LCR, UART_LCR_8N1);                // 关闭 DLAB，设置数据格式
+    outb(UART_FCR, 0xc7);                        // 开启并清空收发 FIFO，触发阈值 14 字节
+    outb(UART_MCR, 0x03);                        // 置 DTR、RTS
+}
+
+/**
+ * @brief 从串口输出一个字符，换行符前补一个回车，便于在终端中按行显示
+ *
+ * @param uint8_t char_asci 要输出的字符
+ */
+void serial_put_char(uint8_t char_asci)
+{
+    if (char_asci == '\n')
+    {
+        serial_put_char('\r');
+    }
+    while (!(inb(UART_LSR) & UART_LSR_THRE))
+        ; // 等待发送保持寄存器为空
+    outb(UART_DATA, char_asci);
+}
+
+/**
+ * @brief 从串口输出以 '\0' 结尾的字符串
+ *
+ * @param char* str 要输出的字符串
+ */
+void serial_put_str(char *str)
+{
+    while (*str)
+    {
+        serial_put_char(*str++);
+    }
+}
+
+/**
+ * @brief 从串口以十六进制输出整数（与 put_int 一致，不带 0x 前缀，不输出前导 0）
+ *
+ * @param uint32_t num 要输出的整数
+ */
+void serial_put_int(uint32_t num)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    int shift = 28;
+    while (shift > 0 && ((num >> shift) & 0xf) == 0)
+    {
+        shift -= 4; // 跳过前导 0
+    }
+    for (; shift >= 0; shift -= 4)
+    {
+        serial_put_char(digits[(num >> shift) & 0xf]);
+    }
+}
@@ -0,0 +1,11 @@
+#ifndef __DEVICE_SERIAL_H
+#define __DEVICE_SERIAL_H
+
+#include "stdint.h"
+
+void serial_init(void);
+void serial_put_char(uint8_t char_asci);
+void serial_put_str(char *str);
+void serial_put_int(uint32_t num);
+
+#endif
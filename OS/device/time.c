@@ -4,18 +4,33 @@
 #include "debug.h"
 #include "thread.h"
 #include "interrupt.h"
+#include "timer.h"
 
-#define IRQ0_FREQUENCY 100      // 时钟中断频率，设为 100Hz
 #define INPUT_FERQUENCY 1193180 // 计数器 0 的工作脉冲信号频率
 // 1193180 / 中断信号的频率 = 计数器 0 的初值
-#define COUNTER0_VALUE INPUT_FERQUENCY / IRQ0_FREQUENCY // 计数器 0 的初始值，根据频率计算
+#define COUNTER0_VALUE (INPUT_FERQUENCY / IRQ0_FREQUENCY) // 计数器 0 的初始值，根据频率计算
 #define COUNTER0_PORT 0x40                              // 计数器 0 的端口号
 #define COUNTER_NO 0                                    // 选择计数器的号码，0 代表计数器 0
 #define COUNTER_MODE 2                                  // 工作方式 2，比率发生器模式
+#define COUNTER_MODE_ONESHOT 0                          // 工作方式 0，计数到 0 时发出一次中断（单次触发）
+#define READ_LATCH 0                                    // 读写方式为 0 时是锁存命令，锁存当前计数值供读取
 #define READ_WRITE_LATCH 3                              // 读写方式，先写低 8 位，再写高 8 位
 #define PIT_CONTROL_PORT 0x43                           // 控制器寄存器的端口
+#define TICKLESS_MAX_TICKS (0xffff / COUNTER0_VALUE)    // 16 位计数器单次最多能定时的滴答数（5 个，约 50ms）
 
 uint32_t ticks; // ticks 是内核自中断开始以来总共的滴答数（类似于系统运行时长的概念，以后在写用户程序的时候也许会用到）
+struct tick_stat tick_stat;
+
+/******************************  tickless  ***********************************
+ * 处理器空闲（idle 线程将要 hlt）或只有当前线程可运行时，周期性的时钟中断除了累加 ticks 之外无事可做，
+ * 这时用 tick_stop 把计数器 0 改为单次触发，在下一个事件（当前线程的时间片到期，空闲时为计数器的上限）才中断一次。
+ * 下一个事件还受时间轮上最近的定时器限制（timer_next_ticks）。单次触发到期时，时钟中断一次补上这段时间的全部滴答；在此之前有别的线程进入就绪队列时（tick_resume），
+ * 锁存并读出计数器的当前值，按已经过的计数补记滴答（不足一个滴答的余数留到下次），然后恢复 100Hz 的周期模式。
+ ******************************************************************************/
+static bool tickless = false;      // 计数器 0 当前处于单次触发模式
+static uint16_t oneshot_count = 0; // 单次触发模式装入的计数初值
+static uint32_t oneshot_ticks = 0; // 它对应的滴答数
+static uint32_t tick_residue = 0;  // 提前回到周期模式时不足一个滴答的计数余数
 
 /**
  * frequency_set - 设置计数器的初始值和工作模式
@@ -45,7 +60,85 @@ static void frequency_set(uint8_t counter_port,
     // 先写入计数初值的低 8 位到计数器的端口
     outb(counter_port, (uint8_t)counter_value);
     // 再写入技术初值的高 8 位到计数器的端口
-    outb(counter_port, (uint8_t)counter_value >> 8);
+    outb(counter_port, (uint8_t)(counter_value >> 8));
+}
+
+/**
+ * @brief 从单次触发模式回到周期模式，返回单次触发期间经过的滴答数（调用者需关中断）
+ *
+ * @param expired 为 true 表示单次触发已到期（在时钟中断中调用），否则读出计数器算出已经过的时间
+ */
+static uint32_t tick_restart(bool expired)
+{
+    uint32_t elapsed = oneshot_ticks;
+    if (!expired)
+    {
+        outb(PIT_CONTROL_PORT, (uint8_t)(COUNTER_NO << 6 | READ_LATCH << 4));
+        uint16_t remain = inb(COUNTER0_PORT);
+        remain |= (uint16_t)inb(COUNTER0_PORT) << 8;
+        // 已经到期但中断还没来得及处理时，计数器从 0xffff 重新递减，按整段计算（随后的那次中断再多记一个滴答）
+        uint32_t counts = (remain > oneshot_count) ? oneshot_count : oneshot_count - remain;
+        counts += tick_residue;
+        elapsed = counts / COUNTER0_VALUE;
+        tick_residue = counts % COUNTER0_VALUE;
+        tick_stat.early_wakes++;
+    }
+    frequency_set(COUNTER0_PORT, COUNTER_NO, READ_WRITE_LATCH, COUNTER_MODE, COUNTER0_VALUE);
+    tickless = false;
+    return elapsed;
+}
+
+/**
+ * tick_stop - 停掉周期时钟，next_ticks 个滴答之后再中断一次
+ *
+ * next_ticks 超过计数器的上限时按上限计，时间轮上有更早的定时器时提前到它；不足两个滴答时不值得切换，保持周期模式。
+ * 已经处于单次触发模式时保持原来的定时不变。调用者需关中断。
+ */
+void tick_stop(uint32_t next_ticks)
+{
+    ASSERT(intr_get_status() == INTR_OFF);
+#if CONFIG_TICKLESS
+    if (tickless)
+    {
+        return;
+    }
+    if (next_ticks > TICKLESS_MAX_TICKS)
+    {
+        next_ticks = TICKLESS_MAX_TICKS;
+    }
+    next_ticks = timer_next_ticks(next_ticks);
+    if (next_ticks < 2)
+    {
+        return;
+    }
+    oneshot_ticks = next_ticks;
+    oneshot_count = (uint16_t)(next_ticks * COUNTER0_VALUE);
+    frequency_set(COUNTER0_PORT, COUNTER_NO, READ_WRITE_LATCH, COUNTER_MODE_ONESHOT, oneshot_count);
+    tickless = true;
+    tick_stat.oneshots++;
+#else
+    (void)next_ticks;
+#endif
+}
+
+/**
+ * tick_resume - 有新的线程可运行时恢复周期时钟
+ *
+ * 补记单次触发期间已经过的滴答，计入全局 ticks 和当前线程（时间片按经过的滴答扣减，不在此处调度）。
+ * 不处于单次触发模式时什么也不做。调用者需关中断。
+ */
+void tick_resume(void)
+{
+    ASSERT(intr_get_status() == INTR_OFF);
+    if (!tickless)
+    {
+        return;
+    }
+    uint32_t elapsed = tick_restart(false);
+    struct task_struct *cur_thread = running_thread();
+    cur_thread->elapsed_ticks += elapsed;
+    ticks += elapsed;
+    cur_thread->ticks = (cur_thread->ticks > elapsed) ? cur_thread->ticks - elapsed : 0;
 }
 
 /**
@@ -59,18 +152,34 @@ static void intr_timer_handler(void)
 
     ASSERT(cur_thread->stack_magic == 0x19870916); // 检查栈是否溢出，破坏了线程信息
 
-    cur_thread->elapsed_ticks++; // 记录此线程占用的 cpu 时间时钟滴答数（将线程总执行的时间加 1）
-    ticks++;                     // 从内核第一次处理时间中断后开始至今的滴答数，内核态和用户态总共的滴答数（中断总共发生的次数）
+    tick_stat.timer_irqs++;
+    uint32_t elapsed = tickless ? tick_restart(true) : 1; // 单次触发到期时一次补上期间的全部滴答，周期模式下每次一个
 
-    /* 每个线程在处理器上运行期间都会有很多次时钟中断发生，每次时钟中断处理程序都会将线程的时间片 ticks 减 1 */
-    if (cur_thread->ticks == 0) // 若进程时间片用完，就开始已调度新的进程上 CPU
+    cur_thread->elapsed_ticks += elapsed; // 记录此线程占用的 cpu 时间时钟滴答数（将线程总执行的时间加 elapsed）
+    ticks += elapsed;                     // 从内核第一次处理时间中断后开始至今的滴答数，内核态和用户态总共的滴答数
+    timer_run();                          // 执行到期的定时器（被唤醒的线程可能在下面抢占当前线程）
+
+    /* 每个线程在处理器上运行期间都会有很多次时钟中断发生，每次时钟中断处理程序都会将线程的时间片 ticks 减去经过的滴答数 */
+    if (cur_thread->ticks < elapsed) // 若进程时间片用完，就开始已调度新的进程上 CPU
     {
+        cur_thread->ticks = 0;
         schedule();
     }
     else
     {
-        cur_thread->ticks--; // 将当前进程的时间片 ticks--
-                             // 之后退出中断处理程序，也就是退出中断，让当前线程 cur_thread 继续执行
+        cur_thread->ticks -= elapsed; // 将当前进程的时间片 ticks 减去 elapsed
+                                      // 之后退出中断处理程序，也就是退出中断，让当前线程 cur_thread 继续执行
+        if (ready_preempts(cur_thread))
+        {
+            schedule(); // 就绪队列中有级别更高的线程，抢占当前线程（剩下的时间片留着下次用）
+        }
+    }
+
+    // 只有当前线程可运行时，下一个事件就是它的时间片到期（idle 线程在 hlt 之前自己停掉时钟）
+    cur_thread = running_thread();
+    if (cur_thread != idle_thread && ready_empty())
+    {
+        tick_stop(cur_thread->ticks + 1);
     }
 }
 
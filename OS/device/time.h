@@ -2,12 +2,35 @@
 #define __DEVICE_TIME_H
 
 #include "stdint.h"
+#include "bitmap.h"
+
+/* 为 1 时处理器空闲或只有一个线程可运行时停掉周期时钟，改用单次触发（tickless），为 0 时始终 100Hz 周期中断，可在 makefile 中用 -D 覆盖 */
+#ifndef CONFIG_TICKLESS
+#define CONFIG_TICKLESS 1
+#endif
+
+/* 时钟中断的统计 */
+struct tick_stat
+{
+    uint32_t timer_irqs;  // 时钟中断的次数
+    uint32_t oneshots;    // 进入单次触发模式的次数
+    uint32_t early_wakes; // 单次触发到期之前就因其他事件回到周期模式的次数
+};
+
+#define IRQ0_FREQUENCY 100 // 时钟中断频率，设为 100Hz
+#define MS_PER_TICK (1000 / IRQ0_FREQUENCY) // 一个滴答的毫秒数
+
+extern uint32_t ticks;
+extern struct tick_stat tick_stat;
 
 static void frequency_set(uint8_t counter_port,
                           uint8_t counter_no,
                           uint8_t rwl,
                           uint8_t counter_mode,
                           uint16_t counter_value);
+static uint32_t tick_restart(bool expired);
+void tick_stop(uint32_t next_ticks);
+void tick_resume(void);
 static void intr_timer_handler(void);
 void timer_init();
 
@@ -0,0 +1,323 @@
+#include "timer.h"
+#include "time.h"
+#include "interrupt.h"
+#include "memstat.h"
+#include "debug.h"
+#include "print.h"
+#include "memory.h"
+#include "thread.h"
+#include "console.h"
+#include "global.h"
+
+#define PG_SIZE 4096
+
+/***************************  分级时间轮  *********************************
+ * 定时器按到期时间与 timer_jiffies（下一个待处理的滴答）之差散列到四级时间轮上：
+ *  ① 差值小于 2^8 的按到期时间的低 8 位放入第 0 级的 256 个槽之一，每槽恰好对应一个滴答
+ *  ② 更远的按到期时间的第 8~13、14~19、20~25 位放入第 1、2、3 级的 64 个槽之一
+ * 插入和撤销都是常数时间的链表操作。每处理一个滴答只取出第 0 级当前槽中的定时器；
+ * 第 0 级转完一圈时，把第 1 级当前槽中的定时器重新散列（cascade）到第 0 级，第 1 级转完一圈时再从第 2 级散列，依此类推。
+ * 所有操作都在关中断下进行，到期函数在时钟中断中执行。
+ ***************************************************************************/
+
+struct timer_stat timer_stat;
+static struct list tv1[TVR_SIZE];             // 第 0 级
+static struct list tvn[TVN_LEVELS][TVN_SIZE]; // 第 1~3 级
+static uint32_t timer_jiffies = 0;            // 下一个待处理的滴答，它之前的滴答都已处理完毕
+
+/**
+ * @brief 初始化定时器 t，到期时调用 func(arg)
+ */
+void timer_setup(struct timer *t, timer_func *func, void *arg)
+{
+    t->func = func;
+    t->arg = arg;
+    t->expires = 0;
+    t->pending = false;
+}
+
+/**
+ * @brief 按 t->expires 把定时器放入对应的槽（调用者需关中断）
+ */
+static void timer_insert(struct timer *t)
+{
+    uint32_t expires = t->expires;
+    int32_t idx = (int32_t)(expires - timer_jiffies);
+    struct list *slot;
+    if (idx < 0)
+    {
+        // 已经过期（到期函数中重新加入、或者滴答被补记后才加入），放到下一个待处理的槽
+        slot = &tv1[timer_jiffies & TVR_MASK];
+    }
+    else if (idx < TVR_SIZE)
+    {
+        slot = &tv1[expires & TVR_MASK];
+    }
+    else
+    {
+        if ((uint32_t)idx > TIMER_MAX_DELAY)
+        {
+            expires = timer_jiffies + TIMER_MAX_DELAY; // 超出最长定时的按最长定时放置，到期前会继续逐级散列
+            idx = TIMER_MAX_DELAY;
+        }
+        uint32_t level = 0;
+        while ((uint32_t)idx >= (1u << (TVR_BITS + (level + 1) * TVN_BITS)))
+        {
+            level++;
+        }
+        slot = &tvn[level][(expires >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK];
+    }
+    list_append(slot, &t->tag);
+}
+
+/**
+ * @brief 把第 level 级（1~3 级中的下标 0~2）第 idx 个槽中的定时器重新散列到低一级的时间轮
+ */
+static void timer_cascade(uint32_t level, uint32_t idx)
+{
+    struct list *slot = &tvn[level][idx];
+    while (!list_empty(slot))
+    {
+        struct list_elem *elem = list_pop(slot);
+        struct timer *t = elem2entry(struct timer, tag, elem);
+        timer_insert(t);
+        timer_stat.cascaded++;
+    }
+}
+
+/**
+ * timer_add - 启动定时器 t，delay 个滴答之后到期
+ *
+ * t 已在时间轮上时先撤下再按新的到期时间放入（即修改定时）。delay 为 0 时按 1 计算，
+ * 在下一个滴答到期。处于 tickless 模式时先恢复周期时钟，以免新的定时器晚于单次触发的时刻。
+ */
+void timer_add(struct timer *t, uint32_t delay)
+{
+    enum intr_status old_status = intr_disable();
+    if (t->pending)
+    {
+        list_remove(&t->tag);
+    }
+    tick_resume();
+    if (delay == 0)
+    {
+        delay = 1;
+    }
+    t->expires = ticks + delay;
+    t->pending = true;
+    timer_insert(t);
+    timer_stat.added++;
+    intr_set_status(old_status);
+}
+
+/**
+ * timer_cancel - 撤销定时器 t
+ *
+ * @return: t 尚未到期而被撤销时返回 true，t 不在时间轮上（未启动或已到期）时返回 false
+ */
+bool timer_cancel(struct timer *t)
+{
+    enum intr_status old_status = intr_disable();
+    bool pending = t->pending;
+    if (pending)
+    {
+        list_remove(&t->tag);
+        t->pending = false;
+        timer_stat.cancelled++;
+    }
+    intr_set_status(old_status);
+    return pending;
+}
+
+/**
+ * timer_run - 处理到当前 ticks 为止的所有滴答，执行到期的定时器
+ *
+ * 由时钟中断处理程序在累加 ticks 之后调用（中断已关闭）。tickless 模式下一次中断可能补记多个滴答，这里逐个处理。
+ */
+void timer_run(void)
+{
+    ASSERT(intr_get_status() == INTR_OFF);
+    while ((int32_t)(ticks - timer_jiffies) >= 0)
+    {
+        uint64_t start = rdtsc();
+        uint32_t idx = timer_jiffies & TVR_MASK;
+        if (idx == 0)
+        {
+            // 第 0 级转完一圈，从高一级取下一段的定时器，高一级也转完一圈时继续向上
+            uint32_t level;
+            for (level = 0; level < TVN_LEVELS; level++)
+            {
+                uint32_t lvl_idx = (timer_jiffies >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK;
+                timer_cascade(level, lvl_idx);
+                if (lvl_idx != 0)
+                {
+                    break;
+                }
+            }
+        }
+        timer_jiffies++; // 先前移，到期函数中重新加入的已过期定时器会落到下一个待处理的槽
+
+        // 先把当前槽整个摘下，再逐个执行，到期函数可以安全地重新加入或撤销定时器
+        struct list expired;
+        list_init(&expired);
+        while (!list_empty(&tv1[idx]))
+        {
+            list_append(&expired, list_pop(&tv1[idx]));
+        }
+        while (!list_empty(&expired))
+        {
+            struct list_elem *elem = list_pop(&expired);
+            struct timer *t = elem2entry(struct timer, tag, elem);
+            t->pending = false;
+            timer_stat.expired++;
+            t->func(t->arg);
+        }
+
+        uint32_t cycles = (uint32_t)(rdtsc() - start);
+        timer_stat.runs++;
+        timer_stat.run_cycles_total += cycles;
+        if (cycles > timer_stat.run_cycles_max)
+        {
+            timer_stat.run_cycles_max = cycles;
+        }
+    }
+}
+
+/**
+ * timer_next_ticks - 返回从当前 ticks 起，至多 max_ticks 个滴答内第一个需要处理的滴答距今的滴答数
+ *
+ * 第 0 级的槽非空，或者该滴答处要从高一级散列（其中可能有即将到期的定时器）时需要处理；都没有时返回 max_ticks。
+ * 供 tickless 模式决定单次触发的时刻，只检查 max_ticks 个槽（调用者需关中断）。
+ */
+uint32_t timer_next_ticks(uint32_t max_ticks)
+{
+    if (max_ticks > TVR_SIZE)
+    {
+        max_ticks = TVR_SIZE;
+    }
+    uint32_t delta;
+    for (delta = 1; delta < max_ticks; delta++)
+    {
+        uint32_t jiffy = ticks + delta;
+        if ((int32_t)(jiffy - timer_jiffies) < 0)
+        {
+            continue; // 已处理过的滴答
+        }
+        uint32_t idx = jiffy & TVR_MASK;
+        if (idx == 0 || !list_empty(&tv1[idx]))
+        {
+            return delta;
+        }
+    }
+    return max_ticks;
+}
+
+/**
+ * @brief 初始化时间轮的各个槽（须在 timer_init 之前调用）
+ */
+void timer_wheel_init(void)
+{
+    put_str("timer_wheel_init start\n");
+    uint32_t idx;
+    for (idx = 0; idx < TVR_SIZE; idx++)
+    {
+        list_init(&tv1[idx]);
+    }
+    uint32_t level;
+    for (level = 0; level < TVN_LEVELS; level++)
+    {
+        for (idx = 0; idx < TVN_SIZE; idx++)
+        {
+            list_init(&tvn[level][idx]);
+        }
+    }
+    timer_jiffies = ticks;
+    put_str("timer_wheel_init done\n");
+}
+
+/**************************  时间轮压力测试  ******************************
+ * 同时启动 timer_cnt 个定时器，延迟在 1~TIMER_BENCH_SPAN 个滴答之间伪随机分布，每个到期后立即以新的伪随机延迟重新启动；
+ * 调用线程睡眠 ms 毫秒后撤销全部定时器，以
+ * "timer cnt=.. runs=.. expired=.. cascaded=.. cyc_hi=.. cyc_lo=.. cyc_max=.." 输出期间处理的滴答数、
+ * 到期的定时器数、重新散列的定时器数，以及处理滴答的总耗时与单个滴答的最大耗时（TSC 周期数），每滴答的平均开销即 cyc / runs。
+ * 须在线程上下文中调用。
+ ***********************************************************************/
+#define TIMER_BENCH_SPAN 2000 // 定时器的最大延迟（滴答），超过第 0 级一圈，使定时器经过重新散列
+
+static uint32_t timer_bench_seed = 1;
+
+/**
+ * @brief 返回 1~TIMER_BENCH_SPAN 之间的伪随机延迟（线性同余）
+ */
+static uint32_t timer_bench_delay(void)
+{
+    timer_bench_seed = timer_bench_seed * 1103515245 + 12345;
+    return (timer_bench_seed >> 16) % TIMER_BENCH_SPAN + 1;
+}
+
+/**
+ * @brief 测试定时器到期：以新的延迟重新启动自己
+ */
+static void timer_bench_fire(void *arg)
+{
+    timer_add((struct timer *)arg, timer_bench_delay());
+}
+
+/**
+ * @brief 测量大量定时器同时存在时时间轮处理每个滴答的开销（见上方说明）
+ */
+void timer_bench(uint32_t timer_cnt, uint32_t ms)
+{
+    uint32_t pg_cnt = DIV_ROUND_UP(timer_cnt * sizeof(struct timer), PG_SIZE);
+    struct timer *timers = get_kernel_pages(pg_cnt);
+    if (timers == NULL)
+    {
+        return;
+    }
+    enum intr_status old_status = intr_disable();
+    uint32_t runs = timer_stat.runs;
+    uint32_t expired = timer_stat.expired;
+    uint32_t cascaded = timer_stat.cascaded;
+    uint64_t cycles = timer_stat.run_cycles_total;
+    timer_stat.run_cycles_max = 0;
+    uint32_t idx;
+    for (idx = 0; idx < timer_cnt; idx++)
+    {
+        timer_setup(&timers[idx], timer_bench_fire, &timers[idx]);
+        timer_add(&timers[idx], timer_bench_delay());
+    }
+    intr_set_status(old_status);
+
+    thread_sleep(ms);
+
+    old_status = intr_disable();
+    for (idx = 0; idx < timer_cnt; idx++)
+    {
+        timer_cancel(&timers[idx]);
+    }
+    runs = timer_stat.runs - runs;
+    expired = timer_stat.expired - expired;
+    cascaded = timer_stat.cascaded - cascaded;
+    cycles = timer_stat.run_cycles_total - cycles;
+    uint32_t cycles_max = timer_stat.run_cycles_max;
+    intr_set_status(old_status);
+    mfree_page(PF_KERNEL, timers, pg_cnt);
+
+    console_acquire();
+    memstat_put_str("timer cnt=");
+    memstat_put_int(timer_cnt);
+    memstat_put_str(" runs=");
+    memstat_put_int(runs);
+    memstat_put_str(" expired=");
+    memstat_put_int(expired);
+    memstat_put_str(" cascaded=");
+    memstat_put_int(cascaded);
+    memstat_put_str(" cyc_hi=");
+    memstat_put_int((uint32_t)(cycles >> 32));
+    memstat_put_str(" cyc_lo=");
+    memstat_put_int((uint32_t)cycles);
+    memstat_put_str(" cyc_max=");
+    memstat_put_int(cycles_max);
+    memstat_put_str("\n");
+    console_release();
+}
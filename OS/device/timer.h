@@ -0,0 +1,54 @@
+#ifndef __DEVICE_TIMER_H
+#define __DEVICE_TIMER_H
+
+#include "stdint.h"
+#include "list.h"
+#include "bitmap.h"
+
+#define TVR_BITS 8                                  // 第 0 级时间轮的槽数为 2^8，每槽 1 个滴答
+#define TVN_BITS 6                                  // 第 1~3 级时间轮的槽数为 2^6，每槽是上一级一整圈
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_MASK (TVR_SIZE - 1)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TVN_LEVELS 3                                // 第 1~3 级
+#define TIMER_MAX_DELAY ((1 << (TVR_BITS + TVN_LEVELS * TVN_BITS)) - 1) // 最长定时（2^26 - 1 个滴答，100Hz 下约 7.7 天）
+
+typedef void timer_func(void *arg);
+
+/* 内核定时器，由使用者分配（可以放在栈上或结构体中），到期时在时钟中断中调用 func(arg) */
+struct timer
+{
+    struct list_elem tag; // 挂在时间轮某个槽上的节点
+    uint32_t expires;     // 到期时的 ticks
+    timer_func *func;     // 到期时调用的函数（在中断上下文中执行，不能阻塞）
+    void *arg;            // 传给 func 的参数
+    bool pending;         // 是否已加入时间轮且尚未到期
+};
+
+/* 时间轮的统计 */
+struct timer_stat
+{
+    uint32_t added;            // timer_add 的次数
+    uint32_t cancelled;        // timer_cancel 撤销了尚未到期的定时器的次数
+    uint32_t expired;          // 到期并执行的定时器数
+    uint32_t cascaded;         // 从高一级时间轮重新散列到低一级的定时器数
+    uint32_t runs;             // timer_run 处理的滴答数
+    uint32_t run_cycles_max;   // 处理一个滴答耗时的最大值（TSC 周期数）
+    uint64_t run_cycles_total; // 处理滴答耗时的总和
+};
+
+extern struct timer_stat timer_stat;
+void timer_setup(struct timer *t, timer_func *func, void *arg);
+static void timer_insert(struct timer *t);
+static void timer_cascade(uint32_t level, uint32_t idx);
+void timer_add(struct timer *t, uint32_t delay);
+bool timer_cancel(struct timer *t);
+void timer_run(void);
+uint32_t timer_next_ticks(uint32_t max_ticks);
+void timer_wheel_init(void);
+static uint32_t timer_bench_delay(void);
+static void timer_bench_fire(void *arg);
+void timer_bench(uint32_t timer_cnt, uint32_t ms);
+
+#endif
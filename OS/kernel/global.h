@@ -14,6 +14,55 @@
 #define SELECTOR_K_DATA     ((2 << 3) + (TI_GDT << 2) + RPL0)
 #define SELECTOR_K_STACK    SELECTOR_K_DATA
 #define SELECTOR_K_GS       ((3 << 3) + (TI_GDT << 2) + RPL0)
+/**
+ * 第 4 个段描述符是 TSS，第 5~8 个依次是 sysenter 使用的内核代码段、内核栈段和用户进程使用的代码段、数据段
+ * sysenter/sysexit 要求这四个描述符按此顺序相邻：sysenter 进入 IA32_SYSENTER_CS 指定的代码段（第 5 个），栈段为其后一个，
+ * sysexit 返回到其后第 2 个（用户代码段）和第 3 个（用户数据段）
+ */
+#define SELECTOR_TSS        ((4 << 3) + (TI_GDT << 2) + RPL0)
+#define SELECTOR_K_SYSENTER ((5 << 3) + (TI_GDT << 2) + RPL0)
+#define SELECTOR_U_CODE     ((7 << 3) + (TI_GDT << 2) + RPL3)
+#define SELECTOR_U_DATA     ((8 << 3) + (TI_GDT << 2) + RPL3)
+#define SELECTOR_U_STACK    SELECTOR_U_DATA
+
+// ----------------------- GDT 描述符属性 -----------------------
+#define DESC_G_4K           1
+#define DESC_D_32           1
+#define DESC_L              0           // 64 位代码标记，此处标记为 0 便可
+#define DESC_AVL            0           // cpu 不用此位，暂置为 0
+#define DESC_P              1
+#define DESC_DPL_0          0
+#define DESC_DPL_1          1
+#define DESC_DPL_2          2
+#define DESC_DPL_3          3
+#define DESC_S_CODE         1           // 代码段和数据段属于存储段，tss 和各种门描述符属于系统段（s 为 1 时表示存储段，为 0 时表示系统段）
+#define DESC_S_DATA         DESC_S_CODE
+#define DESC_S_SYS          0
+#define DESC_TYPE_CODE      8           // x=1,c=0,r=0,a=0 代码段是可执行的，非一致性，不可读，已访问位 a 清 0
+#define DESC_TYPE_DATA      2           // x=0,e=0,w=1,a=0 数据段是不可执行的，向上扩展的，可写，已访问位 a 清 0
+#define DESC_TYPE_TSS       9           // B 位为 0，不忙
+
+#define GDT_ATTR_HIGH           ((DESC_G_4K << 7) + (DESC_D_32 << 6) + (DESC_L << 5) + (DESC_AVL << 4))
+#define GDT_CODE_ATTR_LOW_DPL0  ((DESC_P << 7) + (DESC_DPL_0 << 5) + (DESC_S_CODE << 4) + DESC_TYPE_CODE)
+#define GDT_DATA_ATTR_LOW_DPL0  ((DESC_P << 7) + (DESC_DPL_0 << 5) + (DESC_S_DATA << 4) + DESC_TYPE_DATA)
+#define GDT_CODE_ATTR_LOW_DPL3  ((DESC_P << 7) + (DESC_DPL_3 << 5) + (DESC_S_CODE << 4) + DESC_TYPE_CODE)
+#define GDT_DATA_ATTR_LOW_DPL3  ((DESC_P << 7) + (DESC_DPL_3 << 5) + (DESC_S_DATA << 4) + DESC_TYPE_DATA)
+
+// ----------------------- TSS 描述符属性 -----------------------
+#define TSS_DESC_D          0
+#define TSS_ATTR_HIGH       ((DESC_G_4K << 7) + (TSS_DESC_D << 6) + (DESC_L << 5) + (DESC_AVL << 4) + 0x0)
+#define TSS_ATTR_LOW        ((DESC_P << 7) + (DESC_DPL_0 << 5) + (DESC_S_SYS << 4) + DESC_TYPE_TSS)
+
+/* GDT 中的段描述符结构（8 字节） */
+struct gdt_desc
+{
+    uint16_t limit_low_word;       // 段界限的低 16 位
+    uint16_t base_low_word;        // 段基址的低 16 位
+    uint8_t base_mid_byte;         // 段基址的 16~23 位
+    uint8_t attr_low_byte;         // P、DPL、S、TYPE
+    uint8_t limit_high_attr_high;  // 低 4 位为段界限的 16~19 位，高 4 位为 G、D/B、L、AVL
+    uint8_t base_high_byte;        // 段基址的 24~31 位
+};
 
 // ----------------------- IDT 描述符属性 -----------------------
 #define IDT_DESC_P          1
@@ -24,6 +73,16 @@
 #define IDT_DESC_ATTR_DPL0  ((IDT_DESC_P << 7) + (IDT_DESC_DPL0 << 5) + IDT_DESC_32_TYPE)
 #define IDT_DESC_ATTR_DPL3  ((IDT_DESC_P << 7) + (IDT_DESC_DPL3 << 5) + IDT_DESC_32_TYPE)
 
+// ----------------------- eflags 属性 -----------------------
+#define EFLAGS_MBS          (1 << 1)    // 此位必须为 1
+#define EFLAGS_IF_1         (1 << 9)    // if 为 1，开中断
+#define EFLAGS_IF_0         0           // if 为 0，关中断
+#define EFLAGS_IOPL_3       (3 << 12)   // IOPL3，用于测试用户程序在非系统调用下进行 IO
+#define EFLAGS_IOPL_0       (0 << 12)   // IOPL0
+
+#define DIV_ROUND_UP(X, STEP) ((X + STEP - 1) / (STEP)) // 除法向上取整
+#define UNUSED __attribute__((unused))                // 标记未使用的参数，避免编译器告警
+
 #endif
 
 
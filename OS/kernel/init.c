@@ -2,19 +2,32 @@
 #include "print.h"
 #include "interrupt.h"
 #include "time.h"
+#include "timer.h"
 #include "memory.h"
 #include "thread.h"
 #include "console.h"
 #include "keyboard.h"
+#include "serial.h"
+#include "tss.h"
+#include "syscall-init.h"
+#include "ide.h"
+#include "swap.h"
 
 /* 负责初始化所有模块 */
 void init_all()
 {
     put_str("init_all\n");
+    serial_init();   // 初始化串口 COM1（内存统计等调试信息经由它输出到宿主机）
     idt_init();      // 初始化中断
     mem_init();      // 初始化内存管理系统
     thread_init();   // 初始化线程先关结构
+    page_zero_init(); // 启动后台清 0 线程（依赖线程环境）
+    timer_wheel_init(); // 初始化定时器的时间轮
     timer_init();    // 初始化 PIT8253
     console_init();  // 初始化中断控制台（最好放在开中断之前）
     keyboard_init(); // 初始化键盘中断处理程序
+    tss_init();      // 初始化 TSS，并在 GDT 中加入用户进程的代码段、数据段
+    syscall_init();  // 初始化系统调用
+    ide_init();      // 初始化硬盘（查询方式）
+    swap_init();     // 初始化交换区（用户物理内存用尽时换出冷页）
 }
@@ -14,7 +14,8 @@
 #define GET_EFLAGS(EFLAGS_VAR) asm volatile("pushfl; \
                                              popl %0" : "=g"(EFLAGS_VAR))
 
-#define IDT_DESC_CNT 0x30 // 目前总共支持的中断数 (IR0~IR15 ———— 0x20~0x2F)
+#define IDT_DESC_CNT 0x81   // 目前总共支持的中断数（最后一个是系统调用所用的 0x80）
+#define IDT_ENTRY_CNT 0x30  // kernel.S 中由 VECTOR 宏生成的中断入口数 (异常 0x00~0x1F，IR0~IR15 ———— 0x20~0x2F)
 
 #define PIC_M_CTRL 0x20 // 主片的控制端口是 0x20
 #define PIC_M_DATA 0x21 // 主片的数据端口是 0x21
@@ -41,9 +42,10 @@ char *intr_name[IDT_DESC_CNT]; // 中断异常名数组 ———— 用来记
 intr_handler idt_table[IDT_DESC_CNT]; // 定义中断处理程序数组，在 kernel.S 中定义的 intrXXentry 只是中断处理程序的入口，最终调用的是 ide_table 中的处理程序
 
 // intr_entry_table 中全都是 intr%1entry 中断入口程序
-extern intr_handler intr_entry_table[IDT_DESC_CNT]; // 声明引用定义在 kernel.S 中的中断处理函数入口地址数组
+extern intr_handler intr_entry_table[IDT_ENTRY_CNT]; // 声明引用定义在 kernel.S 中的中断处理函数入口地址数组
                                                     // 中断描述符地址数组 ( 仅仅表明地址，用于修饰 intr_entry_table，定义在 interrupt.h 中 )
                                                     // 中断向量号 * 8 + IDTR = 中断门描述符地址
+extern uint32_t syscall_handler(void);              // 系统调用入口，定义在 kernel.S 中
 
 /**
  * @brief 初始化可编程中断控制器 8259A。
@@ -120,10 +122,13 @@ static void make_idt_desc(struct gate_desc *p_gdesc, uint8_t attr, intr_handler
 static void idt_desc_init(void)
 {
     int i;
-    for (i = 0; i < IDT_DESC_CNT; i++)
+    for (i = 0; i < IDT_ENTRY_CNT; i++)
     {
         make_idt_desc(&idt[i], IDT_DESC_ATTR_DPL0, intr_entry_table[i]);
     }
+    /* 0x30~0x7f 未使用，描述符保持全 0（P 位为 0），误触发时产生 #NP 异常 */
+    /* 单独处理系统调用，系统调用对应的中断门 dpl 为 3，中断处理程序为单独的 syscall_handler，用户进程才能通过 int 0x80 进入 */
+    make_idt_desc(&idt[0x80], IDT_DESC_ATTR_DPL3, syscall_handler);
     put_str("   idt_desc_init done\n");
 }
 
@@ -138,8 +143,9 @@ static void idt_desc_init(void)
  *
  * 函数会专门检查中断向量号 0x27 和 0x2f，这些对应于伪中断 (IRQ7 和 IRQ15)。
  * 如果中断向量号匹配 0x27 或 0x2f，则直接返回，无需进行其他操作。
+ * 其余情况交给 exception_handle，是否发生在用户态由中断栈中保存的 cs 的 RPL 判断。
  */
-static void general_intr_handler(uint8_t vec_nr)
+void general_intr_handler(uint8_t vec_nr)
 {
     // 0x2f 是从片 8259A 上最后一个 irq 引脚，保留
     if (vec_nr == 0x27 || vec_nr == 0x2f) // 0x27 和 0x2f 中断向量号对应的 IRQ7 和 IRQ15
@@ -147,6 +153,43 @@ static void general_intr_handler(uint8_t vec_nr)
         // 0x27 是从片 8259A 上的最后一个 IRQ 引脚，保留
         return; // IRQ7 和 IRQ15 会产生伪中断（spurious interrupt），无需处理
     }
+    exception_handle(vec_nr, (INTR_FRAME()->cs & 3) == 3);
+}
+
+/**
+ * exception_handle - 处理无法恢复的异常
+ *
+ * @vec_nr: 中断向量号
+ * @user_mode: 异常是否发生在 3 特权级
+ *
+ * 用户进程引发的异常（空指针、#GP、写只读页等）只结束这个进程：打印一行说明后调用 thread_exit，不再返回；
+ * 内核态的异常以及没有注册处理程序的外部中断仍然打印异常信息并悬停。
+ */
+void exception_handle(uint8_t vec_nr, bool user_mode)
+{
+    uint32_t page_fault_vaddr = 0;
+    // 如果程序运行过程中出现异常 Pagefault（只有虚拟地址，没有分配物理地址与之形成映射） 时，将会打印出导致 Pagefault 出现的虚拟地址
+    if (vec_nr == 14) // 若为 Pagefault，将缺失的地址打印出来（导致 Pagefault 的虚拟地址会被存放到控制寄存器 CR2 中）
+    {
+        // cr2 是存放造成 page_fault 的虚拟地址的寄存器
+        asm("movl %%cr2, %0" : "=r"(page_fault_vaddr));
+    }
+
+    if (user_mode && vec_nr < 0x20) // 0x20 以下是处理器异常，同步发生在当前进程中
+    {
+        struct task_struct *cur = running_thread();
+        put_str("process ");
+        put_str(cur->name);
+        put_str(" killed: ");
+        put_str(intr_name[vec_nr]);
+        if (vec_nr == 14)
+        {
+            put_str(", addr ");
+            put_int(page_fault_vaddr);
+        }
+        put_char('\n');
+        thread_exit(); // 进程的页表和用户页由 reaper 线程回收
+    }
 
     /* 将光标置为 0，从屏幕左上角清出一片(4行)打印异常信息的区域，方便阅读 */
     // 另外，程序运行时最后输出的有用信息一般都是在屏幕最下方
@@ -163,12 +206,8 @@ static void general_intr_handler(uint8_t vec_nr)
 
     set_cursor(88);             // 从第 2 行 第 8个字符开始打印
     put_str(intr_name[vec_nr]); // 打印异常名
-    // 如果程序运行过程中出现异常 Pagefault（只有虚拟地址，没有分配物理地址与之形成映射） 时，将会打印出导致 Pagefault 出现的虚拟地址
-    if (vec_nr == 14) // 若为 Pagefault，将缺失的地址打印出来并悬停（导致 Pagefault 的虚拟地址会被存放到控制寄存器 CR2 中）
+    if (vec_nr == 14)
     {
-        int page_fault_vaddr = 0;
-        // cr2 是存放造成 page_fault 的虚拟地址的寄存器
-        asm("movl %%cr2, %0" : "=r"(page_fault_vaddr));
         put_str("\npage fault addr is ");
         put_int(page_fault_vaddr);
     }
@@ -4,6 +4,12 @@
 
 typedef void *intr_handler;
 
+/**
+ * 当前中断处理程序的中断栈（struct intr_stack，定义在 thread.h 中）：kernel.S 的 VECTOR 在 call 之前压入的中断号
+ * 既是处理程序的第一个参数，也是中断栈的第一个成员。只能在由 VECTOR 直接调用的处理程序中使用。
+ */
+#define INTR_FRAME() ((struct intr_stack *)((uint32_t)__builtin_frame_address(0) + 8))
+
 /**
  * 定义中断的两种状态：
  * ① INTR_OFF 值为 0，表示关中断
@@ -17,7 +23,8 @@ enum intr_status            // 中断状态
 
 static void pic_init(void);
 static void idt_desc_init(void);
-static void general_intr_handler(uint8_t vec_nr);
+void general_intr_handler(uint8_t vec_nr);
+void exception_handle(uint8_t vec_nr, bool user_mode);
 void register_handler(uint8_t vector_no, intr_handler function);
 static void exception_init(void);
 void idt_init();
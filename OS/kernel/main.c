@@ -36,6 +36,7 @@ int main(void)
     while (1)
     {
         // console_put_str("Main ");
+        thread_block(TASK_BLOCKED); // 主线程已无事可做，阻塞自己把处理器让出来（没有线程可运行时由 idle 线程 hlt），不再空转
     }
 
     return 0;
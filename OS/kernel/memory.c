@@ -5,374 +5,3103 @@
 #include "debug.h"
 #include "print.h"
 #include "string.h"
+#include "interrupt.h"
+#include "thread.h"
+#include "memstat.h"
+#include "process.h"
+#include "swap.h"
 
 #define PG_SIZE 4096 // 页的大小（4096B，4K）
 
 #define PDE_IDX(addr) ((addr & 0xffc00000) >> 22) // 返回虚拟地址的高 10 位（用于在页目录表中定位 pde）
 #define PTE_IDX(addr) ((addr & 0x003ff000) >> 12) // 返回虚拟地址的中间 10 位（用于在页表中定位 pte）
 
-/****************************  内存位图的基址  *******************************
- * 因为 0xc009f000 是内核主线程 main 栈顶, 0xc009e000 是内核主线程的 PCB 起始地址。
- * 一个页框大小的位图可表示 128MB 内存（4096 * 8 * 4K = 128MB）, 位图位置安排在地址 0xc009a000（0xc009a000~0xc009dfff），可表示 512MB
- * 这样本系统最大支持 4 个页框的位图，即 512MB 内存
- *
- *********************************************************************/
-#define MEM_BITMAP_BASE 0xc009a000
+/****************************  内存管理元数据的位置  *******************************
+ * 内存池位图、虚拟地址池位图、伙伴系统各阶的位图及它们的摘要索引统称为元数据，其大小与物理内存容量成正比
+ * （4GB 内存时约 400KB），无法再放进 0xc009a000~0xc009dfff 这 16KB 的固定窗口中。
+ * 因此元数据改为从页表之上的第一段可用物理内存中按需划出若干页，映射到虚拟地址 K_META_START 起，
+ * 内核堆紧随其后，并且堆的虚拟地址不能越过 K_HEAP_END（最后一个页目录项用于访问页目录表自身）。
+ ***********************************************************************************/
+#define K_META_START 0xc0100000 // 元数据的起始虚拟地址（跨过低端 1MB）
+#define K_HEAP_END 0xffc00000   // 内核堆虚拟地址的上界（第 1023 个页目录项指向页目录表自身）
 
-/* 0xc0000000 是内核从虚拟地址 3G 起。0x100000 意指跨过低端 1MB 内存, 使虚拟地址在逻辑上连续 */
-// 内核所使用的堆空间的起始虚拟地址
-#define K_HEAP_START 0xc0100000 // 内核也需要动态申请内存来完成某项工作，动态申请的内存都是在堆空间中完成的，
-                                // 我们为此也定义了内核所用的堆空间，堆也是内存，内存就得有地址，从 0xc0100000 虚拟地址开始分配
+#define BUDDY_MAX_BLOCK (PG_SIZE << MAX_ORDER) // 伙伴系统最大块的字节数（4MB）
 
-// 物理内存池结构，用于物理地址管理，生成两个实例用于管理 内核内存池 和 用户内存池 中的所有物理内存
-struct pool
-{
-    struct bitmap pool_bitmap; // 本内存池用到的位图结构（以页为单位，管理物理内存地址的分配情况）
-    uint32_t phy_addr_start;   // 本内存池所管理物理内存的起始地址
-    uint32_t pool_size;        // 本内存池字节容量（因为物理地址是有限的）
-};
+#define PG_HUGE_PAGES (1 << MAX_ORDER) // 一个 4MB 大页所含的 4KB 页数，恰好是伙伴系统最大块的页数
+#define KERNEL_PDE_START 768           // 内核空间（0xc0000000 起）的第一个页目录项下标
 
-struct pool kernel_pool, user_pool; // 生成 物理内核内存池 和 物理用户内存池
-struct virtual_addr kernel_vaddr;   // 此虚拟内存池用于给内核分配虚拟地址（起始地址为 0xc0100000）———— 内核所使用的堆空间的起始虚拟地址
-                                    // 0xc0000000 是内核从虚拟地址 3G 起。0x100000 意指跨过低端 1MB 内存, 使虚拟地址在逻辑上连续
 
-/**
- * @brief 初始化物理内存池
- *
- * 根据所有内存容量 all_mem 的大小初始化 物理内核内存池 和 物理用户内存池
- *
- * @param all_mem 物理内存总量
- */
-static void mem_pool_init(uint32_t all_mem)
+/**************************  loader 交给内核的内存信息  ***************************
+ * loader 通过 BIOS 0x15 中断的 0xe820 子功能把内存布局（ARDS 结构数组）保存在 ards_buf 中，数量保存在 ards_nr 中，
+ * 它们紧随 total_mem_bytes（0xb00）和 gdt_ptr（6 字节）之后。低端 1MB 已映射到 0xc0000000 起，这里通过高端地址访问。
+ * 若 0xe820 失败（ards_nr 为 0），只能退回使用 total_mem_bytes，把 [0, total_mem_bytes) 当作一整段可用内存。
+ *******************************************************************************/
+#define ARDS_BUF_ADDR 0xc0000b0a // ards_buf 的虚拟地址
+#define ARDS_NR_ADDR 0xc0000bfe  // ards_nr 的虚拟地址
+#define ARDS_MAX 12              // ards_buf 最多容纳的 ARDS 数量（与 boot.inc 中的 ARDS_MAX 一致）
+#define E820_USABLE 1            // ARDS 类型 1：可被操作系统使用的内存
+
+/* 地址范围描述符（Address Range Descriptor Structure） */
+struct ards
 {
-    put_str("   mem_pool_init start\n");
+    uint32_t base_low;    // 基地址的低 32 位
+    uint32_t base_high;   // 基地址的高 32 位
+    uint32_t length_low;  // 长度的低 32 位
+    uint32_t length_high; // 长度的高 32 位
+    uint32_t type;        // 内存类型
+};
 
-    // 页表大小（256 个页框） = 1 页大小的页目录表 + 第 0 和 第 768 个页目录项指向同一个页表（对应低端4MB）+ 第 769~1022 个页目录项共指向 254 个页表
-    // （第 1023 个 pde 指向页目录表，不重复计算空间）（1GB~3GB的用户空间还未分配页表）
-    uint32_t page_table_size = PG_SIZE * 256; // 记录页目录项和页表占用的字节大小，总大小=页目录表大小+所有页表大小
+/* 一段按页对齐的可用物理内存 [start, end) */
+struct mem_range
+{
+    uint32_t start;
+    uint32_t end;
+};
 
-    uint32_t used_mem = page_table_size + 0x100000; // 已使用的内存字节数 = 页目录项和页表占用的字节大小 + 低端 1MB 内存
-    uint32_t free_mem = all_mem - used_mem;         // 可用内存 = 总内存 - 已使用内存
-    uint16_t all_free_pages = free_mem / PG_SIZE;   // 将剩余内存转换成页数（1 页 为 4K，不管总内存是不是 4K 的倍数，不足 1 页的内存被忽略）
+static struct mem_range usable_ranges[ARDS_MAX]; // 已排序、合并的可用内存段（只含 4GB 以下、已用内存之上的部分）
+static uint32_t usable_range_cnt = 0;
 
-    uint16_t kernel_free_pages = all_free_pages / 2;               // 存储分配给 内核物理内存池 的空闲物理页数量
-    uint16_t user_free_pages = all_free_pages - kernel_free_pages; // 把分配给内核后剩余的空闲物理页作为 用户物理内存池 的空闲物理页
+/* 一般的申请按 HIGH -> NORMAL -> DMA 的顺序退而求其次，把低端的页框尽量留给有地址限制的申请 */
+static const enum zone_type zone_fallback[ZONE_CNT] = {ZONE_HIGH, ZONE_NORMAL, ZONE_DMA};
 
-    /**
-     * 为了简化位图操作，余数不处理
-     * ① 坏处：会丢失内存，(1~7页)*2 的内存 ———— 内核物理内存池+用户物理内存池
-     * ② 好处：不用做内存的越界检测，因为位图表示的内存少于实际物理内存
-     */
-    uint32_t kbm_length = kernel_free_pages / 8; // 内核物理内存池的字节长度（因为位图中的 1 位表示 1 页，以字节为单位，故用 kernel_free_pages 除以 8 以获得位图的字节长度）
-    uint32_t ubm_length = user_free_pages / 8;   // 用户物理内存池的字节长度
+/************************  内存仓库 arena 元信息  ************************
+ * 一个 arena 占 1 页或多页，页的开头是此结构，其后的空间被划分成同一规格的内存块，
+ * 大于 1024 字节的分配直接占用若干整页，此时 large 为 true，cnt 表示页框数。
+ ***********************************************************************/
+struct arena
+{
+    struct mem_block_desc *desc; // 此 arena 关联的 mem_block_desc（large 为 true 时为 NULL）
+    uint32_t cnt;                // large 为 false 时表示空闲 mem_block 的数量，为 true 时表示页框数
+    bool large;
+};
 
-    uint32_t kp_start = used_mem;                               // 内核物理内存池的起始地址
-    uint32_t up_start = kp_start + kernel_free_pages * PG_SIZE; // 用户物理内存池的起始地址
+struct mem_block_desc k_block_descs[DESC_CNT]; // 内核内存块描述符数组
 
-    // 用以上的两个物理起始地址初始化各自内存池的起始地址（内核物理内存池起始地址 和 用户物理内存池起始地址）
-    kernel_pool.phy_addr_start = kp_start;
-    user_pool.phy_addr_start = up_start;
+struct pool kernel_pool, user_pool; // 生成 物理内核内存池 和 物理用户内存池
 
-    // 用各自的内存池中的容量字节数（物理页书 * PG_SIZE）初始化各自内存池的 pool_size
-    kernel_pool.pool_size = kernel_free_pages * PG_SIZE;
-    user_pool.pool_size = user_free_pages * PG_SIZE;
+static bool pse_enabled = false; // 处理器是否支持并已开启 4MB 大页（CR4.PSE）
+uint32_t *kernel_pgdir;          // 内核页目录表（物理地址 KERNEL_PGDIR_PHY）的虚拟地址，用于在进程的地址空间中同步内核页目录项
+bool pge_enabled = false;        // 处理器是否支持并已开启全局页（CR4.PGE），开启后内核空间的映射都带 G 位
 
-    // 用各自物理内存池的位图字节长度 kbm_length 和 ubm_length 初始化各自内存池中的位图字节长度成员
-    kernel_pool.pool_bitmap.btmp_bytes_len = kbm_length;
-    user_pool.pool_bitmap.btmp_bytes_len = ubm_length;
+/*************************  预先清 0 的页框  *************************
+ * 后台线程 page_zero_thread 以最低优先级从内核物理内存池取出空闲页框，
+ * 通过临时映射窗口 zero_window 清 0 后放入 zeroed_frames，
+ * get_kernel_pages 和新建页表时优先从这里取页框，从而省去关键路径上的清 0。
+ * zeroed_frames 中的页框在内存池中记为已分配。
+ *********************************************************************/
+#define ZERO_STASH_SIZE 32 // 最多保存的预先清 0 的页框数
+#define ZERO_STASH_LOW 16  // 低于此数量时唤醒后台线程补充
 
-    /************ 初始化 内核物理内存池位图 和 用户物理内存池位图 ************
-     * 位图是全局的数组，长度不可定。
-     * 全局或静态的数组需要在编译时知道其长度,
-     * 而我们需要根据内存池大小计算出位图需要多少字节, （位图的长度取决于具体要管理的内存页数量，因此是无法预计），所以必须在一块内存存在它们的位图。
-     ********************************************************/
-    // 内核内存池的位图的起始地址是0xc009a000, 这是主线程序的栈地址
-    // (内核的大约预订了70KB左右)
-    // 32MB内存的位图长度为2KB ———— 2K*1024*1024*4K=32MB
+static uint32_t zeroed_frames[ZERO_STASH_SIZE];
+static uint32_t zeroed_cnt = 0;
+static uint32_t zero_window = 0;                 // 后台线程清 0 时临时映射页框用的虚拟页
+static uint32_t copy_window = 0;                 // 复制页框内容时临时映射目标页框用的虚拟页（使用时须关中断）
+static struct task_struct *zero_thread = NULL;   // 后台清 0 线程
+static bool zero_thread_idle = false;            // 后台线程是否因无事可做而阻塞
+struct page_zero_stat page_zero_stat;            // 清 0 工作的统计
 
-    // 内核物理内存池的位图位于 MEM_BITMAP_BASE (0xc009a000) 处
-    kernel_pool.pool_bitmap.bits = (void *)MEM_BITMAP_BASE;
+struct reservoir_stat reservoir_stat[RS_CNT]; // 内核与用户两侧的配额与借用统计
 
-    // 用户物理内存池的位图位于 MEM_BITMAP_BASE (0xc009a000) + kbm_length
-    user_pool.pool_bitmap.bits = (void *)(MEM_BITMAP_BASE + kbm_length);
+static struct lazy_region lazy_regions[LAZY_REGION_CNT]; // 按需分配区域表
 
-    /************************* 输出内存池信息 *************************/
-    // 包括 内存池的所用位图的起始物理地址 和 内存池的起始物理地址
-    put_str("       kernel_pool_bitmap_start: ");
-    put_int((int)kernel_pool.pool_bitmap.bits);
-    put_str(" kernel_pool_phy_addr_start: ");
-    put_int(kernel_pool.phy_addr_start);
-    put_str("\n");
-    put_str("       user_pool_bitmap_start: ");
-    put_int((int)user_pool.pool_bitmap.bits);
-    put_str(" user_pool_phy_addr_start: ");
-    put_int(user_pool.phy_addr_start);
-    put_str("\n");
+/* 内核页目录项被替换为 4MB 大页前的原值（指向 loader 预先建好的页表），释放大页时用它恢复 */
+static uint32_t pse_saved_pde[1023 - KERNEL_PDE_START];
+/**********************  内核虚拟地址的空闲段  **********************
+ * 默认用两棵 AVL 树管理内核堆中的空闲段（extent），而不是逐页的位图：
+ *  ① vaddr_addr_tree 按起始页号排序，释放时据此找到前后相邻的空闲段并合并
+ *  ② vaddr_size_tree 按 (页数, 起始页号) 排序，申请时取第一个不小于所需页数的段，即最佳适配（同样大小取地址最低的）
+ * 申请与释放都是 O(log n)（n 为空闲段数），与内核堆的大小无关。CONFIG_VADDR_BITMAP 为 1 时退回位图实现。
+ *********************************************************************/
+static struct avl_tree vaddr_addr_tree;
+static struct avl_tree vaddr_size_tree;
+static struct vaddr_extent *extent_free_list = NULL; // 空闲的结点，经 addr_node.left 串联
+static uint32_t kvaddr_pages = 0;                    // 内核堆虚拟地址的总页数
 
-    /* 将物理内存池位图初始化为 0 */
-    // 0 代表位对应的内存页未分配
-    // 1 代表位对应的内存页已分配
-    bitmap_init(&kernel_pool.pool_bitmap);
-    bitmap_init(&user_pool.pool_bitmap);
+struct virtual_addr kernel_vaddr;   // 此虚拟内存池用于给内核分配虚拟地址（起始于元数据之后）———— 内核所使用的堆空间的起始虚拟地址
+                                    // 0xc0000000 是内核从虚拟地址 3G 起。0x100000 意指跨过低端 1MB 内存, 使虚拟地址在逻辑上连续
 
-    /* 下面初始化内核虚拟内存地址池位图 */
-    // 用于维护内核堆的虚拟地址，所以要和物理内核内存池大小一致
-    kernel_vaddr.vaddr_bitmap.btmp_bytes_len = kbm_length;
+static uint32_t mem_meta_next = K_META_START; // 元数据区域中下一块未分配内存的地址（供 mem_meta_alloc 使用）
+static uint32_t mem_meta_end = K_META_START;  // 元数据区域的上界（由 mem_meta_map 确定）
 
-    /* 内核虚拟内存池的位图的数组指向一块未使用的内存，目前将其安排在紧挨着内核物理内存池和用户物理内存池所用的位图之后 */
-    kernel_vaddr.vaddr_bitmap.bits = (void *)(MEM_BITMAP_BASE + kbm_length + ubm_length);
+/**
+ * @brief 在位图区域中为内存管理的元数据（位图、摘要索引等）分配一块内存
+ *
+ * 元数据在初始化时一次性分配、永不释放，所以简单地按 4 字节对齐依次向后划分即可。
+ *
+ * @param size 需要的字节数
+ * @return void* 分配到的内存起始地址
+ */
+static void *mem_meta_alloc(uint32_t size)
+{
+    uint32_t addr = (mem_meta_next + 3) & 0xfffffffc;
+    mem_meta_next = addr + size;
+    // 不能越过 mem_meta_map 映射好的区域（mem_meta_estimate 的估算偏小时会在这里发现）
+    ASSERT(mem_meta_next <= mem_meta_end);
+    return (void *)addr;
+}
 
-    // 在 loader 中我们已经通过设置页表把虚拟地址 0xc0000000~0xc00fffff 映射到了物理地址 0x00000000~0x000fffff（低端 1MB 内存）
-    // 0xc0100000 是用于给内核动态堆分配内存的虚拟地址
-    kernel_vaddr.vaddr_start = K_HEAP_START; // 虚拟内核内存池的起始地址为 0xc0100000
-    bitmap_init(&kernel_vaddr.vaddr_bitmap);
-    put_str("   mem_pool_init done\n");
+/**
+ * @brief 估算一个 bits 位的位图连同其摘要索引在 mem_meta_alloc 中占用的字节数（含对齐的损耗）
+ */
+static uint32_t mem_meta_bitmap_bytes(uint32_t bits)
+{
+    uint32_t len = (bits + 7) / 8;
+    return ((len + 3) & 0xfffffffc) + bitmap_summary_bytes(len) + 4;
 }
 
 /**
- * @brief 在虚拟内存池中申请指定页数的虚拟页
+ * @brief 估算管理跨度为 span_pages 页的物理内存所需的元数据字节数（只会偏大）
  *
- * 该函数在 pf 表示的虚拟内存池中申请 pg_cnt 个虚拟页，成功则返回虚拟页的起始地址，失败则返回 NULL。
+ * 两个物理内存池的 pool_bitmap、lent_bitmap 以及内核虚拟地址池的位图各自都不超过 span_pages 位，空闲段结点表不超过 kvaddr_nodes(span_pages) 项，
+ * 两个物理内存池的页引用计数各自不超过 span_pages 项；
+ * 每个内存池的伙伴系统第 k 阶约有 (span_pages + 2^MAX_ORDER) >> k 个块（buddy_base 向下对齐最多多出 2^MAX_ORDER 页）。
+ */
+static uint32_t mem_meta_estimate(uint32_t span_pages)
+{
+    uint32_t bytes = mem_meta_bitmap_bytes(span_pages) * 5;
+    uint32_t order;
+    for (order = 0; order <= MAX_ORDER; order++)
+    {
+        bytes += mem_meta_bitmap_bytes(((span_pages + PG_HUGE_PAGES) >> order) + 1) * 2;
+    }
+    bytes += span_pages * sizeof(uint16_t) * 2 + 8;
+    return bytes + kvaddr_nodes(span_pages) * sizeof(struct vaddr_extent);
+}
+
+/**
+ * @brief 把物理地址 meta_phy 起的 meta_pages 页映射到 K_META_START 起，作为元数据区域
  *
- * 针对内核内存池和用户内存池不同处理，暂未实现用户内存池。
+ * 内核空间的页目录项在 loader 中已全部建好，这里只需填写页表项。
+ */
+static void mem_meta_map(uint32_t meta_phy, uint32_t meta_pages)
+{
+    uint32_t pg_idx;
+    for (pg_idx = 0; pg_idx < meta_pages; pg_idx++)
+    {
+        uint32_t *pte = pte_ptr(K_META_START + pg_idx * PG_SIZE);
+        ASSERT(!(*pte & PG_P_1));
+        *pte = ((meta_phy + pg_idx * PG_SIZE) | PG_US_S | PG_RW_W | PG_P_1);
+    }
+    mem_meta_next = K_META_START;
+    mem_meta_end = K_META_START + meta_pages * PG_SIZE;
+}
+
+/**
+ * @brief 为位图 btmp 分配位图本身及其摘要索引所需的内存，并初始化为全 0
  *
- * @param enum pool_flags pf 内存池标志（内核或用户物理内存池）
- * @param uint32_t pg_cnt 申请的页数
- * @return void* 成功返回虚拟页起始地址，失败返回NULL
+ * @param btmp 指向位图结构的指针（btmp_bytes_len 需已赋值）
  */
-static void *vaddr_get(enum pool_flags pf, uint32_t pg_cnt)
+static void mem_bitmap_setup(struct bitmap *btmp)
 {
-    int vaddr_start = 0;    // 存储分配的起始虚拟地址
-    int bit_idx_start = -1; // 存储位图扫描函数 bitmap_scan 的返回值，默认为 -1
-    uint32_t cnt = 0;       // cnt 为连续空闲位的个数
-    if (pf == PF_KERNEL)    // 判断是否是在内核虚拟地址池中申请地址
+    btmp->bits = mem_meta_alloc(btmp->btmp_bytes_len);
+    btmp->summary = mem_meta_alloc(bitmap_summary_bytes(btmp->btmp_bytes_len));
+    bitmap_init(btmp);
+}
+
+/**
+ * @brief 将块 block_idx 作为第 order 阶的空闲块放入伙伴系统
+ */
+static void buddy_mark_free(struct pool *m_pool, uint32_t block_idx, uint32_t order)
+{
+    bitmap_set(&m_pool->free_area[order].free_map, block_idx, 0);
+    m_pool->free_area[order].nr_free++;
+}
+
+/**
+ * @brief 返回页号 pg_idx（相对 buddy_base）所在的物理内存区域
+ */
+static struct zone *pg_zone(struct pool *m_pool, uint32_t pg_idx)
+{
+    uint32_t zone_idx;
+    for (zone_idx = 0; zone_idx < ZONE_CNT - 1; zone_idx++)
     {
-        bit_idx_start = bitmap_scan(&kernel_vaddr.vaddr_bitmap, pg_cnt); // 扫描内核虚拟地址池中的位图
-        // 内核虚拟地址池的位图中没有连续 pg_cnt 个空闲位
-        if (bit_idx_start == -1)
-        {
-            return NULL;
-        }
-        while (cnt < pg_cnt)
+        if (pg_idx < m_pool->zones[zone_idx].end_pg)
         {
-            // 根据申请的页数量 pg_cnt，逐次调用 bitmap_set 函数将内核虚拟地址池的位图相应位置 1
-            bitmap_set(&kernel_vaddr.vaddr_bitmap, bit_idx_start + cnt++, 1);
+            break;
         }
-        // 将 bit_idx_start 转换为虚拟地址（虚拟内核内存池的起始地址为 0xc0100000）
-        // 位图中起始位索引 bit_idx_start 相对于内存池的虚拟页偏移地址 bit_idx_start * PG_SIZE（位图的 1bit 代表实际 1K 大小的内存）
-        vaddr_start = kernel_vaddr.vaddr_start + bit_idx_start * PG_SIZE;
     }
-    else
+    return &m_pool->zones[zone_idx];
+}
+
+/**
+ * @brief 按物理地址边界划分内存池 m_pool 的各个区域（须在 buddy_base 确定之后、加入空闲块之前调用）
+ */
+static void zone_init(struct pool *m_pool)
+{
+    static const uint32_t zone_end[ZONE_CNT] = {ZONE_DMA_END, ZONE_NORMAL_END, 0};
+    uint32_t pool_end_pg = (m_pool->phy_addr_start + m_pool->pool_size - m_pool->buddy_base) / PG_SIZE;
+    uint32_t start_pg = 0;
+    uint32_t zone_idx;
+    for (zone_idx = 0; zone_idx < ZONE_CNT; zone_idx++)
     {
-        // 用户内存池，将来实现用户进程时再补充
+        struct zone *zone = &m_pool->zones[zone_idx];
+        uint32_t end_pg = pool_end_pg;
+        if (zone_idx < ZONE_CNT - 1)
+        {
+            // 区域上界换算成相对 buddy_base 的页号，并限制在 [start_pg, pool_end_pg] 之内
+            end_pg = zone_end[zone_idx] <= m_pool->buddy_base ? 0 : (zone_end[zone_idx] - m_pool->buddy_base) / PG_SIZE;
+            end_pg = end_pg < start_pg ? start_pg : (end_pg > pool_end_pg ? pool_end_pg : end_pg);
+        }
+        zone->start_pg = start_pg;
+        zone->end_pg = end_pg;
+        zone->present_pages = 0;
+        zone->free_pages = 0;
+        zone->watermark = 0;
+        start_pg = end_pg;
     }
-    return (void *)vaddr_start; // 将 vaddr_start 转换成指针后返回
 }
 
 /**
- * @brief 获取虚拟地址 vaddr 对应的页表项 pte 指针（指针的值是虚拟地址）
- *
- * 该函数接受虚拟地址 vaddr，返回对应页表项 pte 的指针，利用虚拟地址计算出页表项所在的物理地址。
+ * @brief 初始化物理内存池 m_pool 的伙伴系统
  *
- * @param uint32_t vaddr 虚拟地址
+ * 先把各阶的块全部标记为不可用，再把 [phy_addr_start, phy_addr_start + pool_size) 中每一段连续的可用页（pool_bitmap 中为 0）
+ * 拆成尽可能大的、天然对齐的块放入对应阶中，
+ * 按这种方式拆出来的块不会出现同一阶两个伙伴同时空闲的情况（否则它们本可以合并成更大的一块）。
  *
- * @return uint32_t* 对应页表项 pte 的指针（能够访问 vaddr 所在的 pte 的虚拟地址）
+ * @param m_pool 指向物理内存池的指针
  */
-uint32_t *pte_ptr(uint32_t vaddr)
+static void buddy_init(struct pool *m_pool)
 {
-    // 最后一个页目录项里写的是页目录表自己的物理地址，目的是为了通过此页目录项编辑页表
+    uint32_t pool_end = m_pool->phy_addr_start + m_pool->pool_size;
+    m_pool->buddy_base = m_pool->phy_addr_start & ~(BUDDY_MAX_BLOCK - 1);
+    uint32_t pg_total = (pool_end - m_pool->buddy_base) / PG_SIZE; // 块编号覆盖的页数
 
-    /** 通过页表映射获取页表项的地址
-     * ① 先访问到页表自己
-     * ② 再用页目录项 PDE（页目录项的索引）作为 pte 的索引访问页表
-     * ③ 再用 pte 的索引作为内偏移
-     */
-    uint32_t *pte = (uint32_t *)(0xffc00000 +                   // 0xffc00000 中的前 10 位代表 第 1023 个页表项
-                                 ((vaddr & 0xffc00000) >> 10) + // 用 vaddr 的前 10 位索引页目录项（此页目录项中记录的是页表的物理地址）
-                                 PTE_IDX(vaddr) * 4);           // 用 vaddr 的中 10 位索引页表项（页表项索引 * 4B = 页表项的物理地址） ———— 每个页表项大小为 4B
+    uint32_t order;
+    for (order = 0; order <= MAX_ORDER; order++)
+    {
+        struct bitmap *map = &m_pool->free_area[order].free_map;
+        uint32_t blocks = (pg_total + (1 << order) - 1) >> order;
+        map->btmp_bytes_len = (blocks + 7) / 8;
+        mem_bitmap_setup(map);
+        bitmap_set_range(map, 0, map->btmp_bytes_len * 8, 1); // 先全部置为不可用
+        m_pool->free_area[order].nr_free = 0;
+    }
+    zone_init(m_pool);
 
-    return pte;
+    /* 只把 pool_bitmap 中空闲的页（即可用内存）加入伙伴系统，内存空洞中的页在 pool_bitmap 中已被置 1 */
+    uint32_t pg_offset = (m_pool->phy_addr_start - m_pool->buddy_base) / PG_SIZE;
+    uint32_t bit_cnt = m_pool->pool_size / PG_SIZE;
+    uint32_t bit_idx = 0;
+    while (bit_idx < bit_cnt)
+    {
+        if (bitmap_scan_test(&m_pool->pool_bitmap, bit_idx))
+        {
+            bit_idx++;
+            continue;
+        }
+        uint32_t run_end = bit_idx;
+        while (run_end < bit_cnt && !bitmap_scan_test(&m_pool->pool_bitmap, run_end))
+        {
+            run_end++;
+        }
+
+        uint32_t pg_idx = pg_offset + bit_idx;
+        uint32_t pg_end = pg_offset + run_end;
+        while (pg_idx < pg_end)
+        {
+            // 找出以 pg_idx 开头、天然对齐且不越过这段空闲内存末尾的最大块
+            order = MAX_ORDER;
+            while ((pg_idx & ((1 << order) - 1)) || pg_idx + (1 << order) > pg_end)
+            {
+                order--;
+            }
+            buddy_mark_free(m_pool, pg_idx >> order, order);
+            pg_zone(m_pool, pg_idx)->present_pages += 1 << order;
+            pg_idx += 1 << order;
+        }
+        bit_idx = run_end;
+    }
+
+    uint32_t zone_idx;
+    for (zone_idx = 0; zone_idx < ZONE_CNT; zone_idx++)
+    {
+        m_pool->zones[zone_idx].free_pages = m_pool->zones[zone_idx].present_pages;
+    }
+    // ZONE_DMA 保留四分之一（最多 ZONE_DMA_RESERVE 页）给必须位于 16MB 以下的申请
+    struct zone *dma = &m_pool->zones[ZONE_DMA];
+    dma->watermark = dma->present_pages / 4 < ZONE_DMA_RESERVE ? dma->present_pages / 4 : ZONE_DMA_RESERVE;
 }
 
 /**
- * @brief 获取虚拟地址 vaddr 对应的页目录项 pde 的指针（指针的值是虚拟地址）
- *
- * 该函数接受虚拟地址 vaddr，返回对应页目录项 pde 的指针，利用虚拟地址计算出页目录项所在的物理地址。
- *
- * 目前页表中不存在的虚拟地址， pte_ptr 和 pde_ptr 这两个函数只是根据虚拟地址转换的规则计算出 vaddr 对应的 pte 及 pde 的虚拟地址，与 vaddr 所在的 pte 及 pde 是否存在无关。
+ * @brief 从伙伴系统中分配一个第 order 阶的块（2^order 个连续且天然对齐的物理页）
  *
- * @param uint32_t vaddr 虚拟地址
+ * 从第 order 阶开始向上找到第一个在区域 zone_idx 中有空闲块的阶，取出一块后逐级对半拆分，拆出的右半块放回低一阶，
+ * 整个过程最多经过 MAX_ORDER 阶，为 O(log n)。调用者需保证已关中断。
  *
- * @return uint32_t* 对应页目录项 pde 的指针
+ * @param m_pool 指向物理内存池的指针
+ * @param order 块的阶
+ * @param zone_idx 块必须位于的物理内存区域
+ * @return int 块的首页相对 buddy_base 的页号，失败返回 -1
  */
-uint32_t *pde_ptr(uint32_t vaddr)
+static int buddy_alloc(struct pool *m_pool, uint32_t order, enum zone_type zone_idx)
 {
-    /* 通过页目录表获取页目录项的地址 */
-    // 0xfffff000 对应的的还是页目录表的物理地址
-    uint32_t *pde = (uint32_t *)(0xfffff000 + PDE_IDX(vaddr) * 4); // 此时指针变量 pde 指向 vaddr 所在的 pde
-    return pde;
+    struct zone *zone = &m_pool->zones[zone_idx];
+    if (zone->free_pages < (1U << order))
+    {
+        return -1;
+    }
+
+    uint32_t cur;
+    int block_idx = -1;
+    for (cur = order; cur <= MAX_ORDER; cur++)
+    {
+        if (m_pool->free_area[cur].nr_free == 0)
+        {
+            continue;
+        }
+        // 只在区域对应的块号范围内查找
+        uint32_t blk_start = zone->start_pg >> cur;
+        uint32_t blk_end = (zone->end_pg + (1 << cur) - 1) >> cur;
+        block_idx = bitmap_scan_range(&m_pool->free_area[cur].free_map, blk_start, blk_end);
+        if (block_idx != -1)
+        {
+            break;
+        }
+    }
+    if (block_idx == -1)
+    {
+        return -1; // 区域中没有足够大的空闲块
+    }
+
+    bitmap_set(&m_pool->free_area[cur].free_map, block_idx, 1);
+    m_pool->free_area[cur].nr_free--;
+    zone->free_pages -= 1 << order;
+
+    /* 逐级拆分：保留左半块继续拆，右半块（伙伴）放回低一阶的空闲集合 */
+    while (cur > order)
+    {
+        cur--;
+        block_idx <<= 1;
+        buddy_mark_free(m_pool, block_idx + 1, cur);
+    }
+    return block_idx << order;
 }
 
 /**
- * @brief 在物理内存池中分配一页物理内存
+ * @brief 将相对 buddy_base 的页号为 pg_idx 的第 order 阶块释放回伙伴系统
  *
- * 该函数在 m_pool 指向的物理内存池中分配 1 页物理内存，成功返回页框的物理地址，失败返回 NULL。
+ * 若伙伴块也空闲，就把伙伴从它所在的阶中取出，与本块合并成高一阶的块后继续向上检查，
+ * 最多合并到 MAX_ORDER 阶，为 O(log n)。调用者需保证已关中断。
  *
- * @param struct pool* m_pool 指向物理内存池的指针
- * @return void* 成功返回分配的物理页地址，失败返回 NULL
+ * 由于合并只检查伙伴是否空闲，一个第 k 阶的块也可以逐页按第 0 阶释放，最终同样会合并回完整的块。
+ *
+ * @param m_pool 指向物理内存池的指针
+ * @param pg_idx 块的首页相对 buddy_base 的页号
+ * @param order 块的阶
  */
-static void *palloc(struct pool *m_pool)
+static void buddy_free(struct pool *m_pool, uint32_t pg_idx, uint32_t order)
 {
-    /* 扫描或设置位图要保持原子操作，分配一个物理页面 */
-    int bit_idx = bitmap_scan(&m_pool->pool_bitmap, 1); // 返回在位图中的起始索引位
-    if (bit_idx == -1)
+    uint32_t free_order = order; // 合并会改变 order，区域统计按释放的大小计
+    uint32_t block_idx = pg_idx >> order;
+    while (order < MAX_ORDER)
     {
-        return NULL; // 分配失败
+        struct bitmap *map = &m_pool->free_area[order].free_map;
+        uint32_t buddy_idx = block_idx ^ 1;
+        if (buddy_idx >= map->btmp_bytes_len * 8 || bitmap_scan_test(map, buddy_idx))
+        {
+            break; // 伙伴不空闲，不能合并
+        }
+        bitmap_set(map, buddy_idx, 1);
+        m_pool->free_area[order].nr_free--;
+        block_idx >>= 1;
+        order++;
     }
-    bitmap_set(&m_pool->pool_bitmap, bit_idx, 1);                           // 将 bit_idx 索引位置 1
-    uint32_t page_phyaddr = (m_pool->phy_addr_start + (bit_idx * PG_SIZE)); // 保存分配的物理页地址（物理内存池的起始地址 m_pool-> phy_addr_start+ 物理页在内存池中的偏移地址（bit_idx * PG_SIZE））
-    return (void *)page_phyaddr;
+    ASSERT(bitmap_scan_test(&m_pool->free_area[order].free_map, block_idx)); // 防止重复释放
+    buddy_mark_free(m_pool, block_idx, order);
+    pg_zone(m_pool, pg_idx)->free_pages += 1 << free_order;
 }
 
 /**
- * @brief 添加虚拟地址 _vaddr 和物理地址 _page_phyaddr 的映射
+ * @brief 按区域的退让顺序分配一个第 order 阶的块
  *
- * @param _vaddr 要映射的虚拟地址
- * @param _page_phyaddr 要映射到虚拟地址的物理地址
+ * dma 为 true 时只能从 ZONE_DMA 中分配；否则按 zone_fallback 的顺序尝试，
+ * 退到 ZONE_DMA 时还要保证分配后其空闲页数不低于水位线。调用者需保证已关中断。
  *
- * 此函数在页表中创建虚拟地址 _vaddr 和物理地址 _page_phyaddr 之间的映射。
- * (本质上是在页表中添加此虚拟地址对应的页表项 pte，并把物理页的物理地址写入此页表项 pte 中)
- * 它确保在创建页表项 (PTE) 之前，页目录项 (PDE) 已经创建。
- * 如果页表项已经存在，为了避免冲突，程序会报错。
+ * @return int 块的首页相对 buddy_base 的页号，失败返回 -1
  */
-static void page_table_add(void *_vaddr, void *_page_phyaddr)
+static int zone_alloc(struct pool *m_pool, uint32_t order, bool dma)
 {
-    uint32_t vaddr = (uint32_t)_vaddr;               // 要映射的虚拟地址
-    uint32_t page_phyaddr = (uint32_t)_page_phyaddr; // 要映射到虚拟地址的物理地址
-    uint32_t *pde = pde_ptr(vaddr);                  // 获取虚拟地址所在的页目录项虚拟地址指针
-    uint32_t *pte = pte_ptr(vaddr);                  // 获取虚拟地址所在的页表项虚拟地址指针
-
-    /************   注意   ************
-     * 由于目前页表中不存在的虚拟地址，pte_ptr 和 pde_ptr 这两个函数只是根据虚拟地址转换的规则计算出 vaddr 对应的 pte 及 pde 的虚拟地址，与 vaddr 所在的 pte 及 pde 是否存在无关。
-     * 执行 *pte，可能会访问到空的 pde。所以确保 pde 创建完成后才能执行 *pte，
-     * 否则会引发 page_fault。因此在 *pde 为 0 时，
-     * pte 只能出现在下面 else 语句块中的 *pde 后面。
-     ***********************************/
-    /************   注意   ************
-     * 访问*pte时，会先访问到对应的页目录项 (PDE)。
-     * 因此，必须确保页目录项已创建，否则会引发 page_fault 错误。
-     ***********************************/
-
-    // 先在页目录内判断页目录项是否存在，若为 1，则表示已存在
-    if (*pde & 0x00000001)
+    if (dma)
     {
-        // 页目录项和页表项的第 0 位为 p，此处判断页目录项是否存在（此处确保页表项不存在，避免重复映射）
-        ASSERT(!(*pte & 0x00000001));
-
-        if (!(*pte & 0x00000001)) // 页表项不存在
+        return buddy_alloc(m_pool, order, ZONE_DMA);
+    }
+    uint32_t idx;
+    for (idx = 0; idx < ZONE_CNT; idx++)
+    {
+        enum zone_type zone_idx = zone_fallback[idx];
+        struct zone *zone = &m_pool->zones[zone_idx];
+        if (zone_idx == ZONE_DMA && zone->free_pages < zone->watermark + (1U << order))
         {
-            *pte = (page_phyaddr | PG_US_S | PG_RW_R | PG_P_1); // 把物理页的物理地址和 pte 属性写入此页表项 pte 中
+            continue; // 不能把 ZONE_DMA 用到水位线以下
         }
-        else
-        { // 目前应该不会执行到这，因为上面的 ASSERT 会先执行
-            // 页表项重复，抛出异常
-            PANIC("pte repeat!");
-            *pte = (page_phyaddr | PG_US_S | PG_RW_R | PG_P_1);
+        int pg_idx = buddy_alloc(m_pool, order, zone_idx);
+        if (pg_idx != -1)
+        {
+            return pg_idx;
         }
     }
-    else
-    {
-        /* 页目录项 pde 不存在，所以要先创建页目录项再创建页表项 */
-
-        // 从内核内存池分配一个物理页来作为页表
-        uint32_t page_phyaddr = (uint32_t)palloc(&kernel_pool);
-
-        *pde = (page_phyaddr | PG_US_U | PG_RW_W | PG_P_1); // 把要添加的 pte 的物理地址和 pde 属性写入此页目录项 pde 中
-
-        // 清空(置 0)分配到的物理页，确保没有旧数据影响页表的正确性
-        // 因为这样形成的 pte 风格迥异，也许 P 位为 1，也许 pte 的高 20 位有数值，这就会导致新的页表中平白无故地多了好多页表项，
-        // 页表就会“臃肿且破烂不堪”。您可以试一下，如果此处不对用作新页表的物理页清 0 的话，
-        // 在 bochs 中用 info tab 来查看页表中的映射关系时，能输出好几屏的内容，而且全不是自己添加的
-        /* 分配到的物理页地址 pde_phyaddr 对应的物理内存清 0，
-         * （内存系统在回收该物理页的时候并没有对其清 0，因为回收时清 0 是低效的，（内存系统在回收该物理页的时候并没有对其清 0，因为回收时清 0 是低效的））
-         * 避免里面的陈旧数据变成了页表项，从而让页表混乱。
-         */
-
-        /**
-         * 访问到 pde 对应的物理地址，用 pte 取高 20 位便可。
-         * 因为 pte 基于该 pde 对应的物理地址内再寻址，最后 12 位作为页表项的索引，现在将页表清 θ，避免旧数据变成页表项
-         * 把低 12 位置 0 便是该 pde 对应的页表物理页的起始（第 0 个 pte）
-         */
-        memset((void *)((int)pte & 0xfffff000), 0, PG_SIZE); // pte & 0xfffff000)：得到这个 vaddr 所在页表的虚拟地址
+    return -1;
+}
 
-        // 将新物理页的物理地址 page_phyaddr 和相关属性(US=1, RW=1, P=1)写入此 pte 中
-        ASSERT(!(*pte & 0x00000001));                       // 确保页表项不存在
-        *pte = (page_phyaddr | PG_US_U | PG_RW_W | PG_P_1); // 创建新的页表项（相当于第 0 个页表项）
+/**
+ * @brief 打印内存池 m_pool 各区域的可用页数与水位线
+ */
+static void zone_print(const char *name, struct pool *m_pool)
+{
+    static const char *zone_name[ZONE_CNT] = {"DMA", "NORMAL", "HIGH"};
+    uint32_t zone_idx;
+    put_str("       ");
+    put_str((char *)name);
+    put_str(" zones:");
+    for (zone_idx = 0; zone_idx < ZONE_CNT; zone_idx++)
+    {
+        put_str(" ");
+        put_str((char *)zone_name[zone_idx]);
+        put_str("=");
+        put_int(m_pool->zones[zone_idx].present_pages);
     }
+    put_str(" dma_watermark: ");
+    put_int(m_pool->zones[ZONE_DMA].watermark);
+    put_str("\n");
 }
 
 /**
- * malloc_page - 在 pf 所指向的内存池中分配指定 pg_cnt 数量的页空间，返回起始虚拟地址
- *
- *
- * @param pf: 指定内存池（内核或用户）
- * @param pg_cnt: 要分配的页数量
- *
- * @return: 成功则返回起始虚拟地址，失败返回 NULL
+ * @brief 解析 loader 传来的 E820 内存布局，得到 low_limit 之上、按页对齐、已排序且合并过的可用内存段
  *
- * 此函数实现三个步骤：（申请虚拟地址，然后为此虚拟地址分配物理地址，并在页表中建立好虚拟地址到物理地址的映射）
- * 1. 通过 vaddr_get 在虚拟地址空间中申请 pg_cnt 个虚拟页。
- * 2. 通过 palloc 在物理内存池中申请 pg_cnt 个物理页。
- * 3. 通过 page_table_add 将以上得到的 虚拟地址 和 物理地址 在页表中建立映射。
+ * 只处理 4GB 以下的部分（32 位下无法使用更高的物理地址），同时打印可用/保留内存的统计。
  *
- * malloc_page 就是以上三个函数的封装
+ * @param total_mem_bytes loader 得到的内存容量，E820 不可用时作为唯一一段可用内存的上界
+ * @param low_limit 可用内存段的下界（低端 1MB 和页表之上）
  */
-void *malloc_page(enum pool_flags pf, uint32_t pg_cnt)
+static void e820_parse(uint32_t total_mem_bytes, uint32_t low_limit)
 {
-    ASSERT(pg_cnt > 0 && pg_cnt < 3840); // 确保申请的页数合理（内核空间和用户空间各约16MB，保守起见 15MB 来限制）
-                                         // 15*1024*1024/4096=3840页
-    void *vaddr_start = vaddr_get(pf, pg_cnt);
-    if (vaddr_start == NULL)
+    struct ards *ards = (struct ards *)ARDS_BUF_ADDR;
+    uint32_t ards_nr = *(uint16_t *)ARDS_NR_ADDR;
+    if (ards_nr > ARDS_MAX)
     {
-        return NULL; // 虚拟地址申请失败
+        ards_nr = ARDS_MAX; // loader 已限制过，这里再防御一次
     }
 
-    uint32_t vaddr = (uint32_t)vaddr_start; // 分配的虚拟内存起始地址
-    uint32_t cnt = pg_cnt;
-    struct pool *mem_pool = (pf & PF_KERNEL) ? &kernel_pool : &user_pool; // 判断是内核物理内存池还是用户物理内存池
+    struct mem_range ranges[ARDS_MAX];
+    uint32_t range_cnt = 0;
+    uint64_t usable_bytes = 0, reserved_bytes = 0;
+    uint32_t idx;
 
-    /* 虚拟地址是连续的，但物理地址可能不连续，因此逐个映射 */
-    while (cnt-- > 0)
+    if (ards_nr == 0)
     {
-        // 在相应的内存池申请物理页
-        void *page_phyaddr = palloc(mem_pool); // 失败时要将曾经申请的虚拟地址和物理页全部回滚（恢复虚拟/物理内存池位图），在将来完成内存回收时再补充
-                                               // 当申请物理页失败时，应该将曾经已申请成功的虚拟地址和物理地址全部回滚，虽然地址还未使用，但虚拟内存池的位图已经被修改了，如果物理内存池的位图也被修改过，还要再把物理地址回滚。
-        if (page_phyaddr == NULL)
+        put_str("       e820 unavailable, total_mem_bytes: ");
+        put_int(total_mem_bytes);
+        put_str("\n");
+        ranges[range_cnt].start = 0;
+        ranges[range_cnt].end = total_mem_bytes & 0xfffff000;
+        range_cnt++;
+        usable_bytes = total_mem_bytes;
+    }
+
+    for (idx = 0; idx < ards_nr; idx++)
+    {
+        uint64_t base = ((uint64_t)ards[idx].base_high << 32) | ards[idx].base_low;
+        uint64_t length = ((uint64_t)ards[idx].length_high << 32) | ards[idx].length_low;
+        put_str("       e820: base ");
+        put_int(ards[idx].base_low);
+        put_str(" length ");
+        put_int(ards[idx].length_low);
+        put_str(" type ");
+        put_int(ards[idx].type);
+        put_str("\n");
+
+        if (ards[idx].type != E820_USABLE)
         {
-            return NULL; // 申请失败时返回 NULL
+            reserved_bytes += length;
+            continue;
         }
+        usable_bytes += length;
 
-        page_table_add((void *)vaddr, page_phyaddr); // 在页表中建立映射（将虚拟地址 vaddr 映射为物理地址 page_phyaddr）
-        vaddr += PG_SIZE;                            // 移动到下一个虚拟页（继续下一个循环中的申请物理页和页表映射）———— 加上 PG_SIZE 相当于移动到是下一个页表项
+        uint64_t end = base + length;
+        if (base >= 0x100000000ULL)
+        {
+            continue; // 4GB 以上的内存用不到
+        }
+        if (end > 0x100000000ULL)
+        {
+            end = 0x100000000ULL;
+        }
+        // 向内对齐到页边界，不足 1 页的部分丢弃
+        uint32_t start = ((uint32_t)base + PG_SIZE - 1) & 0xfffff000;
+        uint32_t stop = (uint32_t)(end & 0xfffff000ULL);
+        if (end == 0x100000000ULL)
+        {
+            stop = 0xfffff000; // 32 位放不下 4GB，舍去最后一页
+        }
+        if (start < stop)
+        {
+            ranges[range_cnt].start = start;
+            ranges[range_cnt].end = stop;
+            range_cnt++;
+        }
     }
-    return vaddr_start; // 返回起始虚拟地址
+
+    /* 按起始地址插入排序（BIOS 并不保证 ARDS 有序），再裁掉 low_limit 以下的部分，合并重叠或相邻的段 */
+    uint32_t i, j;
+    for (i = 1; i < range_cnt; i++)
+    {
+        struct mem_range key = ranges[i];
+        for (j = i; j > 0 && ranges[j - 1].start > key.start; j--)
+        {
+            ranges[j] = ranges[j - 1];
+        }
+        ranges[j] = key;
+    }
+    usable_range_cnt = 0;
+    for (i = 0; i < range_cnt; i++)
+    {
+        uint32_t start = ranges[i].start < low_limit ? low_limit : ranges[i].start;
+        uint32_t stop = ranges[i].end;
+        if (start >= stop)
+        {
+            continue;
+        }
+        if (usable_range_cnt > 0 && start <= usable_ranges[usable_range_cnt - 1].end)
+        {
+            if (stop > usable_ranges[usable_range_cnt - 1].end)
+            {
+                usable_ranges[usable_range_cnt - 1].end = stop;
+            }
+            continue;
+        }
+        usable_ranges[usable_range_cnt].start = start;
+        usable_ranges[usable_range_cnt].end = stop;
+        usable_range_cnt++;
+    }
+
+    put_str("       usable_bytes: ");
+    put_int((uint32_t)(usable_bytes >> 32));
+    put_char(':');
+    put_int((uint32_t)usable_bytes);
+    put_str(" reserved_bytes: ");
+    put_int((uint32_t)(reserved_bytes >> 32));
+    put_char(':');
+    put_int((uint32_t)reserved_bytes);
+    put_str("\n");
 }
 
 /**
- * get_kernel_pages - 从内核物理内存池中申请指定页数的内存
- * @param pg_cnt: 要申请的页数量
- * @return: 成功则返回起始虚拟地址，失败返回 NULL
- *
- * 通过调用 malloc_page 函数实现内存分配，并将分配的页初始化为 0。
+ * @brief 在物理内存池的位图中只保留可用内存段为空闲，其余（内存空洞、保留区）全部置为已分配
  */
-void *get_kernel_pages(uint32_t pg_cnt)
+static void pool_mark_usable(struct pool *m_pool)
 {
-    void *vaddr = malloc_page(PF_KERNEL, pg_cnt); // 从内核内存池中申请页
-    if (vaddr != NULL)                            // 若成功分配（分配的地址不为空），清空分配的页（将页框清 0 后返回）
+    uint32_t bit_cnt = m_pool->pool_size / PG_SIZE;
+    uint32_t pool_end = m_pool->phy_addr_start + m_pool->pool_size;
+    bitmap_set_range(&m_pool->pool_bitmap, 0, bit_cnt, 1);
+
+    uint32_t idx;
+    for (idx = 0; idx < usable_range_cnt; idx++)
+    {
+        uint32_t start = usable_ranges[idx].start;
+        uint32_t end = usable_ranges[idx].end;
+        if (start < m_pool->phy_addr_start)
+        {
+            start = m_pool->phy_addr_start;
+        }
+        if (end > pool_end)
+        {
+            end = pool_end;
+        }
+        if (start < end)
+        {
+            bitmap_set_range(&m_pool->pool_bitmap, (start - m_pool->phy_addr_start) / PG_SIZE, (end - start) / PG_SIZE, 0);
+        }
+    }
+}
+
+/**
+ * @brief 初始化物理内存池
+ *
+ * 根据所有内存容量 all_mem 的大小初始化 物理内核内存池 和 物理用户内存池
+ *
+ * @param all_mem 物理内存总量
+ */
+static void mem_pool_init(uint32_t all_mem)
+{
+    put_str("   mem_pool_init start\n");
+
+    // 页表大小（256 个页框） = 1 页大小的页目录表 + 第 0 和 第 768 个页目录项指向同一个页表（对应低端4MB）+ 第 769~1022 个页目录项共指向 254 个页表
+    // （第 1023 个 pde 指向页目录表，不重复计算空间）（1GB~3GB的用户空间还未分配页表）
+    uint32_t page_table_size = PG_SIZE * 256; // 记录页目录项和页表占用的字节大小，总大小=页目录表大小+所有页表大小
+
+    uint32_t used_mem = page_table_size + 0x100000; // 已使用的内存字节数 = 页目录项和页表占用的字节大小 + 低端 1MB 内存
+
+    /* 从 E820 内存布局中找出 used_mem 之上的可用内存段，内存池只从这些段中分配 */
+    e820_parse(all_mem, used_mem);
+    ASSERT(usable_range_cnt > 0);
+    uint32_t mem_top = usable_ranges[usable_range_cnt - 1].end; // 最高一段可用内存的末尾
+
+    /* 元数据从第一段可用内存的开头划出，按整个内存跨度估算大小，划走后这段内存相应缩短 */
+    uint32_t meta_pages = DIV_ROUND_UP(mem_meta_estimate((mem_top - used_mem) / PG_SIZE), PG_SIZE);
+    uint32_t meta_phy = usable_ranges[0].start;
+    ASSERT(usable_ranges[0].end - meta_phy > meta_pages * PG_SIZE); // 第一段可用内存要放得下元数据
+    usable_ranges[0].start += meta_pages * PG_SIZE;
+    mem_meta_map(meta_phy, meta_pages);
+    used_mem = usable_ranges[0].start; // 内存池从元数据之后开始
+
+    /* 内核堆的虚拟地址紧随元数据之后，它能覆盖的页数也就是内核物理内存池最多能有的页数 */
+    uint32_t heap_start = mem_meta_end;
+    uint32_t heap_max_pages = (K_HEAP_END - heap_start) / PG_SIZE;
+
+    uint32_t all_free_pages = 0; // 可用的空闲物理页数（不含内存空洞）
+    uint32_t range_idx;
+    for (range_idx = 0; range_idx < usable_range_cnt; range_idx++)
+    {
+        all_free_pages += (usable_ranges[range_idx].end - usable_ranges[range_idx].start) / PG_SIZE;
+    }
+
+    /* 内核物理内存池分得一半的可用页：从 used_mem 向上累加可用页，数够一半的位置就是两个内存池的分界 */
+    uint32_t kernel_free_pages = all_free_pages / 2;
+    uint32_t split_addr = used_mem;
+    uint32_t counted = 0;
+    for (range_idx = 0; range_idx < usable_range_cnt && counted < kernel_free_pages; range_idx++)
+    {
+        uint32_t range_pages = (usable_ranges[range_idx].end - usable_ranges[range_idx].start) / PG_SIZE;
+        uint32_t take = (kernel_free_pages - counted < range_pages) ? kernel_free_pages - counted : range_pages;
+        split_addr = usable_ranges[range_idx].start + take * PG_SIZE;
+        counted += take;
+    }
+
+    /**
+     * 内存池管理的是一段连续的物理地址（其中可能夹着内存空洞），空洞中的页在位图中标记为已分配。
+     * 为了简化位图操作，页数按 8 向下取整，余数不处理
+     * ① 坏处：会丢失内存，(1~7页)*2 的内存 ———— 内核物理内存池+用户物理内存池
+     * ② 好处：不用做内存的越界检测，因为位图表示的内存少于实际物理内存
+     */
+    uint32_t kernel_pool_pages = (split_addr - used_mem) / PG_SIZE;
+    if (kernel_pool_pages > heap_max_pages)
+    {
+        kernel_pool_pages = heap_max_pages; // 大内存时内核物理内存池受限于内核堆的虚拟地址空间（约 1GB），其余归用户内存池
+    }
+    kernel_pool_pages = kernel_pool_pages / 8 * 8;
+    uint32_t kp_start = used_mem;                               // 内核物理内存池的起始地址
+    uint32_t up_start = kp_start + kernel_pool_pages * PG_SIZE; // 用户物理内存池的起始地址
+    uint32_t user_pool_pages = (mem_top - up_start) / PG_SIZE / 8 * 8;
+
+    uint32_t kbm_length = kernel_pool_pages / 8; // 内核物理内存池的位图字节长度（因为位图中的 1 位表示 1 页）
+    uint32_t ubm_length = user_pool_pages / 8;   // 用户物理内存池的位图字节长度
+
+    // 用以上的两个物理起始地址初始化各自内存池的起始地址（内核物理内存池起始地址 和 用户物理内存池起始地址）
+    kernel_pool.phy_addr_start = kp_start;
+    user_pool.phy_addr_start = up_start;
+
+    // 用各自的内存池中的容量字节数（物理页书 * PG_SIZE）初始化各自内存池的 pool_size
+    kernel_pool.pool_size = kernel_pool_pages * PG_SIZE;
+    user_pool.pool_size = user_pool_pages * PG_SIZE;
+
+    // 用各自物理内存池的位图字节长度 kbm_length 和 ubm_length 初始化各自内存池中的位图字节长度成员
+    kernel_pool.pool_bitmap.btmp_bytes_len = kbm_length;
+    user_pool.pool_bitmap.btmp_bytes_len = ubm_length;
+
+    /************ 初始化 内核物理内存池位图 和 用户物理内存池位图 ************
+     * 位图是全局的数组，长度不可定。
+     * 全局或静态的数组需要在编译时知道其长度,
+     * 而我们需要根据内存池大小计算出位图需要多少字节, （位图的长度取决于具体要管理的内存页数量，因此是无法预计），所以必须在一块内存存在它们的位图。
+     ********************************************************/
+    // 32MB内存的位图长度为2KB ———— 2K*1024*1024*4K=32MB
+    // 各位图及其摘要索引、伙伴系统各阶的空闲块位图都由 mem_meta_alloc 从 K_META_START (0xc0100000) 起依次划分
+
+    /* 将物理内存池位图初始化为 0 */
+    // 0 代表位对应的内存页未分配
+    // 1 代表位对应的内存页已分配
+    mem_bitmap_setup(&kernel_pool.pool_bitmap); // 内核物理内存池的位图位于 K_META_START (0xc0100000) 处
+    mem_bitmap_setup(&user_pool.pool_bitmap);   // 用户物理内存池的位图紧随其后
+    kernel_pool.lent_bitmap.btmp_bytes_len = kbm_length;
+    user_pool.lent_bitmap.btmp_bytes_len = ubm_length;
+    mem_bitmap_setup(&kernel_pool.lent_bitmap); // 初始时没有借出的页框，全 0
+    mem_bitmap_setup(&user_pool.lent_bitmap);
+    /* 用户进程的页框也可能借自内核物理内存池，所以两个内存池都要有页引用计数，初始时全 0 */
+    kernel_pool.page_ref = mem_meta_alloc(kernel_pool_pages * sizeof(uint16_t));
+    user_pool.page_ref = mem_meta_alloc(user_pool_pages * sizeof(uint16_t));
+    memset(kernel_pool.page_ref, 0, kernel_pool_pages * sizeof(uint16_t));
+    memset(user_pool.page_ref, 0, user_pool_pages * sizeof(uint16_t));
+    pool_mark_usable(&kernel_pool);             // 内存空洞中的页标记为已分配，永不分配出去
+    pool_mark_usable(&user_pool);
+
+    /************************* 输出内存池信息 *************************/
+    // 包括 内存池的所用位图的起始物理地址 和 内存池的起始物理地址
+    put_str("       kernel_pool_bitmap_start: ");
+    put_int((int)kernel_pool.pool_bitmap.bits);
+    put_str(" kernel_pool_phy_addr_start: ");
+    put_int(kernel_pool.phy_addr_start);
+    put_str("\n");
+    put_str("       user_pool_bitmap_start: ");
+    put_int((int)user_pool.pool_bitmap.bits);
+    put_str(" user_pool_phy_addr_start: ");
+    put_int(user_pool.phy_addr_start);
+    put_str("\n");
+
+    /* 下面初始化内核虚拟地址池 */
+    // 用于维护内核堆的虚拟地址。内核一侧可以向用户内存池借页框，所以按全部可用页（受限于内核堆的虚拟地址空间）而不是内核物理内存池的大小来定
+    kvaddr_init((all_free_pages < heap_max_pages ? all_free_pages : heap_max_pages) / 8 * 8);
+
+    /* 物理页实际由两个内存池各自的伙伴系统分配 */
+    buddy_init(&kernel_pool);
+    buddy_init(&user_pool);
+    reservoir_stat[RS_KERNEL].quota = pool_free_pages(&kernel_pool); // 两侧的软配额即初始划分的页数
+    reservoir_stat[RS_USER].quota = pool_free_pages(&user_pool);
+
+    // 在 loader 中我们已经通过设置页表把虚拟地址 0xc0000000~0xc00fffff 映射到了物理地址 0x00000000~0x000fffff（低端 1MB 内存）
+    // 0xc0100000 起是元数据，其后是用于给内核动态堆分配内存的虚拟地址
+    kernel_vaddr.vaddr_start = heap_start;
+    put_str("       meta_phy_addr_start: ");
+    put_int(meta_phy);
+    put_str(" meta_bytes: ");
+    put_int(mem_meta_next - K_META_START);
+    put_str(" kernel_heap_start: ");
+    put_int(heap_start);
+    put_str("\n");
+    zone_print("kernel", &kernel_pool);
+    zone_print("user", &user_pool);
+    put_str("       reservoir quota kernel: ");
+    put_int(reservoir_stat[RS_KERNEL].quota);
+    put_str(" user: ");
+    put_int(reservoir_stat[RS_USER].quota);
+    put_str("\n");
+    put_str("   mem_pool_init done\n");
+}
+
+/**
+ * @brief 空闲段按起始页号比较
+ */
+static int extent_addr_less(struct avl_node *a, struct avl_node *b)
+{
+    struct vaddr_extent *ea = elem2entry(struct vaddr_extent, addr_node, a);
+    struct vaddr_extent *eb = elem2entry(struct vaddr_extent, addr_node, b);
+    return ea->start < eb->start;
+}
+
+/**
+ * @brief 空闲段按 (页数, 起始页号) 比较
+ */
+static int extent_size_less(struct avl_node *a, struct avl_node *b)
+{
+    struct vaddr_extent *ea = elem2entry(struct vaddr_extent, size_node, a);
+    struct vaddr_extent *eb = elem2entry(struct vaddr_extent, size_node, b);
+    return ea->pg_cnt < eb->pg_cnt || (ea->pg_cnt == eb->pg_cnt && ea->start < eb->start);
+}
+
+/**
+ * @brief 取一个空闲结点记录空闲段 [start, start + pg_cnt)，并挂到两棵树上
+ *
+ * @return struct vaddr_extent* 新的空闲段，结点已用完时返回 NULL
+ */
+static struct vaddr_extent *extent_new(uint32_t start, uint32_t pg_cnt)
+{
+    struct vaddr_extent *ext = extent_free_list;
+    if (ext == NULL)
+    {
+        return NULL;
+    }
+    extent_free_list = (struct vaddr_extent *)ext->addr_node.left;
+    ext->start = start;
+    ext->pg_cnt = pg_cnt;
+    avl_insert(&vaddr_addr_tree, &ext->addr_node);
+    avl_insert(&vaddr_size_tree, &ext->size_node);
+    return ext;
+}
+
+/**
+ * @brief 把空闲段从两棵树上摘下，结点放回空闲结点链
+ */
+static void extent_delete(struct vaddr_extent *ext)
+{
+    avl_remove(&vaddr_addr_tree, &ext->addr_node);
+    avl_remove(&vaddr_size_tree, &ext->size_node);
+    ext->addr_node.left = (struct avl_node *)extent_free_list;
+    extent_free_list = ext;
+}
+
+/**
+ * @brief 把空闲段改为 [start, start + pg_cnt)
+ *
+ * 调用者保证新的范围不越过相邻的空闲段，因此它在按地址排序的树中的位置不变，只需在按大小排序的树中重新插入。
+ */
+static void extent_resize(struct vaddr_extent *ext, uint32_t start, uint32_t pg_cnt)
+{
+    avl_remove(&vaddr_size_tree, &ext->size_node);
+    ext->start = start;
+    ext->pg_cnt = pg_cnt;
+    avl_insert(&vaddr_size_tree, &ext->size_node);
+}
+
+/**
+ * @brief 管理 pg_cnt 页的内核堆所需的空闲段结点数
+ *
+ * 空闲段之间至少隔着一个已分配的页，所以 pg_cnt 页中最多有 pg_cnt / 2 + 1 个空闲段，再以 VADDR_EXTENT_MAX 封顶。
+ */
+static uint32_t kvaddr_nodes(uint32_t pg_cnt)
+{
+#if CONFIG_VADDR_BITMAP
+    return 0;
+#else
+    uint32_t nodes = pg_cnt / 2 + 1;
+    return nodes < VADDR_EXTENT_MAX ? nodes : VADDR_EXTENT_MAX;
+#endif
+}
+
+/**
+ * @brief 初始化内核虚拟地址池，共 pg_cnt 页，起初全部空闲
+ *
+ * 位图或空闲段结点表从元数据区域中分配。
+ */
+static void kvaddr_init(uint32_t pg_cnt)
+{
+    kvaddr_pages = pg_cnt;
+#if CONFIG_VADDR_BITMAP
+    kernel_vaddr.vaddr_bitmap.btmp_bytes_len = pg_cnt / 8;
+    mem_bitmap_setup(&kernel_vaddr.vaddr_bitmap); // 紧挨着各物理内存池所用的位图之后
+#else
+    uint32_t nodes = kvaddr_nodes(pg_cnt);
+    struct vaddr_extent *table = mem_meta_alloc(nodes * sizeof(struct vaddr_extent));
+    uint32_t idx;
+    avl_init(&vaddr_addr_tree, extent_addr_less);
+    avl_init(&vaddr_size_tree, extent_size_less);
+    extent_free_list = NULL;
+    for (idx = nodes; idx-- > 0;)
+    {
+        table[idx].addr_node.left = (struct avl_node *)extent_free_list;
+        extent_free_list = &table[idx];
+    }
+    if (pg_cnt > 0)
+    {
+        extent_new(0, pg_cnt);
+    }
+#endif
+}
+
+/**
+ * @brief 在内核虚拟地址池中申请 pg_cnt 个连续的虚拟页，起始页号满足 页号 % align == offset
+ *
+ * 不要求对齐（align 为 1）时取最佳适配的空闲段的开头；要求对齐时从最佳适配的段起，按大小递增依次检查能否容纳对齐后的范围，
+ * 对齐后的范围落在段中间时，段会一分为二，这时需要一个新结点。调用者需保证已关中断。
+ *
+ * @return int 起始页号（相对 kernel_vaddr.vaddr_start），失败返回 -1
+ */
+static int kvaddr_alloc(uint32_t pg_cnt, uint32_t align, uint32_t offset)
+{
+    ASSERT(pg_cnt > 0 && align > 0);
+#if CONFIG_VADDR_BITMAP
+    int bit_idx_start = (align == 1) ? bitmap_scan(&kernel_vaddr.vaddr_bitmap, pg_cnt)
+                                     : bitmap_scan_align(&kernel_vaddr.vaddr_bitmap, pg_cnt, align, offset);
+    if (bit_idx_start != -1)
+    {
+        bitmap_set_range(&kernel_vaddr.vaddr_bitmap, bit_idx_start, pg_cnt, 1);
+    }
+    return bit_idx_start;
+#else
+    struct vaddr_extent key;
+    key.start = 0;
+    key.pg_cnt = pg_cnt;
+    struct avl_node *node = avl_lower_bound(&vaddr_size_tree, &key.size_node);
+    while (node != NULL)
+    {
+        struct vaddr_extent *ext = elem2entry(struct vaddr_extent, size_node, node);
+        uint32_t ext_end = ext->start + ext->pg_cnt;
+        uint32_t start = ext->start + (offset + align - ext->start % align) % align; // 段中第一个满足对齐的页号
+        if (start + pg_cnt <= ext_end)
+        {
+            uint32_t tail = ext_end - (start + pg_cnt);
+            if (start == ext->start)
+            {
+                // 从段的开头切走，段缩短或者被用完
+                if (tail == 0)
+                {
+                    extent_delete(ext);
+                }
+                else
+                {
+                    extent_resize(ext, start + pg_cnt, tail);
+                }
+            }
+            else if (tail == 0)
+            {
+                extent_resize(ext, ext->start, start - ext->start); // 从段的末尾切走
+            }
+            else
+            {
+                // 从段的中间切走，余下的尾部成为新的空闲段
+                if (extent_new(start + pg_cnt, tail) == NULL)
+                {
+                    return -1;
+                }
+                extent_resize(ext, ext->start, start - ext->start);
+            }
+            return (int)start;
+        }
+        node = avl_upper_bound(&vaddr_size_tree, node);
+    }
+    return -1;
+#endif
+}
+
+/**
+ * @brief 把以 pg_idx 起始的 pg_cnt 页归还给内核虚拟地址池，与前后相邻的空闲段合并。调用者需保证已关中断
+ */
+static void kvaddr_free(uint32_t pg_idx, uint32_t pg_cnt)
+{
+    ASSERT(pg_cnt > 0 && pg_idx + pg_cnt <= kvaddr_pages);
+#if CONFIG_VADDR_BITMAP
+    bitmap_set_range(&kernel_vaddr.vaddr_bitmap, pg_idx, pg_cnt, 0);
+#else
+    struct vaddr_extent key;
+    key.start = pg_idx;
+    struct avl_node *prev_node = avl_prev(&vaddr_addr_tree, &key.addr_node);
+    struct avl_node *next_node = avl_lower_bound(&vaddr_addr_tree, &key.addr_node);
+    struct vaddr_extent *prev = prev_node ? elem2entry(struct vaddr_extent, addr_node, prev_node) : NULL;
+    struct vaddr_extent *next = next_node ? elem2entry(struct vaddr_extent, addr_node, next_node) : NULL;
+    ASSERT(prev == NULL || prev->start + prev->pg_cnt <= pg_idx); // 防止重复释放
+    ASSERT(next == NULL || next->start >= pg_idx + pg_cnt);
+
+    bool merge_prev = (prev != NULL && prev->start + prev->pg_cnt == pg_idx);
+    bool merge_next = (next != NULL && next->start == pg_idx + pg_cnt);
+    if (merge_prev && merge_next)
+    {
+        uint32_t total = prev->pg_cnt + pg_cnt + next->pg_cnt;
+        extent_delete(next);
+        extent_resize(prev, prev->start, total);
+    }
+    else if (merge_prev)
+    {
+        extent_resize(prev, prev->start, prev->pg_cnt + pg_cnt);
+    }
+    else if (merge_next)
+    {
+        extent_resize(next, pg_idx, next->pg_cnt + pg_cnt);
+    }
+    else if (extent_new(pg_idx, pg_cnt) == NULL)
+    {
+        PANIC("kvaddr_free: out of vaddr extent nodes");
+    }
+#endif
+}
+
+/**
+ * @brief 统计内核虚拟地址池的碎片情况（供 memstat 使用）
+ */
+void vaddr_frag(struct frag_info *info)
+{
+#if CONFIG_VADDR_BITMAP
+    memstat_frag(&kernel_vaddr.vaddr_bitmap, info);
+#else
+    memstat_frag_reset(info, kvaddr_pages);
+    enum intr_status old_status = intr_disable();
+    struct avl_node *node = avl_first(&vaddr_addr_tree);
+    while (node != NULL)
+    {
+        struct vaddr_extent *ext = elem2entry(struct vaddr_extent, addr_node, node);
+        memstat_frag_add(info, ext->pg_cnt);
+        node = avl_upper_bound(&vaddr_addr_tree, node);
+    }
+    intr_set_status(old_status);
+#endif
+}
+
+/**
+ * @brief 在虚拟内存池中申请指定页数的虚拟页
+ *
+ * 该函数在 pf 表示的虚拟内存池中申请 pg_cnt 个虚拟页，成功则返回虚拟页的起始地址，失败则返回 NULL。
+ *
+ * 针对内核内存池和用户内存池不同处理：内核从 kernel_vaddr 中分配，用户进程从自己 PCB 中的 userprog_vaddr 中分配。
+ *
+ * @param enum pool_flags pf 内存池标志（内核或用户物理内存池）
+ * @param uint32_t pg_cnt 申请的页数
+ * @return void* 成功返回虚拟页起始地址，失败返回NULL
+ */
+static void *vaddr_get(enum pool_flags pf, uint32_t pg_cnt)
+{
+    int vaddr_start = 0;    // 存储分配的起始虚拟地址
+    int bit_idx_start = -1; // 存储位图扫描函数 bitmap_scan 的返回值，默认为 -1
+    if (pf & PF_KERNEL)     // 判断是否是在内核虚拟地址池中申请地址
+    {
+        /* 查找与占用之间若被打断，另一个线程可能找到同一段空闲地址，因此要保持原子操作 */
+        enum intr_status old_status = intr_disable();
+        bit_idx_start = kvaddr_alloc(pg_cnt, 1, 0);
+        intr_set_status(old_status);
+        // 内核虚拟地址池中没有连续 pg_cnt 个空闲页
+        if (bit_idx_start == -1)
+        {
+            return NULL;
+        }
+        // 将 bit_idx_start 转换为虚拟地址（虚拟内核内存池的起始地址为 kernel_vaddr.vaddr_start）
+        // 位图中起始位索引 bit_idx_start 相对于内存池的虚拟页偏移地址 bit_idx_start * PG_SIZE（位图的 1bit 代表实际 1K 大小的内存）
+        vaddr_start = kernel_vaddr.vaddr_start + bit_idx_start * PG_SIZE;
+    }
+    else
+    {
+        struct task_struct *cur = running_thread();
+        enum intr_status old_status = intr_disable();
+        bit_idx_start = bitmap_scan(&cur->userprog_vaddr.vaddr_bitmap, pg_cnt);
+        if (bit_idx_start != -1)
+        {
+            bitmap_set_range(&cur->userprog_vaddr.vaddr_bitmap, bit_idx_start, pg_cnt, 1);
+        }
+        intr_set_status(old_status);
+        if (bit_idx_start == -1)
+        {
+            return NULL;
+        }
+        vaddr_start = cur->userprog_vaddr.vaddr_start + bit_idx_start * PG_SIZE;
+        /* (0xc0000000 - PG_SIZE) 作为用户 3 级栈已经在 start_process 被分配 */
+        ASSERT((uint32_t)vaddr_start < (0xc0000000 - PG_SIZE));
+    }
+    return (void *)vaddr_start; // 将 vaddr_start 转换成指针后返回
+}
+
+/**
+ * @brief 获取虚拟地址 vaddr 对应的页表项 pte 指针（指针的值是虚拟地址）
+ *
+ * 该函数接受虚拟地址 vaddr，返回对应页表项 pte 的指针，利用虚拟地址计算出页表项所在的物理地址。
+ *
+ * @param uint32_t vaddr 虚拟地址
+ *
+ * @return uint32_t* 对应页表项 pte 的指针（能够访问 vaddr 所在的 pte 的虚拟地址）
+ */
+uint32_t *pte_ptr(uint32_t vaddr)
+{
+    // 最后一个页目录项里写的是页目录表自己的物理地址，目的是为了通过此页目录项编辑页表
+
+    /** 通过页表映射获取页表项的地址
+     * ① 先访问到页表自己
+     * ② 再用页目录项 PDE（页目录项的索引）作为 pte 的索引访问页表
+     * ③ 再用 pte 的索引作为内偏移
+     */
+    uint32_t *pte = (uint32_t *)(0xffc00000 +                   // 0xffc00000 中的前 10 位代表 第 1023 个页表项
+                                 ((vaddr & 0xffc00000) >> 10) + // 用 vaddr 的前 10 位索引页目录项（此页目录项中记录的是页表的物理地址）
+                                 PTE_IDX(vaddr) * 4);           // 用 vaddr 的中 10 位索引页表项（页表项索引 * 4B = 页表项的物理地址） ———— 每个页表项大小为 4B
+
+    return pte;
+}
+
+/**
+ * @brief 获取虚拟地址 vaddr 对应的页目录项 pde 的指针（指针的值是虚拟地址）
+ *
+ * 该函数接受虚拟地址 vaddr，返回对应页目录项 pde 的指针，利用虚拟地址计算出页目录项所在的物理地址。
+ *
+ * 目前页表中不存在的虚拟地址， pte_ptr 和 pde_ptr 这两个函数只是根据虚拟地址转换的规则计算出 vaddr 对应的 pte 及 pde 的虚拟地址，与 vaddr 所在的 pte 及 pde 是否存在无关。
+ *
+ * @param uint32_t vaddr 虚拟地址
+ *
+ * @return uint32_t* 对应页目录项 pde 的指针
+ */
+uint32_t *pde_ptr(uint32_t vaddr)
+{
+    /* 通过页目录表获取页目录项的地址 */
+    // 0xfffff000 对应的的还是页目录表的物理地址
+    uint32_t *pde = (uint32_t *)(0xfffff000 + PDE_IDX(vaddr) * 4); // 此时指针变量 pde 指向 vaddr 所在的 pde
+    return pde;
+}
+
+/**
+ * @brief 在物理内存池中分配 2^order 个连续的物理页
+ *
+ * 该函数从 m_pool 的伙伴系统中取出一个第 order 阶的块，并在 pool_bitmap 中把块内各页标记为已分配。
+ * 返回的物理地址按 2^order 页天然对齐。
+ *
+ * @param struct pool* m_pool 指向物理内存池的指针
+ * @param uint32_t order 块的阶（0 ~ MAX_ORDER）
+ * @param bool dma 为 true 时块必须位于 16MB 以下（ZONE_DMA）
+ * @return void* 成功返回块的起始物理地址，失败返回 NULL
+ */
+static void *palloc_order(struct pool *m_pool, uint32_t order, bool dma)
+{
+    ASSERT(order <= MAX_ORDER);
+    /* 伙伴系统的拆分与位图的设置要保持原子操作 */
+    enum intr_status old_status = intr_disable();
+    struct pool *src = m_pool;
+    int pg_idx = zone_alloc(m_pool, order, dma);
+    if (pg_idx == -1)
+    {
+        // 本侧内存池已用尽，向另一侧借
+        src = (m_pool == &kernel_pool) ? &user_pool : &kernel_pool;
+        pg_idx = reservoir_borrow(m_pool, order, dma);
+        if (pg_idx == -1)
+        {
+            // 两侧都已用尽，用户的单页申请再尝试换出一个冷页，直接用腾出的页框
+            uint32_t frame = (m_pool == &user_pool && order == 0 && !dma) ? swap_evict() : 0;
+            intr_set_status(old_status);
+            return (void *)frame; // 为 0 即分配失败
+        }
+    }
+    uint32_t page_phyaddr = pool_claim(src, pg_idx, order, m_pool);
+    intr_set_status(old_status);
+    return (void *)page_phyaddr;
+}
+
+/**
+ * @brief 返回内存池 m_pool 所属的一侧（内核或用户）
+ */
+static enum reservoir_side pool_side(struct pool *m_pool)
+{
+    return (m_pool == &user_pool) ? RS_USER : RS_KERNEL;
+}
+
+/**
+ * @brief 返回内存池 m_pool 中空闲的页数
+ */
+static uint32_t pool_free_pages(struct pool *m_pool)
+{
+    uint32_t free_pages = 0;
+    uint32_t zone_idx;
+    for (zone_idx = 0; zone_idx < ZONE_CNT; zone_idx++)
+    {
+        free_pages += m_pool->zones[zone_idx].free_pages;
+    }
+    return free_pages;
+}
+
+/**
+ * @brief 替 m_pool 一侧从另一侧的内存池借一个第 order 阶的块
+ *
+ * 出借方借出后的空闲页数不能低于其配额的 1/2^RESERVOIR_RESERVE_SHIFT，以免另一侧也立刻陷入缺页。调用者需保证已关中断。
+ *
+ * @return int 块的首页相对出借方 buddy_base 的页号，不能借时返回 -1
+ */
+static int reservoir_borrow(struct pool *m_pool, uint32_t order, bool dma)
+{
+    struct pool *lender = (m_pool == &kernel_pool) ? &user_pool : &kernel_pool;
+    struct reservoir_stat *stat = &reservoir_stat[pool_side(m_pool)];
+    uint32_t reserve = reservoir_stat[pool_side(lender)].quota >> RESERVOIR_RESERVE_SHIFT;
+    int pg_idx = -1;
+    if (pool_free_pages(lender) >= reserve + (1U << order))
+    {
+        pg_idx = zone_alloc(lender, order, dma);
+    }
+    if (pg_idx == -1)
+    {
+        stat->lend_refusals++;
+        return -1;
+    }
+    stat->borrow_events++;
+    return pg_idx;
+}
+
+/**
+ * @brief 把刚从内存池 src 的伙伴系统取出的块登记为 m_pool 一侧所用，返回块的起始物理地址
+ *
+ * 在 src 的 pool_bitmap 中把块内各页标记为已分配；src 不是 m_pool 时块是借来的，同时在 src 的 lent_bitmap 中标记。
+ * 调用者需保证已关中断。
+ */
+static uint32_t pool_claim(struct pool *src, uint32_t pg_idx, uint32_t order, struct pool *m_pool)
+{
+    uint32_t page_phyaddr = src->buddy_base + pg_idx * PG_SIZE; // 块的起始物理地址
+    uint32_t bit_idx = (page_phyaddr - src->phy_addr_start) / PG_SIZE;
+    struct reservoir_stat *stat = &reservoir_stat[pool_side(m_pool)];
+    bitmap_set_range(&src->pool_bitmap, bit_idx, 1 << order, 1);
+    if (src != m_pool)
+    {
+        bitmap_set_range(&src->lent_bitmap, bit_idx, 1 << order, 1);
+        stat->borrowed += 1 << order;
+    }
+    stat->used += 1 << order;
+    if (stat->used > stat->peak)
+    {
+        stat->peak = stat->used;
+    }
+    return page_phyaddr;
+}
+
+/**
+ * @brief 获取当前线程在内存池 m_pool 上的 magazine
+ *
+ * 线程环境初始化之前（主线程 PCB 尚未被 init_thread 填写，stack_magic 不对），返回 NULL，此时直接使用内存池。
+ *
+ * @param struct pool* m_pool 指向物理内存池的指针
+ * @return struct page_magazine* 当前线程对应的 magazine，不可用时返回 NULL
+ */
+static struct page_magazine *page_mag_of(struct pool *m_pool)
+{
+    struct task_struct *cur = running_thread();
+    if (cur->stack_magic != STACK_MAGIC)
+    {
+        return NULL;
+    }
+    return &cur->page_mag[m_pool == &user_pool ? 1 : 0];
+}
+
+/**
+ * @brief 从内存池中一次性取出最多 PG_MAG_BATCH 个页框补充到 magazine 中
+ *
+ * 整批操作只关一次中断，这正是 magazine 相对于逐页 palloc_order 的收益所在。
+ * 只从 ZONE_HIGH、ZONE_NORMAL 补充：ZONE_DMA 的页框一旦囤进各线程的 magazine，DMA 申请和水位线就都看不到它们了，
+ * 这两个区域用尽后交给 palloc_order 经 zone_alloc 按水位线逐页退到 ZONE_DMA。
+ *
+ * @return bool 至少补充到 1 个页框时返回 true
+ */
+static bool page_magazine_refill(struct pool *m_pool, struct page_magazine *mag)
+{
+    enum intr_status old_status = intr_disable();
+    uint32_t idx = 0;
+    while (mag->cnt < PG_MAG_BATCH && idx < ZONE_CNT)
+    {
+        enum zone_type zone_idx = zone_fallback[idx];
+        int pg_idx = (zone_idx != ZONE_DMA) ? buddy_alloc(m_pool, 0, zone_idx) : -1;
+        if (pg_idx == -1)
+        {
+            idx++; // 本区域已空，换下一个区域，都空了就能补多少算多少
+            continue;
+        }
+        mag->frames[mag->cnt++] = pool_claim(m_pool, pg_idx, 0, m_pool);
+    }
+    intr_set_status(old_status);
+    return mag->cnt > 0;
+}
+
+/**
+ * @brief 把 magazine 中最近放入的 cnt 个页框成批归还给内存池
+ */
+static void page_magazine_drain(struct pool *m_pool, struct page_magazine *mag, uint32_t cnt)
+{
+    ASSERT(cnt <= mag->cnt);
+    enum intr_status old_status = intr_disable();
+    while (cnt-- > 0)
+    {
+        pool_free_block(m_pool, mag->frames[--mag->cnt], 0);
+    }
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 把已退出线程的两个 magazine（mags[0] 内核、mags[1] 用户）中的页框全部归还内存池，回收 PCB 之前调用
+ */
+void page_mag_release(struct page_magazine *mags)
+{
+    page_magazine_drain(&kernel_pool, &mags[0], mags[0].cnt);
+    page_magazine_drain(&user_pool, &mags[1], mags[1].cnt);
+}
+
+/**
+ * @brief 在物理内存池中分配一页物理内存
+ *
+ * 该函数在 m_pool 指向的物理内存池中分配 1 页物理内存，成功返回页框的物理地址，失败返回 NULL。
+ * 优先从当前线程的 magazine 中取，magazine 为空时先批量补充。
+ * magazine 只归当前线程使用，线程切换不会破坏它，因此取页框时无需关中断；
+ * 中断处理程序（包括缺页异常，它可能打断当前线程正在进行的 magazine 操作）中不要调用此函数，改用 palloc_order。
+ *
+ * @param struct pool* m_pool 指向物理内存池的指针
+ * @return void* 成功返回分配的物理页地址，失败返回 NULL
+ */
+static void *palloc(struct pool *m_pool)
+{
+    struct page_magazine *mag = page_mag_of(m_pool);
+    if (mag == NULL)
+    {
+        return palloc_order(m_pool, 0, false); // 一页即伙伴系统的第 0 阶块
+    }
+
+    if (mag->cnt > 0)
+    {
+        mag->alloc_hits++;
+    }
+    else
+    {
+        mag->alloc_misses++;
+        if (!page_magazine_refill(m_pool, mag))
+        {
+            // 内存池也没有空闲页了，内核先从预先清 0 的页框中取一个，再不行就向另一侧借（借来的页框不进 magazine）
+            void *page_phyaddr = (m_pool == &kernel_pool) ? (void *)page_zero_take() : NULL;
+            return (page_phyaddr != NULL) ? page_phyaddr : palloc_order(m_pool, 0, false);
+        }
+    }
+    return (void *)mag->frames[--mag->cnt];
+}
+
+/**
+ * @brief 把以 pg_phy_addr 起始的第 order 阶块直接归还给内存池 m_pool
+ *
+ * 清除 pool_bitmap 中对应的位，再把该块释放回伙伴系统（能合并时会自动合并）。
+ * 借出的块（lent_bitmap 中有标记）从借用方的账上扣除，否则从 m_pool 本侧的账上扣除。
+ */
+static void pool_free_block(struct pool *m_pool, uint32_t pg_phy_addr, uint32_t order)
+{
+    enum intr_status old_status = intr_disable();
+    uint32_t bit_idx = (pg_phy_addr - m_pool->phy_addr_start) / PG_SIZE;
+    ASSERT(bitmap_scan_test(&m_pool->pool_bitmap, bit_idx)); // 只能释放已分配的页
+    bitmap_set_range(&m_pool->pool_bitmap, bit_idx, 1 << order, 0);
+    struct reservoir_stat *stat = &reservoir_stat[pool_side(m_pool)];
+    if (bitmap_scan_test(&m_pool->lent_bitmap, bit_idx))
+    {
+        stat = &reservoir_stat[pool_side(m_pool) == RS_KERNEL ? RS_USER : RS_KERNEL];
+        bitmap_set_range(&m_pool->lent_bitmap, bit_idx, 1 << order, 0);
+        stat->borrowed -= 1 << order;
+    }
+    stat->used -= 1 << order;
+    buddy_free(m_pool, (pg_phy_addr - m_pool->buddy_base) / PG_SIZE, order);
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 将物理地址 pg_phy_addr 所在的物理页回收到物理内存池
+ *
+ * 根据物理地址判断所属的内存池，先放回当前线程的 magazine，magazine 已满时先成批归还 PG_MAG_BATCH 个页框给内存池。
+ * 以 palloc_order 分配的多页块可以逐页释放。借来的页框和 ZONE_DMA 中的页框不进 magazine，直接归还给内存池。
+ *
+ * @param pg_phy_addr 物理页的地址
+ */
+void pfree(uint32_t pg_phy_addr)
+{
+    struct pool *mem_pool = (pg_phy_addr >= user_pool.phy_addr_start) ? &user_pool : &kernel_pool;
+    ASSERT(pg_phy_addr >= mem_pool->phy_addr_start && pg_phy_addr < mem_pool->phy_addr_start + mem_pool->pool_size);
+
+    struct page_magazine *mag = page_mag_of(mem_pool);
+    if (mag == NULL || pg_phy_addr < ZONE_DMA_END || bitmap_scan_test(&mem_pool->lent_bitmap, (pg_phy_addr - mem_pool->phy_addr_start) / PG_SIZE))
+    {
+        pool_free_block(mem_pool, pg_phy_addr, 0);
+        return;
+    }
+
+    if (mag->cnt == PG_MAG_SIZE)
+    {
+        mag->free_overflows++;
+        page_magazine_drain(mem_pool, mag, PG_MAG_BATCH);
+    }
+    else
+    {
+        mag->free_hits++;
+    }
+    mag->frames[mag->cnt++] = pg_phy_addr;
+}
+
+/**
+ * @brief 为虚拟地址 vaddr 新建一张页表，并写入页目录项 pde
+ *
+ * 页表的物理页优先取预先清 0 的页框，否则从内核物理内存池申请后清 0。
+ * 必须清 0：页框中的陈旧数据会被当成页表项，使新页表中平白多出许多映射。
+ * 缺页异常中按需分配时也会经 page_table_add 走到这里，所以直接从伙伴系统申请，不经过当前线程的 magazine。
+ *
+ * @return 成功返回 true；内核物理内存池已无空闲页时返回 false，页目录项未作修改
+ */
+static bool page_table_new(uint32_t *pde, uint32_t vaddr)
+{
+    uint32_t pde_phyaddr = page_zero_take();
+    bool prezeroed = (pde_phyaddr != 0);
+    if (!prezeroed)
+    {
+        pde_phyaddr = (uint32_t)palloc_order(&kernel_pool, 0, false);
+    }
+    if (pde_phyaddr == 0)
+    {
+        return false;
+    }
+    // 页目录项的权限放到最宽，由各页表项的属性决定实际权限
+    *pde = (pde_phyaddr | PG_US_U | PG_RW_W | PG_P_1);
+    if (!prezeroed)
+    {
+        page_zero_range((void *)((uint32_t)pte_ptr(vaddr) & 0xfffff000), 1); // pte_ptr(vaddr) & 0xfffff000 即新页表自身的虚拟地址
+    }
+    return true;
+}
+
+/**
+ * @brief map_range 与 map_range_contig 的实现，paddrs 为 NULL 时物理页框从 paddr 起连续
+ */
+static bool map_range_do(uint32_t vaddr, const uint32_t *paddrs, uint32_t paddr, uint32_t pg_cnt, uint32_t flags)
+{
+    ASSERT(vaddr % PG_SIZE == 0);
+    uint32_t done = 0;
+    while (done < pg_cnt)
+    {
+        uint32_t cur = vaddr + done * PG_SIZE;
+        uint32_t *pde = pde_ptr(cur);
+        /* 访问 *pte 前页目录项必须存在，否则会引发缺页异常 */
+        if (!(*pde & PG_P_1) && !page_table_new(pde, cur))
+        {
+            unmap_range(vaddr, done, false); // 撤销已写入的页表项，已建好的页表保留
+            return false;
+        }
+        ASSERT(!(*pde & PG_PS));
+
+        /* 本页表中落在范围内的页表项是连续的一串，只定位一次 */
+        uint32_t *pte = pte_ptr(cur);
+        uint32_t run = PG_TABLE_ENTRIES - PTE_IDX(cur);
+        if (run > pg_cnt - done)
+        {
+            run = pg_cnt - done;
+        }
+        uint32_t idx;
+        for (idx = 0; idx < run; idx++, done++)
+        {
+            ASSERT(!(pte[idx] & PG_P_1)); // 不允许重复映射
+            uint32_t page_phyaddr = (paddrs != NULL) ? paddrs[done] : paddr + done * PG_SIZE;
+            pte[idx] = (page_phyaddr | flags | PG_P_1);
+        }
+    }
+    return true;
+}
+
+/**
+ * map_range - 把从 vaddr 起的 pg_cnt 个虚拟页依次映射到物理页框 paddrs[0] ~ paddrs[pg_cnt - 1]
+ *
+ * @vaddr: 起始虚拟地址（页对齐）
+ * @paddrs: 各页的物理页框地址
+ * @pg_cnt: 页数
+ * @flags: 页表项属性，PG_RW_W、PG_US_U、PG_G、PG_PCD 的组合（P 位自动加上）
+ *
+ * @return: 成功返回 true；需要新建页表但内核物理内存池已无空闲页时返回 false，此时范围内不留下任何映射
+ *
+ * 每张页表只定位一次：先确保页目录项存在（必要时新建页表），再连续写入这张页表中落在范围内的一串页表项。
+ * 原先不存在的页表项不会被处理器缓存在 TLB 中，所以建立映射无需刷新 TLB。
+ */
+bool map_range(uint32_t vaddr, const uint32_t *paddrs, uint32_t pg_cnt, uint32_t flags)
+{
+    return map_range_do(vaddr, paddrs, 0, pg_cnt, flags);
+}
+
+/**
+ * @brief 与 map_range 相同，但物理页框是从 paddr 起连续的 pg_cnt 页
+ */
+bool map_range_contig(uint32_t vaddr, uint32_t paddr, uint32_t pg_cnt, uint32_t flags)
+{
+    return map_range_do(vaddr, NULL, paddr, pg_cnt, flags);
+}
+
+/**
+ * unmap_range - 去掉从 vaddr 起的 pg_cnt 个虚拟页的映射
+ *
+ * @vaddr: 起始虚拟地址（页对齐）
+ * @pg_cnt: 页数
+ * @free_frames: 为 true 时把映射的物理页框归还给内存池，由 malloc_page_huge 建立的 4MB 大页整块归还
+ *
+ * 不存在的页（按需分配区域中从未访问过的页、整张不存在的页表）直接跳过。
+ * 页表项整个清 0，不留下页框地址和 PG_COW、PG_SWAP 位，以免日后这个虚拟页被重新使用时缺页处理把旧表项误当成换出页或写时复制页；
+ * 全部清完后统一刷新 TLB：页数不超过 TLB_FLUSH_BATCH，或者范围中有全局页（重新加载 CR3 清不掉）时，
+ * 逐页 invlpg；否则重新加载一次 CR3 清空整个 TLB，比逐页 invlpg 更省。
+ * 整个过程关中断，页框虽然先于 TLB 刷新归还，但在刷新之前不会被再次分配出去。
+ */
+void unmap_range(uint32_t vaddr, uint32_t pg_cnt, bool free_frames)
+{
+    ASSERT(vaddr % PG_SIZE == 0);
+    enum intr_status old_status = intr_disable();
+    uint32_t done = 0;
+    uint32_t cleared = 0; // 实际清除的页表项数
+    bool global = false;  // 清除的页表项中是否有全局页
+    while (done < pg_cnt)
+    {
+        uint32_t cur = vaddr + done * PG_SIZE;
+        uint32_t *pde = pde_ptr(cur);
+        if (*pde & PG_PS)
+        {
+            // 由 malloc_page_huge 建立的 4MB 大页，整块归还（page_table_huge_remove 自己刷新 TLB）
+            ASSERT(free_frames && cur % BUDDY_MAX_BLOCK == 0 && pg_cnt - done >= PG_HUGE_PAGES);
+            page_table_huge_remove(cur);
+            done += PG_HUGE_PAGES;
+            continue;
+        }
+
+        uint32_t run = PG_TABLE_ENTRIES - PTE_IDX(cur);
+        if (run > pg_cnt - done)
+        {
+            run = pg_cnt - done;
+        }
+        if (*pde & PG_P_1)
+        {
+            uint32_t *pte = pte_ptr(cur);
+            uint32_t idx;
+            for (idx = 0; idx < run; idx++)
+            {
+                if (!(pte[idx] & PG_P_1))
+                {
+                    if (free_frames && (pte[idx] & PG_SWAP)) // 已换出的页只需释放交换槽
+                    {
+                        swap_slot_free(pte[idx]);
+                        pte[idx] = 0;
+                    }
+                    continue;
+                }
+                if (free_frames)
+                {
+                    uint32_t pg_phy_addr = pte[idx] & 0xfffff000;
+                    // 确保待释放的物理内存在低端 1MB 以及页目录表、页表所在的物理地址范围之外
+                    ASSERT(pg_phy_addr >= 0x102000);
+                    if (page_ref_put(pg_phy_addr)) // 写时复制共享的页框要等最后一个映射解除时才释放
+                    {
+                        pfree(pg_phy_addr);
+                    }
+                }
+                global = global || (pte[idx] & PG_G);
+                pte[idx] = 0;
+                cleared++;
+            }
+        }
+        done += run;
+    }
+
+    if (cleared > 0)
+    {
+        if (pg_cnt <= TLB_FLUSH_BATCH || global)
+        {
+            for (done = 0; done < pg_cnt; done++)
+            {
+                asm volatile("invlpg %0" : : "m"(*(char *)(vaddr + done * PG_SIZE)) : "memory"); // 操作数是 vaddr 所指的内存
+            }
+        }
+        else
+        {
+            uint32_t cr3;
+            asm volatile("movl %%cr3, %0; movl %0, %%cr3" : "=r"(cr3) : : "memory");
+        }
+    }
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 添加虚拟地址 _vaddr 和物理地址 _page_phyaddr 的映射（单页的 map_range）
+ *
+ * @return 成功返回 true；需要新建页表但内核物理内存池已无空闲页时返回 false，此时页表未作任何修改
+ */
+static bool page_table_add(void *_vaddr, void *_page_phyaddr, uint32_t flags)
+{
+    uint32_t page_phyaddr = (uint32_t)_page_phyaddr;
+    return map_range((uint32_t)_vaddr, &page_phyaddr, 1, flags);
+}
+
+/**
+ * @brief 返回内存池 pf 中页的页表项属性：内核页仅限特权级 0~2 访问，用户页允许特权级 3 访问，都可读写
+ */
+static uint32_t pf_pte_flags(enum pool_flags pf)
+{
+    // 内核空间在所有进程的页目录中都相同，标记为全局页，切换页目录（重新加载 CR3）时它们的 TLB 条目得以保留
+    return (pf & PF_KERNEL) ? (PG_US_S | PG_RW_W | (pge_enabled ? PG_G : 0)) : (PG_US_U | PG_RW_W);
+}
+
+/**
+ * malloc_page - 在 pf 所指向的内存池中分配指定 pg_cnt 数量的页空间，返回起始虚拟地址
+ *
+ *
+ * @param pf: 指定内存池（内核或用户）
+ * @param pg_cnt: 要分配的页数量
+ *
+ * @return: 成功则返回起始虚拟地址，失败返回 NULL
+ *
+ * 此函数实现三个步骤：（申请虚拟地址，然后为此虚拟地址分配物理地址，并在页表中建立好虚拟地址到物理地址的映射）
+ * 1. 通过 vaddr_get 在虚拟地址空间中申请 pg_cnt 个虚拟页。
+ * 2. 通过 palloc 在物理内存池中申请 pg_cnt 个物理页。
+ * 3. 通过 map_range 将以上得到的 虚拟地址 和 物理地址 在页表中建立映射（第 2、3 步按 MAP_BATCH 页一批交替进行）。
+ *
+ * malloc_page 就是以上三个函数的封装
+ *
+ * 第 2、3 步中途失败时，会把已经映射的页（连同物理页框）以及全部 pg_cnt 个虚拟页回滚，不留下半成品。
+ */
+void *malloc_page(enum pool_flags pf, uint32_t pg_cnt)
+{
+    return malloc_page_zero(pf, pg_cnt, false, __builtin_return_address(0));
+}
+
+/**
+ * @brief malloc_page 与 get_kernel_pages 的公共入口，把本次分配的结果、耗时和调用点 caller 记入内存统计
+ */
+static void *malloc_page_zero(enum pool_flags pf, uint32_t pg_cnt, bool zero, void *caller)
+{
+    uint64_t start = rdtsc();
+    void *vaddr = malloc_page_map(pf, pg_cnt, zero);
+    memstat_alloc(pf, pg_cnt, (uint32_t)(rdtsc() - start), caller, vaddr != NULL);
+    return vaddr;
+}
+
+/**
+ * @brief malloc_page 的实现，zero 为 true 时保证返回的页内容全为 0
+ *
+ * 需要清 0 时，内核页优先取后台线程预先清 0 的页框（见 page_zero_take），取不到再在映射后就地清 0。
+ */
+static void *malloc_page_map(enum pool_flags pf, uint32_t pg_cnt, bool zero)
+{
+    ASSERT(pg_cnt > 0); // 页数的上限由虚拟地址池决定，超出时 vaddr_get 返回 NULL
+    // 页数是 4MB 的整数倍时优先用 4MB 大页映射，失败（没有对齐的虚拟地址或物理块）再退回逐页映射
+    if (pse_enabled && pf == PF_KERNEL && pg_cnt % PG_HUGE_PAGES == 0)
+    {
+        void *huge_vaddr = malloc_page_huge(pf, pg_cnt);
+        if (huge_vaddr != NULL)
+        {
+            if (zero)
+            {
+                page_zero_range(huge_vaddr, pg_cnt); // 大页没有预先清 0 的来源，只能就地清 0
+            }
+            return huge_vaddr;
+        }
+    }
+
+    void *vaddr_start = vaddr_get(pf, pg_cnt);
+    if (vaddr_start == NULL)
+    {
+        return NULL; // 虚拟地址申请失败
+    }
+
+    uint32_t vaddr = (uint32_t)vaddr_start; // 分配的虚拟内存起始地址
+    uint32_t cnt = pg_cnt;
+    struct pool *mem_pool = (pf & PF_KERNEL) ? &kernel_pool : &user_pool; // 判断是内核物理内存池还是用户物理内存池
+    bool dma = (pf & PF_DMA) != 0;
+
+    /* 虚拟地址是连续的，但物理地址可能不连续：每次申请最多 MAP_BATCH 个页框，再用 map_range 一次写入它们的页表项 */
+    while (cnt > 0)
+    {
+        uint32_t frames[MAP_BATCH]; // 本批申请到的物理页框
+        uint32_t need_zero = 0;     // 第 i 位为 1 表示第 i 个页框映射后还需就地清 0
+        uint32_t batch = (cnt < MAP_BATCH) ? cnt : MAP_BATCH;
+        uint32_t got = 0;
+        while (got < batch)
+        {
+            // 在相应的内存池申请物理页，需要清 0 的内核页先尝试取预先清 0 的页框
+            // 有 PF_DMA 限制时直接从 ZONE_DMA 分配（magazine 中没有 ZONE_DMA 的页框，预先清 0 的页框可能来自任何区域）
+            uint32_t page_phyaddr = (zero && mem_pool == &kernel_pool && !dma) ? page_zero_take() : 0;
+            if (page_phyaddr == 0)
+            {
+                page_phyaddr = (uint32_t)(dma ? palloc_order(mem_pool, 0, true) : palloc(mem_pool));
+                if (page_phyaddr == 0)
+                {
+                    break; // 物理页不足，本批映射完后到下面回滚
+                }
+                if (zero)
+                {
+                    need_zero |= 1 << got;
+                }
+            }
+            frames[got++] = page_phyaddr;
+        }
+
+        // 在页表中建立映射（将从 vaddr 起的 got 个虚拟页映射为 frames 中的物理页框）
+        if (got > 0 && !map_range(vaddr, frames, got, pf_pte_flags(pf)))
+        {
+            uint32_t idx;
+            for (idx = 0; idx < got; idx++)
+            {
+                pfree(frames[idx]); // 这批页框都还没映射上，逐个归还
+            }
+            break;
+        }
+        uint32_t idx;
+        for (idx = 0; idx < got; idx++)
+        {
+            if (need_zero & (1 << idx))
+            {
+                page_zero_range((void *)(vaddr + idx * PG_SIZE), 1);
+            }
+        }
+        vaddr += got * PG_SIZE; // 移动到下一批虚拟页
+        cnt -= got;
+        if (got < batch)
+        {
+            break;
+        }
+    }
+
+    if (cnt > 0)
+    {
+        /* 申请失败：虽然地址还未使用，但虚拟内存池和物理内存池的位图都已经被修改了，要全部回滚 */
+        malloc_page_rollback(pf, vaddr_start, pg_cnt - cnt, pg_cnt);
+        return NULL;
+    }
+    return vaddr_start; // 返回起始虚拟地址
+}
+
+/**
+ * get_a_page - 在当前进程的地址空间中，为指定的用户虚拟地址 vaddr 分配一页物理内存并建立映射
+ * @param pf: 内存池标志，只支持 PF_USER（内核虚拟地址由区间树统一分配，不能指定地址）
+ * @param vaddr: 页对齐的用户虚拟地址
+ * @return: 成功返回 vaddr，失败返回 NULL
+ *
+ * 与 malloc_page 的区别是虚拟地址由调用者指定（例如用户进程的 3 级栈位于用户空间的最高页），
+ * 该页在用户虚拟地址池中的对应位随之置 1。页框清 0 后才交给用户进程，以免泄露其他进程或内核的数据。
+ */
+void *get_a_page(enum pool_flags pf, uint32_t vaddr)
+{
+    struct task_struct *cur = running_thread();
+    ASSERT(pf == PF_USER && cur->pgdir != NULL && vaddr % PG_SIZE == 0);
+    uint64_t start = rdtsc();
+
+    enum intr_status old_status = intr_disable();
+    uint32_t bit_idx = (vaddr - cur->userprog_vaddr.vaddr_start) / PG_SIZE;
+    ASSERT(vaddr >= cur->userprog_vaddr.vaddr_start && !bitmap_scan_test(&cur->userprog_vaddr.vaddr_bitmap, bit_idx));
+    bitmap_set(&cur->userprog_vaddr.vaddr_bitmap, bit_idx, 1);
+
+    uint32_t page_phyaddr = (uint32_t)palloc(&user_pool);
+    if (page_phyaddr == 0 || !page_table_add((void *)vaddr, (void *)page_phyaddr, pf_pte_flags(pf)))
+    {
+        if (page_phyaddr != 0)
+        {
+            pfree(page_phyaddr);
+        }
+        bitmap_set(&cur->userprog_vaddr.vaddr_bitmap, bit_idx, 0);
+        intr_set_status(old_status);
+        memstat_alloc(pf, 1, (uint32_t)(rdtsc() - start), __builtin_return_address(0), false);
+        return NULL;
+    }
+    intr_set_status(old_status);
+    page_zero_range((void *)vaddr, 1);
+    memstat_alloc(pf, 1, (uint32_t)(rdtsc() - start), __builtin_return_address(0), true);
+    return (void *)vaddr;
+}
+
+/**
+ * get_kernel_pages - 从内核物理内存池中申请指定页数的内存
+ * @param pg_cnt: 要申请的页数量
+ * @return: 成功则返回起始虚拟地址，失败返回 NULL
+ *
+ * 通过调用 malloc_page 函数实现内存分配，并将分配的页初始化为 0。
+ */
+void *get_kernel_pages(uint32_t pg_cnt)
+{
+    // 从内核内存池中申请页，返回的页已清 0（优先使用后台预先清 0 的页框）
+    return malloc_page_zero(PF_KERNEL, pg_cnt, true, __builtin_return_address(0));
+}
+
+/**
+ * malloc_page_contig - 在 pf 所指向的内存池中分配 2^order 个物理上连续的页，返回起始虚拟地址
+ *
+ * @param pf: 指定内存池（内核或用户）
+ * @param order: 块的阶，实际分配 2^order 页（0 ~ MAX_ORDER）
+ *
+ * @return: 成功则返回起始虚拟地址，失败返回 NULL
+ *
+ * 与 malloc_page 的区别在于物理页由伙伴系统一次性分配，因此物理地址连续，且按 2^order 页天然对齐，
+ * 可以用于页表、DMA 缓冲区等要求物理连续的场合，物理地址可由 addr_v2p 获得。
+ */
+void *malloc_page_contig(enum pool_flags pf, uint32_t order)
+{
+    return malloc_page_contig_tag(pf, order, __builtin_return_address(0));
+}
+
+/**
+ * @brief malloc_page_contig 与 get_kernel_contig_pages 的公共入口，把本次分配记入内存统计
+ */
+static void *malloc_page_contig_tag(enum pool_flags pf, uint32_t order, void *caller)
+{
+    uint64_t start = rdtsc();
+    void *vaddr = malloc_page_contig_map(pf, order);
+    memstat_alloc(pf, 1 << order, (uint32_t)(rdtsc() - start), caller, vaddr != NULL);
+    return vaddr;
+}
+
+/**
+ * @brief malloc_page_contig 的实现
+ */
+static void *malloc_page_contig_map(enum pool_flags pf, uint32_t order)
+{
+    ASSERT(order <= MAX_ORDER);
+    uint32_t pg_cnt = 1 << order;
+    void *vaddr_start = vaddr_get(pf, pg_cnt);
+    if (vaddr_start == NULL)
+    {
+        return NULL; // 虚拟地址申请失败
+    }
+
+    struct pool *mem_pool = (pf & PF_KERNEL) ? &kernel_pool : &user_pool;
+    uint32_t page_phyaddr = (uint32_t)palloc_order(mem_pool, order, (pf & PF_DMA) != 0);
+    if (page_phyaddr == 0)
+    {
+        vaddr_remove(pf, vaddr_start, pg_cnt); // 没有足够大的连续物理块，归还虚拟地址
+        return NULL;
+    }
+
+    if (!map_range_contig((uint32_t)vaddr_start, page_phyaddr, pg_cnt, pf_pte_flags(pf)))
+    {
+        /* map_range_contig 失败时不留下映射，块逐页归还（伙伴系统会自动合并）后再归还虚拟地址 */
+        uint32_t idx;
+        for (idx = 0; idx < pg_cnt; idx++)
+        {
+            pfree(page_phyaddr + idx * PG_SIZE);
+        }
+        vaddr_remove(pf, vaddr_start, pg_cnt);
+        return NULL;
+    }
+    return vaddr_start;
+}
+
+/**
+ * get_kernel_contig_pages - 从内核物理内存池中申请 2^order 个物理连续的页，并清 0
+ * @param order: 块的阶
+ * @return: 成功则返回起始虚拟地址，失败返回 NULL
+ */
+void *get_kernel_contig_pages(uint32_t order)
+{
+    void *vaddr = malloc_page_contig_tag(PF_KERNEL, order, __builtin_return_address(0));
+    if (vaddr != NULL)
+    {
+        page_zero_range(vaddr, 1 << order);
+    }
+    return vaddr;
+}
+
+/**
+ * @brief 得到虚拟地址 vaddr 映射到的物理地址
+ *
+ * @param vaddr 已映射的虚拟地址
+ * @return uint32_t 对应的物理地址（页框地址 + 页内偏移）
+ */
+uint32_t addr_v2p(uint32_t vaddr)
+{
+    uint32_t *pde = pde_ptr(vaddr);
+    if (*pde & PG_PS)
+    {
+        // 4MB 大页：页目录项的高 10 位即物理页框地址，虚拟地址的低 22 位是页内偏移
+        return ((*pde & 0xffc00000) + (vaddr & 0x003fffff));
+    }
+    uint32_t *pte = pte_ptr(vaddr);
+    // (*pte) 的值是页表所在的物理页框地址，去掉其低 12 位的页表项属性 + 虚拟地址 vaddr 的低 12 位
+    return ((*pte & 0xfffff000) + (vaddr & 0x00000fff));
+}
+
+/**
+ * @brief 在虚拟地址池中释放以 _vaddr 起始的连续 pg_cnt 个虚拟页地址
+ *
+ * @param pf 内存池标志（内核或用户）
+ * @param _vaddr 起始虚拟地址
+ * @param pg_cnt 页数
+ */
+static void vaddr_remove(enum pool_flags pf, void *_vaddr, uint32_t pg_cnt)
+{
+    uint32_t vaddr = (uint32_t)_vaddr;
+    if (pf & PF_KERNEL) // 内核虚拟内存池
+    {
+        uint32_t bit_idx_start = (vaddr - kernel_vaddr.vaddr_start) / PG_SIZE;
+        enum intr_status old_status = intr_disable();
+        kvaddr_free(bit_idx_start, pg_cnt);
+        intr_set_status(old_status);
+    }
+    else // 用户虚拟内存池
+    {
+        struct task_struct *cur = running_thread();
+        uint32_t bit_idx_start = (vaddr - cur->userprog_vaddr.vaddr_start) / PG_SIZE;
+        enum intr_status old_status = intr_disable();
+        bitmap_set_range(&cur->userprog_vaddr.vaddr_bitmap, bit_idx_start, pg_cnt, 0);
+        intr_set_status(old_status);
+    }
+}
+
+/**
+ * mfree_page - 释放以虚拟地址 _vaddr 起始的 pg_cnt 个物理页框
+ *
+ * @param pf: 内存池标志（内核或用户）
+ * @param _vaddr: 起始虚拟地址（页对齐）
+ * @param pg_cnt: 页数
+ *
+ * 是 malloc_page 的逆过程：
+ * 1. 通过 pfree 把每一页映射的物理页框回收到其所属的物理内存池
+ * 2. 通过 unmap_range 删除页表中的映射并成批刷新 TLB（与第 1 步在同一次遍历中完成）
+ * 3. 通过 vaddr_remove 把虚拟地址归还给虚拟地址池
+ */
+void mfree_page(enum pool_flags pf, void *_vaddr, uint32_t pg_cnt)
+{
+    mfree_page_unmap(pf, _vaddr, pg_cnt);
+    memstat_free(pf, pg_cnt);
+}
+
+/**
+ * @brief mfree_page 的实现（不计入内存统计，malloc_page_rollback 撤销失败的分配时直接调用它）
+ */
+static void mfree_page_unmap(enum pool_flags pf, void *_vaddr, uint32_t pg_cnt)
+{
+    ASSERT(pg_cnt >= 1 && (uint32_t)_vaddr % PG_SIZE == 0);
+
+    enum intr_status old_status = intr_disable();
+    unmap_range((uint32_t)_vaddr, pg_cnt, true); // 归还物理页框并去掉映射（按需分配区域中未访问过的页没有页框）
+    vaddr_remove(pf, _vaddr, pg_cnt);            // 归还虚拟地址
+
+    /* 若释放的是整个按需分配区域，注销该区域（区域都在内核空间中） */
+    struct lazy_region *region = (pf & PF_KERNEL) ? lazy_region_find((uint32_t)_vaddr) : NULL;
+    if (region != NULL && region->vaddr_start == (uint32_t)_vaddr)
+    {
+        ASSERT(region->pg_cnt == pg_cnt); // 按需分配区域只能整体释放
+        region->pg_cnt = 0;
+    }
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 撤销一次未完成的 malloc_page / malloc_page_contig
+ *
+ * 前 mapped_cnt 页已建立映射，通过 mfree_page 解除映射并归还物理页框与虚拟地址；
+ * 其余未映射的虚拟页只需归还虚拟地址。
+ *
+ * @param pf 内存池标志（内核或用户）
+ * @param vaddr_start 本次申请的起始虚拟地址
+ * @param mapped_cnt 已经建立映射的页数
+ * @param pg_cnt 本次申请的总页数
+ */
+static void malloc_page_rollback(enum pool_flags pf, void *vaddr_start, uint32_t mapped_cnt, uint32_t pg_cnt)
+{
+    if (mapped_cnt > 0)
+    {
+        mfree_page_unmap(pf, vaddr_start, mapped_cnt);
+    }
+    if (pg_cnt > mapped_cnt)
+    {
+        vaddr_remove(pf, (void *)((uint32_t)vaddr_start + mapped_cnt * PG_SIZE), pg_cnt - mapped_cnt);
+    }
+}
+
+/**
+ * @brief 检测处理器是否支持 4MB 大页，支持则置位 CR4.PSE
+ *
+ * CPUID 1 号功能返回的 edx 第 3 位为 PSE 标志。
+ */
+static void pse_init(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    if (!(edx & (1 << 3)))
+    {
+        put_str("   PSE not supported, 4MB pages disabled\n");
+        return;
+    }
+    uint32_t cr4;
+    asm volatile("movl %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_PSE;
+    asm volatile("movl %0, %%cr4" : : "r"(cr4) : "memory");
+    pse_enabled = true;
+    put_str("   PSE enabled\n");
+}
+
+/**
+ * @brief 收紧 loader 建立的低端 1MB 映射的权限：内核映像的只读段对 3 特权级只读可见，其余页仅限特权级 0~2 访问
+ *
+ * loader 把低端 1MB（内核映像、GDT、显存、主线程的 PCB 等）都映射为用户可读写，用户进程共享第 768 个页目录项后，
+ * 3 特权级可以直接改写内核的数据段。这里按内核 ELF 映像的程序头重新设置这些页表项：
+ *  ① 先清除全部页表项的 US 位
+ *  ② 不可写的 PT_LOAD 段（代码、只读数据）所在页置 US、清 RW，作为用户程序的代码（用户程序目前还是内核映像中的函数）
+ *  ③ 可写的段（.data、.bss）所在页清 US、置 RW，与只读段共用一页时以可写段为准
+ * 开启 CR0.WP 后内核也不能写只读段。须在 pge_init 之前调用，此时还没有全局页，重新加载 CR3 即可清空旧的 TLB 条目。
+ */
+static void kernel_image_protect(void)
+{
+    struct elf32_ehdr *ehdr = (struct elf32_ehdr *)KERNEL_ELF_HDR;
+    ASSERT(*(uint32_t *)ehdr->e_ident == 0x464c457f); // "\x7fELF"
+
+    uint32_t vaddr;
+    for (vaddr = 0xc0000000; vaddr < K_META_START; vaddr += PG_SIZE)
+    {
+        *pte_ptr(vaddr) &= ~PG_US_U;
+    }
+
+    uint32_t pass;
+    for (pass = 0; pass < 2; pass++) // 第 0 遍处理只读段，第 1 遍处理可写段
+    {
+        uint32_t idx;
+        for (idx = 0; idx < ehdr->e_phnum; idx++)
+        {
+            struct elf32_phdr *phdr = (struct elf32_phdr *)(KERNEL_ELF_HDR + ehdr->e_phoff + idx * ehdr->e_phentsize);
+            bool writable = (phdr->p_flags & PF_W) != 0;
+            if (phdr->p_type != PT_LOAD || phdr->p_memsz == 0 || writable != (pass == 1))
+            {
+                continue;
+            }
+            for (vaddr = phdr->p_vaddr & 0xfffff000; vaddr < phdr->p_vaddr + phdr->p_memsz; vaddr += PG_SIZE)
+            {
+                uint32_t *pte = pte_ptr(vaddr);
+                *pte = writable ? ((*pte & ~PG_US_U) | PG_RW_W) : ((*pte & ~PG_RW_W) | PG_US_U);
+            }
+        }
+    }
+    asm volatile("movl %%cr3, %0; movl %0, %%cr3" : "=r"(vaddr) : : "memory");
+}
+
+/**
+ * @brief 去掉 loader 建立的低端 1MB 恒等映射（内核页目录表的第 0 项）
+ *
+ * 恒等映射只在 loader 开启分页后、跳入内核之前用到，内核中的代码都经 0xc0000000 起的高端地址访问低端 1MB。
+ * 须在 pge_init 之前调用，此时还没有全局页，重新加载 CR3 即可清空恒等地址上的 TLB 条目。
+ */
+static void identity_map_remove(void)
+{
+    uint32_t *pde = pde_ptr(0);
+    *pde = 0;
+    uint32_t cr3;
+    asm volatile("movl %%cr3, %0; movl %0, %%cr3" : "=r"(cr3) : : "memory");
+}
+
+/**
+ * @brief 检测处理器是否支持全局页，支持则把内核空间已有的映射标记为全局页，再置位 CR4.PGE
+ *
+ * 已有的映射包括 loader 建立的低端 1MB 映射和元数据区域，之后新建的内核映射由 pf_pte_flags 带上 G 位。
+ * 第 1023 个页目录项（页目录表自身的映射）在每个页目录中都不同，不能标记为全局页，所以只处理第 768~1022 个页目录项。
+ * loader 让第 0 个页目录项与第 768 个共用同一张页表，所以须先由 identity_map_remove 去掉低端 1MB 的恒等映射，
+ * 否则置上 G 位的页表项经第 0 个页目录项同样成为全局页，恒等地址上的 TLB 条目在切换地址空间后依然有效。
+ */
+static void pge_init(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    if (!(edx & (1 << 13)))
+    {
+        put_str("   PGE not supported, kernel TLB entries flushed on every CR3 load\n");
+        return;
+    }
+
+    uint32_t pde_idx;
+    for (pde_idx = KERNEL_PDE_START; pde_idx < 1023; pde_idx++)
+    {
+        uint32_t vaddr = pde_idx << 22;
+        uint32_t *pde = pde_ptr(vaddr);
+        if (!(*pde & PG_P_1) || (*pde & PG_PS))
+        {
+            continue; // 此时还没有 4MB 大页，新建的大页由 page_table_huge_add 设置 G 位
+        }
+        uint32_t *pte = pte_ptr(vaddr);
+        uint32_t idx;
+        for (idx = 0; idx < PG_TABLE_ENTRIES; idx++)
+        {
+            if (pte[idx] & PG_P_1)
+            {
+                pte[idx] |= PG_G;
+            }
+        }
+    }
+
+    uint32_t cr4;
+    asm volatile("movl %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_PGE;
+    asm volatile("movl %0, %%cr4" : : "r"(cr4) : "memory"); // 改写 CR4.PGE 会清空整个 TLB，之后按新的 G 位重新缓存
+    pge_enabled = true;
+    put_str("   PGE enabled\n");
+}
+
+/**
+ * @brief 把内核页目录表映射到内核虚拟地址空间
+ *
+ * 内核线程运行时可以通过第 1023 个页目录项访问内核页目录表，但进程运行时那里是进程自己的页目录表，
+ * 同步 4MB 大页的页目录项时需要另一条途径访问内核页目录表。
+ */
+static void kernel_pgdir_map(void)
+{
+    kernel_pgdir = vaddr_get(PF_KERNEL, 1);
+    if (kernel_pgdir == NULL || !page_table_add(kernel_pgdir, (void *)KERNEL_PGDIR_PHY, pf_pte_flags(PF_KERNEL)))
+    {
+        PANIC("kernel_pgdir_map: no memory");
+    }
+}
+
+/**
+ * @brief 在内核虚拟地址池中申请按 4MB 对齐的 pg_cnt 个虚拟页
+ *
+ * 内核虚拟地址池紧随元数据之后开始，并不一定在 4MB 边界上，因此查找时要用 offset 补齐这段偏移。
+ *
+ * @return void* 成功返回 4MB 对齐的起始虚拟地址，失败返回 NULL
+ */
+static void *vaddr_get_huge(enum pool_flags pf, uint32_t pg_cnt)
+{
+    ASSERT(pf == PF_KERNEL);
+    uint32_t misalign = (kernel_vaddr.vaddr_start % BUDDY_MAX_BLOCK) / PG_SIZE;
+    uint32_t offset = (PG_HUGE_PAGES - misalign) % PG_HUGE_PAGES;
+
+    enum intr_status old_status = intr_disable();
+    int bit_idx_start = kvaddr_alloc(pg_cnt, PG_HUGE_PAGES, offset);
+    intr_set_status(old_status);
+    if (bit_idx_start == -1)
+    {
+        return NULL;
+    }
+    return (void *)(kernel_vaddr.vaddr_start + bit_idx_start * PG_SIZE);
+}
+
+/**
+ * @brief 用一个 4MB 大页目录项把虚拟地址 vaddr 映射到物理地址 page_phyaddr
+ *
+ * 内核空间的页目录项在 loader 中已全部指向预先建好的页表，这里先保存原值再改写为大页，
+ * 由于该 4MB 范围在虚拟地址池中是空闲的，原页表中不应有任何有效的页表项。
+ * 改写页目录项后要用 invlpg 作废处理器缓存的旧页目录项。
+ */
+static void page_table_huge_add(uint32_t vaddr, uint32_t page_phyaddr)
+{
+    ASSERT(vaddr % BUDDY_MAX_BLOCK == 0 && page_phyaddr % BUDDY_MAX_BLOCK == 0);
+    uint32_t *pde = pde_ptr(vaddr);
+    ASSERT(PDE_IDX(vaddr) >= KERNEL_PDE_START && !(*pde & PG_PS));
+    if (*pde & PG_P_1)
+    {
+        uint32_t pg_idx;
+        for (pg_idx = 0; pg_idx < PG_HUGE_PAGES; pg_idx++)
+        {
+            ASSERT(!(*pte_ptr(vaddr + pg_idx * PG_SIZE) & PG_P_1));
+        }
+    }
+    pse_saved_pde[PDE_IDX(vaddr) - KERNEL_PDE_START] = *pde;
+    *pde = (page_phyaddr | PG_PS | PG_US_S | PG_RW_W | PG_P_1 | (pge_enabled ? PG_G : 0)); // 大页目录项的第 8 位即 G 位
+    process_sync_kernel_pde(vaddr); // 页目录项不像内核页表那样被各页目录表共享，要同步到其他地址空间
+    asm volatile("invlpg %0" : : "m"(*(char *)vaddr) : "memory");
+}
+
+/**
+ * @brief 去掉虚拟地址 vaddr 所在的 4MB 大页映射，把物理块整块归还内存池，并恢复原页目录项
+ */
+static void page_table_huge_remove(uint32_t vaddr)
+{
+    uint32_t *pde = pde_ptr(vaddr);
+    ASSERT(*pde & PG_PS);
+    uint32_t pg_phy_addr = *pde & 0xffc00000;
+    struct pool *mem_pool = (pg_phy_addr >= user_pool.phy_addr_start) ? &user_pool : &kernel_pool;
+    *pde = pse_saved_pde[PDE_IDX(vaddr) - KERNEL_PDE_START];
+    process_sync_kernel_pde(vaddr);
+    asm volatile("invlpg %0" : : "m"(*(char *)vaddr) : "memory"); // 作废该 4MB 大页的 TLB 条目
+    pool_free_block(mem_pool, pg_phy_addr, MAX_ORDER);
+}
+
+/**
+ * malloc_page_huge - 用 4MB 大页分配 pg_cnt 个页（pg_cnt 须为 1024 的整数倍）
+ *
+ * @param pf: 指定内存池（目前只支持内核）
+ * @param pg_cnt: 要分配的页数量
+ *
+ * @return: 成功则返回 4MB 对齐的起始虚拟地址，失败返回 NULL（已分配的部分会回滚）
+ *
+ * 虚拟地址按 4MB 对齐申请，物理块取伙伴系统的最大块（2^MAX_ORDER 页），它相对 buddy_base 对齐，
+ * 而 buddy_base 本身按 4MB 对齐，所以物理地址也满足大页的对齐要求。
+ */
+static void *malloc_page_huge(enum pool_flags pf, uint32_t pg_cnt)
+{
+    ASSERT(pg_cnt % PG_HUGE_PAGES == 0);
+    void *vaddr_start = vaddr_get_huge(pf, pg_cnt);
+    if (vaddr_start == NULL)
+    {
+        return NULL;
+    }
+
+    struct pool *mem_pool = &kernel_pool;
+    uint32_t vaddr = (uint32_t)vaddr_start;
+    uint32_t mapped_cnt = 0;
+    while (mapped_cnt < pg_cnt)
+    {
+        uint32_t page_phyaddr = (uint32_t)palloc_order(mem_pool, MAX_ORDER, false);
+        if (page_phyaddr == 0)
+        {
+            malloc_page_rollback(pf, vaddr_start, mapped_cnt, pg_cnt);
+            return NULL;
+        }
+        page_table_huge_add(vaddr, page_phyaddr);
+        vaddr += BUDDY_MAX_BLOCK;
+        mapped_cnt += PG_HUGE_PAGES;
+    }
+    return vaddr_start;
+}
+
+/**
+ * @brief 为 malloc 做准备，初始化内存块描述符数组
+ *
+ * 7 种规格从 16 字节开始逐次翻倍，直到 1024 字节，每种规格的 arena 为 1 页，开头是 struct arena。
+ *
+ * @param desc_array 内存块描述符数组
+ */
+void block_desc_init(struct mem_block_desc *desc_array)
+{
+    uint16_t desc_idx, block_size = 16;
+    for (desc_idx = 0; desc_idx < DESC_CNT; desc_idx++)
+    {
+        desc_array[desc_idx].block_size = block_size;
+        // 初始化 arena 中的内存块数量
+        desc_array[desc_idx].blocks_per_arena = (PG_SIZE - sizeof(struct arena)) / block_size;
+        list_init(&desc_array[desc_idx].free_list);
+        block_size *= 2; // 更新为下一个规格内存块
+    }
+}
+
+/**
+ * @brief 返回 arena 中第 idx 个内存块的地址（desc 为 arena 所属的描述符）
+ */
+static struct mem_block *arena2block(struct arena *a, struct mem_block_desc *desc, uint32_t idx)
+{
+    return (struct mem_block *)((uint32_t)a + sizeof(struct arena) + idx * desc->block_size);
+}
+
+/**
+ * @brief 返回内存块 b 所在的 arena 地址（arena 的元信息位于内存块所在页的开头）
+ */
+static struct arena *block2arena(struct mem_block *b)
+{
+    return (struct arena *)((uint32_t)b & 0xfffff000);
+}
+
+/**************************  用户堆的检查  ******************************
+ * 用户进程的 arena 头和空闲块链表的结点都在用户可写的内存中，sys_malloc / sys_free 作为系统调用不能信任它们：
+ *  ① 从用户内存中读出的地址，只有落在 [USER_VADDR_START, 0xc0000000) 且所在页都已在进程的虚拟地址位图中分配时才访问
+ *     （这样的页要么已映射，要么由缺页异常换入或写时复制，内核访问它们不会失败）
+ *  ② arena 中记录的描述符必须是 u_desc_base 数组中的一项，换算成下标后使用本进程 u_block_desc 中的那一项
+ *  ③ 链表结点中的 prev、next 只有是本链表的首尾结点或满足 ① 时才沿着它们写入
+ * 检查失败时 sys_malloc 返回 NULL、sys_free 直接返回，受损的只是进程自己的堆。
+ * 其他系统调用传入的用户字符串同样按 ① 检查（user_str_len）。
+ ***********************************************************************/
+
+/**
+ * @brief 当前用户进程中从 vaddr 起的 len 字节是否都在用户空间、且所在页都已分配
+ */
+static bool uheap_ptr_ok(uint32_t vaddr, uint32_t len)
+{
+    if (vaddr < USER_VADDR_START || vaddr >= 0xc0000000 || len == 0 || len > 0xc0000000 - vaddr)
+    {
+        return false;
+    }
+    struct virtual_addr *uvaddr = &running_thread()->userprog_vaddr;
+    uint32_t pg = (vaddr - uvaddr->vaddr_start) / PG_SIZE;
+    uint32_t pg_end = (vaddr + len - 1 - uvaddr->vaddr_start) / PG_SIZE;
+    for (; pg <= pg_end; pg++)
+    {
+        if (!bitmap_scan_test(&uvaddr->vaddr_bitmap, pg))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief 用户堆链表 plist 中的结点指针 elem 是否可以访问（是 plist 的首尾结点，或者是用户空间中已分配的地址）
+ */
+bool uheap_elem_ok(struct list *plist, struct list_elem *elem)
+{
+    return elem == &plist->head || elem == &plist->tail || uheap_ptr_ok((uint32_t)elem, sizeof(struct list_elem));
+}
+
+/**
+ * @brief 当前用户进程中以 str 起始的字符串的长度，字符串在 max_len 字节内没有结束、或经过不在用户空间或未分配的页时返回 -1
+ *
+ * 逐页先用 uheap_ptr_ok 检查整页再读其中的字节，内核不会读到内核空间或触发无法处理的缺页异常。
+ */
+int32_t user_str_len(const char *str, uint32_t max_len)
+{
+    uint32_t vaddr = (uint32_t)str;
+    uint32_t len = 0;
+    while (len < max_len)
+    {
+        uint32_t run = PG_SIZE - (vaddr + len) % PG_SIZE; // 到本页末尾的字节数
+        if (run > max_len - len)
+        {
+            run = max_len - len;
+        }
+        if (!uheap_ptr_ok(vaddr + len, run))
+        {
+            return -1;
+        }
+        for (; run > 0; run--, len++)
+        {
+            if (str[len] == 0)
+            {
+                return len;
+            }
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief 从用户堆链表 plist 中弹出第一个结点，链表为空或已损坏时返回 NULL（不使用结点中的 prev）
+ */
+static struct list_elem *uheap_pop(struct list *plist)
+{
+    struct list_elem *elem = plist->head.next;
+    if (elem == &plist->tail || elem == &plist->head || !uheap_elem_ok(plist, elem))
+    {
+        return NULL;
+    }
+    struct list_elem *next = elem->next;
+    if (next == &plist->head || !uheap_elem_ok(plist, next))
+    {
+        return NULL;
+    }
+    plist->head.next = next;
+    next->prev = &plist->head;
+    return elem;
+}
+
+/**
+ * @brief 把已检查过的结点 elem 加到用户堆链表 plist 的末尾，链表已损坏时返回 false
+ */
+static bool uheap_append(struct list *plist, struct list_elem *elem)
+{
+    struct list_elem *last = plist->tail.prev;
+    if (last == &plist->tail || !uheap_elem_ok(plist, last))
+    {
+        return false;
+    }
+    elem->prev = last;
+    elem->next = &plist->tail;
+    last->next = elem;
+    plist->tail.prev = elem;
+    return true;
+}
+
+/**
+ * @brief 把已检查过的结点 elem 从用户堆链表 plist 中摘下，它的前后结点不可访问时返回 false
+ */
+static bool uheap_remove(struct list *plist, struct list_elem *elem)
+{
+    struct list_elem *prev = elem->prev;
+    struct list_elem *next = elem->next;
+    if (prev == &plist->tail || next == &plist->head || !uheap_elem_ok(plist, prev) || !uheap_elem_ok(plist, next))
+    {
+        return false;
+    }
+    prev->next = next;
+    next->prev = prev;
+    return true;
+}
+
+/**
+ * @brief 把用户进程 arena 中记录的描述符换算成当前进程的描述符，不是 u_desc_base 中的一项时返回 NULL
+ */
+static struct mem_block_desc *uheap_desc(struct mem_block_desc *key)
+{
+    struct task_struct *cur = running_thread();
+    uint32_t offset = (uint32_t)key - (uint32_t)cur->u_desc_base;
+    if (offset % sizeof(struct mem_block_desc) != 0 || offset / sizeof(struct mem_block_desc) >= DESC_CNT)
+    {
+        return NULL;
+    }
+    return &cur->u_block_desc[offset / sizeof(struct mem_block_desc)];
+}
+
+/**
+ * sys_malloc - 在堆中申请 size 字节内存
+ * @param size: 申请的字节数
+ * @return: 成功返回内存块地址，失败返回 NULL
+ *
+ * 不超过 1024 字节的申请按 2 的幂向上取整到对应规格，从该规格描述符的 free_list 中取一块，
+ * free_list 为空时先用 malloc_page 申请 1 页作为新的 arena 并切分成同规格的内存块；
+ * 超过 1024 字节的申请直接分配若干整页，页首同样存放 arena 元信息以便 sys_free 识别。
+ */
+void *sys_malloc(uint32_t size)
+{
+    enum pool_flags PF;
+    struct mem_block_desc *descs;
+    uint32_t pool_size;
+    struct task_struct *cur_thread = running_thread();
+    bool user = (cur_thread->pgdir != NULL);
+
+    /* 判断用哪个内存池：内核线程用内核堆，用户进程用自己 PCB 中的内存块描述符管理的用户堆 */
+    if (cur_thread->pgdir == NULL)
+    {
+        PF = PF_KERNEL;
+        pool_size = kernel_pool.pool_size;
+        descs = k_block_descs;
+    }
+    else
+    {
+        PF = PF_USER;
+        pool_size = user_pool.pool_size;
+        descs = cur_thread->u_block_desc;
+    }
+
+    /* 若申请的内存不在内存池容量范围内则直接返回 NULL */
+    if (!(size > 0 && size < pool_size))
+    {
+        return NULL;
+    }
+
+    struct arena *a;
+    struct mem_block *b;
+    enum intr_status old_status = intr_disable(); // arena 的切分与 free_list 的修改要保持原子操作
+
+    /* 超过最大内存块 1024，就分配页框 */
+    if (size > 1024)
+    {
+        uint32_t page_cnt = DIV_ROUND_UP(size + sizeof(struct arena), PG_SIZE); // 向上取整需要的页框数
+        a = malloc_page(PF, page_cnt);
+        if (a == NULL)
+        {
+            intr_set_status(old_status);
+            return NULL;
+        }
+        memset(a, 0, page_cnt * PG_SIZE); // 将分配的内存清 0
+        /* 对于分配的大块页框，将 desc 置为 NULL，cnt 置为页框数，large 置为 true */
+        a->desc = NULL;
+        a->cnt = page_cnt;
+        a->large = true;
+        intr_set_status(old_status);
+        return (void *)(a + 1); // 跨过 arena 大小，把剩下的内存返回
+    }
+
+    /* 若申请的内存小于等于 1024，可在各种规格的 mem_block_desc 中去适配 */
+    uint8_t desc_idx;
+    for (desc_idx = 0; desc_idx < DESC_CNT; desc_idx++)
+    {
+        if (size <= descs[desc_idx].block_size) // 从小往大，找到后退出
+        {
+            break;
+        }
+    }
+
+    struct mem_block_desc *desc = &descs[desc_idx];
+
+    /* 若 mem_block_desc 的 free_list 中已经没有可用的 mem_block，就创建新的 arena 提供 mem_block */
+    if (list_empty(&desc->free_list))
+    {
+        a = malloc_page(PF, 1); // 分配 1 页框作为 arena
+        if (a == NULL)
+        {
+            intr_set_status(old_status);
+            return NULL;
+        }
+        memset(a, 0, PG_SIZE);
+
+        /* 对于分配的小块内存，将 desc 置为相应内存块描述符（用户进程记为 u_desc_base 中的对应项），cnt 置为此 arena 可用的内存块数，large 置为 false */
+        a->desc = user ? &cur_thread->u_desc_base[desc_idx] : desc;
+        a->large = false;
+        a->cnt = desc->blocks_per_arena;
+
+        /* 开始将 arena 拆分成内存块，并添加到内存块描述符的 free_list 中 */
+        uint32_t block_idx;
+        for (block_idx = 0; block_idx < desc->blocks_per_arena; block_idx++)
+        {
+            b = arena2block(a, desc, block_idx);
+            if (!user)
+            {
+                ASSERT(!elem_find(&desc->free_list, &b->free_elem));
+                list_append(&desc->free_list, &b->free_elem);
+            }
+            else if (!uheap_append(&desc->free_list, &b->free_elem))
+            {
+                intr_set_status(old_status);
+                return NULL; // 用户堆的链表已损坏（新 arena 的页留在进程的地址空间中，随进程回收）
+            }
+        }
+    }
+
+    /* 开始分配内存块 */
+    struct list_elem *elem = user ? uheap_pop(&desc->free_list) : list_pop(&desc->free_list);
+    if (elem == NULL)
+    {
+        intr_set_status(old_status);
+        return NULL;
+    }
+    b = elem2entry(struct mem_block, free_elem, elem);
+    memset(b, 0, desc->block_size);
+
+    a = block2arena(b); // 获取内存块 b 所在的 arena
+    a->cnt--;           // 将此 arena 中的空闲内存块数减 1
+    intr_set_status(old_status);
+    return (void *)b;
+}
+
+/**
+ * @brief 回收当前用户进程的堆内存 ptr，arena 头或空闲链表不合法时不做任何回收直接返回
+ */
+static void sys_free_user(void *ptr)
+{
+    if (!uheap_ptr_ok((uint32_t)ptr, 1))
+    {
+        return;
+    }
+    enum intr_status old_status = intr_disable();
+    struct mem_block *b = ptr;
+    struct arena *a = block2arena(b);
+    if (a->desc == NULL)
+    {
+        /* 大块内存：ptr 必须紧跟在 arena 头之后，且 arena 记录的整页都属于本进程 */
+        if (a->large == true && (void *)(a + 1) == ptr && a->cnt != 0 &&
+            a->cnt <= (0xc0000000 - (uint32_t)a) / PG_SIZE && uheap_ptr_ok((uint32_t)a, a->cnt * PG_SIZE))
+        {
+            mfree_page(PF_USER, a, a->cnt);
+        }
+        intr_set_status(old_status);
+        return;
+    }
+
+    /* 小块内存：描述符必须是本进程的，ptr 必须是 arena 中某个块的起始地址，且 arena 不能已经全部空闲 */
+    struct mem_block_desc *desc = uheap_desc(a->desc);
+    uint32_t offset = (uint32_t)ptr - (uint32_t)(a + 1);
+    if (desc == NULL || a->large != false || offset % desc->block_size != 0 ||
+        offset / desc->block_size >= desc->blocks_per_arena || a->cnt >= desc->blocks_per_arena)
+    {
+        intr_set_status(old_status);
+        return;
+    }
+
+    if (!uheap_append(&desc->free_list, &b->free_elem))
+    {
+        intr_set_status(old_status);
+        return;
+    }
+    if (++a->cnt == desc->blocks_per_arena)
+    {
+        /* 逐个摘下 arena 中的块，有一个摘不下（链表已损坏）就保留 arena 所在页，以免归还的页仍挂在链表上 */
+        uint32_t block_idx;
+        for (block_idx = 0; block_idx < desc->blocks_per_arena; block_idx++)
+        {
+            if (!uheap_remove(&desc->free_list, &arena2block(a, desc, block_idx)->free_elem))
+            {
+                break;
+            }
+        }
+        if (block_idx == desc->blocks_per_arena)
+        {
+            mfree_page(PF_USER, a, 1);
+        }
+    }
+    intr_set_status(old_status);
+}
+
+/**
+ * sys_free - 回收 sys_malloc 分配的内存 ptr
+ * @param ptr: 待释放的内存地址
+ *
+ * 大块内存直接用 mfree_page 归还整页；小块内存挂回对应描述符的 free_list，
+ * 当所在 arena 中的内存块全部空闲时，把这些块从 free_list 中摘下，并将整个 arena 所在页归还。
+ */
+void sys_free(void *ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    if (running_thread()->pgdir != NULL)
+    {
+        sys_free_user(ptr);
+        return;
+    }
+
+    enum pool_flags PF = PF_KERNEL; // 与 sys_malloc 的选择一致
+    enum intr_status old_status = intr_disable();
+    struct mem_block *b = ptr;
+    struct arena *a = block2arena(b); // 把 mem_block 转换成 arena，获取元信息
+    struct mem_block_desc *desc = a->desc;
+
+    ASSERT(a->large == 0 || a->large == 1);
+    if (desc == NULL && a->large == true) // 大于 1024 的内存
+    {
+        mfree_page(PF, a, a->cnt);
+    }
+    else // 小于等于 1024 的内存块
+    {
+        /* 先将内存块回收到 free_list */
+        list_append(&desc->free_list, &b->free_elem);
+
+        /* 再判断此 arena 中的内存块是否都是空闲，如果是就释放 arena */
+        if (++a->cnt == desc->blocks_per_arena)
+        {
+            uint32_t block_idx;
+            for (block_idx = 0; block_idx < desc->blocks_per_arena; block_idx++)
+            {
+                struct mem_block *b = arena2block(a, desc, block_idx);
+                ASSERT(elem_find(&desc->free_list, &b->free_elem));
+                list_remove(&b->free_elem);
+            }
+            mfree_page(PF, a, 1);
+        }
+    }
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 把从 vaddr 起始的 pg_cnt 页清 0，每清 1 页计入一次关键路径上的清 0
+ *
+ * 按 4 字节一次写入（rep stosl），比逐字节的 memset 快。
+ */
+static void page_zero_range(void *vaddr, uint32_t pg_cnt)
+{
+    uint32_t dwords = pg_cnt * PG_SIZE / 4;
+    asm volatile("cld; rep stosl" : "+D"(vaddr), "+c"(dwords) : "a"(0) : "memory");
+    page_zero_stat.inline_zeroed += pg_cnt;
+}
+
+/**
+ * @brief 取出一个预先清 0 的内核页框
+ *
+ * 取走后若剩余数量低于 ZERO_STASH_LOW，唤醒后台线程继续补充。
+ *
+ * @return uint32_t 页框的物理地址，没有时返回 0
+ */
+static uint32_t page_zero_take(void)
+{
+    uint32_t page_phyaddr = 0;
+    enum intr_status old_status = intr_disable();
+    if (zeroed_cnt > 0)
+    {
+        page_phyaddr = zeroed_frames[--zeroed_cnt];
+        page_zero_stat.prezeroed_hits++;
+    }
+    if (zero_thread_idle && zeroed_cnt < ZERO_STASH_LOW)
+    {
+        zero_thread_idle = false;
+        thread_unblock(zero_thread);
+    }
+    intr_set_status(old_status);
+    return page_phyaddr;
+}
+
+/**
+ * @brief 后台清 0 线程，一直把 zeroed_frames 补满，满了（或内存池已空）就阻塞，等待 page_zero_take 唤醒
+ */
+static void page_zero_thread(void *arg UNUSED)
+{
+    uint32_t *pte = pte_ptr(zero_window);
+    while (1)
+    {
+        enum intr_status old_status = intr_disable();
+        uint32_t page_phyaddr = 0;
+        int pg_idx = (zeroed_cnt < ZERO_STASH_SIZE) ? zone_alloc(&kernel_pool, 0, false) : -1; // 直接向内存池申请，不经过 magazine，也不向用户一侧借
+        if (pg_idx != -1)
+        {
+            page_phyaddr = pool_claim(&kernel_pool, pg_idx, 0, &kernel_pool);
+        }
+        if (page_phyaddr == 0)
+        {
+            zero_thread_idle = true;
+            thread_block(TASK_BLOCKED);
+            intr_set_status(old_status);
+            continue;
+        }
+        intr_set_status(old_status);
+
+        /* 把页框临时映射到 zero_window 上清 0，清完立即解除映射 */
+        *pte = (page_phyaddr | PG_US_S | PG_RW_W | PG_P_1);
+        asm volatile("invlpg %0" : : "m"(*(char *)zero_window) : "memory");
+        uint32_t dwords = PG_SIZE / 4;
+        void *dst = (void *)zero_window;
+        asm volatile("cld; rep stosl" : "+D"(dst), "+c"(dwords) : "a"(0) : "memory");
+        *pte = 0;
+        asm volatile("invlpg %0" : : "m"(*(char *)zero_window) : "memory");
+
+        old_status = intr_disable();
+        zeroed_frames[zeroed_cnt++] = page_phyaddr;
+        page_zero_stat.bg_zeroed++;
+        intr_set_status(old_status);
+    }
+}
+
+/**
+ * @brief 为后台清 0 线程保留临时映射窗口并启动该线程（须在 thread_init 之后调用）
+ */
+void page_zero_init(void)
+{
+    put_str("page_zero_init start\n");
+    zero_window = (uint32_t)vaddr_get(PF_KERNEL, 1); // 只占虚拟地址，平时不映射任何页框
+    ASSERT(zero_window != 0);
+    zero_thread = thread_start("page_zero", 1, page_zero_thread, NULL); // 优先级最低，时间片最短
+    put_str("page_zero_init done\n");
+}
+
+/**
+ * malloc_page_lazy - 按需分配 pg_cnt 个页：只申请虚拟地址，不分配物理页框
+ *
+ * @param pf: 指定内存池，只支持内核内存池（可带 PF_DMA）
+ * @param pg_cnt: 要分配的页数量
+ *
+ * @return: 成功则返回起始虚拟地址，失败（虚拟地址不足或区域表已满）返回 NULL
+ *
+ * 区域中的页在第一次被访问时触发缺页异常，由 page_fault_handler 分配清 0 的页框并建立映射，
+ * 因此大而稀疏的缓冲区只为实际用到的页消耗物理内存。用 mfree_page 整体释放。
+ * 区域表是全局的、只按虚拟地址查找，只有所有地址空间共享的内核虚拟地址才能这样登记；
+ * 用户虚拟地址在各进程中各不相同，登记进来会让其他进程在同一地址上的缺页被误当作按需分配，所以不支持 PF_USER。
+ */
+void *malloc_page_lazy(enum pool_flags pf, uint32_t pg_cnt)
+{
+    ASSERT(pg_cnt > 0 && (pf & PF_KERNEL));
+    if (!(pf & PF_KERNEL))
+    {
+        return NULL;
+    }
+    uint64_t start = rdtsc();
+    enum intr_status old_status = intr_disable();
+    uint32_t idx;
+    for (idx = 0; idx < LAZY_REGION_CNT; idx++)
+    {
+        if (lazy_regions[idx].pg_cnt == 0)
+        {
+            break;
+        }
+    }
+    void *vaddr_start = (idx < LAZY_REGION_CNT) ? vaddr_get(pf, pg_cnt) : NULL;
+    if (vaddr_start != NULL)
+    {
+        lazy_regions[idx].vaddr_start = (uint32_t)vaddr_start;
+        lazy_regions[idx].pg_cnt = pg_cnt;
+        lazy_regions[idx].pf = pf;
+    }
+    intr_set_status(old_status);
+    memstat_alloc(pf, pg_cnt, (uint32_t)(rdtsc() - start), __builtin_return_address(0), vaddr_start != NULL);
+    return vaddr_start;
+}
+
+/**
+ * @brief 查找虚拟地址 vaddr 所在的按需分配区域
+ *
+ * @return struct lazy_region* 找到的区域，vaddr 不属于任何区域时返回 NULL
+ */
+static struct lazy_region *lazy_region_find(uint32_t vaddr)
+{
+    uint32_t idx;
+    for (idx = 0; idx < LAZY_REGION_CNT; idx++)
+    {
+        struct lazy_region *region = &lazy_regions[idx];
+        if (region->pg_cnt != 0 && vaddr >= region->vaddr_start &&
+            vaddr - region->vaddr_start < region->pg_cnt * PG_SIZE)
+        {
+            return region;
+        }
+    }
+    return NULL;
+}
+
+/**************************  写时复制（copy-on-write）  **************************
+ * fork 时父子进程共享用户页框：双方的页表项都去掉 R/W 位并置上 PG_COW，页框的引用计数记为映射数。
+ * 任何一方写这样的页都会引发缺页异常，由 cow_fault 复制出一个私有页框（已无人共享时直接恢复可写）。
+ * 引用计数按页框存放在所属内存池的 page_ref 中：0 表示未共享，k >= 2 表示有 k 个映射共享。
+ * 计数只在关中断时修改，缺页处理与 fork、unmap_range 之间不会交错。
+ ********************************************************************************/
+
+/**
+ * @brief 返回物理页框 pg_phy_addr 的引用计数所在的位置
+ */
+uint16_t *page_ref_of(uint32_t pg_phy_addr)
+{
+    struct pool *mem_pool = (pg_phy_addr >= user_pool.phy_addr_start) ? &user_pool : &kernel_pool;
+    ASSERT(pg_phy_addr >= mem_pool->phy_addr_start && pg_phy_addr < mem_pool->phy_addr_start + mem_pool->pool_size);
+    return &mem_pool->page_ref[(pg_phy_addr - mem_pool->phy_addr_start) / PG_SIZE];
+}
+
+/**
+ * @brief 页框 pg_phy_addr 多了一个共享它的映射（调用者需关中断）
+ */
+static void page_ref_share(uint32_t pg_phy_addr)
+{
+    uint16_t *ref = page_ref_of(pg_phy_addr);
+    ASSERT(*ref < 0xffff);
+    *ref = (*ref == 0) ? 2 : *ref + 1;
+}
+
+/**
+ * @brief 页框 pg_phy_addr 少了一个映射（调用者需关中断）
+ *
+ * @return bool 已没有其他映射、页框应当释放时返回 true
+ */
+static bool page_ref_put(uint32_t pg_phy_addr)
+{
+    uint16_t *ref = page_ref_of(pg_phy_addr);
+    if (*ref >= 2)
+    {
+        (*ref)--;
+        return false;
+    }
+    *ref = 0; // 为 1 时剩下的唯一映射尚未因写入而恢复可写，同样归它释放
+    return true;
+}
+
+/**
+ * @brief 把物理页框 pg_phy_addr 临时映射到 copy_window 上，返回其虚拟地址
+ *
+ * 与 zero_window 一样直接写页表项，不是全局页。调用者需关中断，并在用完后调用 copy_window_unmap。
+ */
+static void *copy_window_map(uint32_t pg_phy_addr)
+{
+    ASSERT(intr_get_status() == INTR_OFF);
+    uint32_t *pte = pte_ptr(copy_window);
+    ASSERT(!(*pte & PG_P_1));
+    *pte = (pg_phy_addr | PG_US_S | PG_RW_W | PG_P_1);
+    asm volatile("invlpg %0" : : "m"(*(char *)copy_window) : "memory");
+    return (void *)copy_window;
+}
+
+/**
+ * @brief 解除 copy_window 的临时映射
+ */
+static void copy_window_unmap(void)
+{
+    *pte_ptr(copy_window) = 0;
+    asm volatile("invlpg %0" : : "m"(*(char *)copy_window) : "memory");
+}
+
+/**
+ * @brief 把虚拟地址 src 处的一页复制到物理页框 dst_phy_addr（目标页框不必映射在当前地址空间中）
+ */
+static void page_copy_to_frame(uint32_t dst_phy_addr, const void *src)
+{
+    enum intr_status old_status = intr_disable();
+    *(volatile const char *)src; // src 已被换出时先在这里缺页读回：换入要开中断等盘，不能在占着 copy_window 时发生
+    void *dst = copy_window_map(dst_phy_addr);
+    uint32_t dwords = PG_SIZE / 4;
+    asm volatile("cld; rep movsl" : "+D"(dst), "+S"(src), "+c"(dwords) : : "memory");
+    copy_window_unmap();
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 处理对写时复制页 page_vaddr 的写入
+ *
+ * 页框仍被其他地址空间共享时，复制出一个新页框换进页表项；否则当前地址空间已独占该页，直接恢复可写。
+ * 在缺页异常中调用，此时已关中断。
+ *
+ * @return bool 用户物理内存池已无空闲页时返回 false
+ */
+static bool cow_fault(uint32_t page_vaddr)
+{
+    uint32_t *pte = pte_ptr(page_vaddr);
+    uint32_t pg_phy_addr = *pte & 0xfffff000;
+    uint32_t flags = ((*pte & 0xfff) & ~PG_COW) | PG_RW_W;
+    uint16_t *ref = page_ref_of(pg_phy_addr);
+    uint32_t new_phy_addr = 0;
+    if (*ref > 1)
+    {
+        new_phy_addr = (uint32_t)palloc_order(&user_pool, 0, false); // 中断上下文中不经过 magazine
+        if (new_phy_addr == 0)
+        {
+            return false;
+        }
+    }
+    if (*ref > 1) // 申请页框时可能开中断等盘换页，其间其他共享方可能已退出，重新判断
+    {
+        page_copy_to_frame(new_phy_addr, (void *)page_vaddr);
+        (*ref)--;
+        pg_phy_addr = new_phy_addr;
+    }
+    else
+    {
+        if (new_phy_addr != 0)
+        {
+            pool_free_block((new_phy_addr >= user_pool.phy_addr_start) ? &user_pool : &kernel_pool, new_phy_addr, 0);
+        }
+        *ref = 0;
+    }
+    *pte = pg_phy_addr | flags;
+    asm volatile("invlpg %0" : : "m"(*(char *)page_vaddr) : "memory");
+    return true;
+}
+
+/**
+ * pgdir_copy_user - 为子进程复制当前地址空间中用户部分（第 0~767 个页目录项）的页表
+ * @param child_pgdir: 子进程的页目录表（内核部分已由 create_page_dir 填好）
+ * @param cow: 为 true 时与子进程写时复制共享所有页框，为 false 时立即为子进程复制每一页
+ *
+ * @return: 内存不足时返回 false，已复制的部分留在 child_pgdir 中，由调用者用 pgdir_release_user 回收
+ *
+ * 子进程的页表先在一页内核内存中拼好，再整页复制到从内核物理内存池申请的页框中，因此不必为每张页表占用内核虚拟地址。
+ * 写时复制时父进程中可写的页表项同样改为只读，返回前重新加载 CR3 使其生效。
+ */
+bool pgdir_copy_user(uint32_t *child_pgdir, bool cow)
+{
+    uint32_t *table = get_kernel_pages(1);
+    if (table == NULL)
+    {
+        return false;
+    }
+
+    bool ok = true;
+    uint32_t pde_idx;
+    for (pde_idx = 0; pde_idx < KERNEL_PDE_START && ok; pde_idx++)
+    {
+        uint32_t pde = *(uint32_t *)(0xfffff000 + pde_idx * 4);
+        if (!(pde & PG_P_1))
+        {
+            continue;
+        }
+        ASSERT(!(pde & PG_PS)); // 用户空间不使用 4MB 大页
+        uint32_t table_phy = (uint32_t)palloc(&kernel_pool);
+        if (table_phy == 0)
+        {
+            ok = false;
+            break;
+        }
+
+        uint32_t *parent_pte = (uint32_t *)(0xffc00000 + pde_idx * PG_SIZE); // 借助第 1023 个页目录项访问父进程的页表
+        uint32_t pte_idx;
+        for (pte_idx = 0; pte_idx < PG_TABLE_ENTRIES; pte_idx++)
+        {
+            uint32_t page_vaddr = (pde_idx << 22) | (pte_idx << 12);
+            table[pte_idx] = 0;
+            /* 其他进程申请页框时随时可能换出父进程的页，从读页表项到改为共享要在关中断时一气呵成 */
+            enum intr_status old_status = intr_disable();
+            if ((parent_pte[pte_idx] & (PG_P_1 | PG_SWAP)) == PG_SWAP && !swap_fault(page_vaddr)) // 已换出的页先换回来，交换槽不在父子进程间共享
+            {
+                intr_set_status(old_status);
+                ok = false;
+                memset(&table[pte_idx], 0, (PG_TABLE_ENTRIES - pte_idx) * 4);
+                break;
+            }
+            uint32_t pte = parent_pte[pte_idx];
+            if ((pte & PG_P_1) && cow)
+            {
+                if (pte & PG_RW_W)
+                {
+                    pte = (pte & ~PG_RW_W) | PG_COW;
+                    parent_pte[pte_idx] = pte;
+                }
+                page_ref_share(pte & 0xfffff000); // 只读页同样共享，不需要置 PG_COW
+                table[pte_idx] = pte;
+            }
+            intr_set_status(old_status);
+            if (!(pte & PG_P_1) || cow)
+            {
+                continue;
+            }
+
+            uint32_t new_phy_addr = (uint32_t)palloc(&user_pool);
+            if (new_phy_addr == 0)
+            {
+                ok = false;
+                memset(&table[pte_idx], 0, (PG_TABLE_ENTRIES - pte_idx) * 4);
+                break;
+            }
+            page_copy_to_frame(new_phy_addr, (void *)page_vaddr);
+            uint32_t flags = pte & 0xfff;
+            if (flags & PG_COW) // 父进程自己还在与别人共享，复制出的页则归子进程私有
+            {
+                flags = (flags & ~PG_COW) | PG_RW_W;
+            }
+            table[pte_idx] = new_phy_addr | flags;
+        }
+        page_copy_to_frame(table_phy, table);
+        child_pgdir[pde_idx] = table_phy | PG_US_U | PG_RW_W | PG_P_1; // 页表填好后才挂上，swap_evict 随时可能扫描子进程
+    }
+    mfree_page(PF_KERNEL, table, 1);
+
+    if (cow)
+    {
+        uint32_t cr3;
+        asm volatile("movl %%cr3, %0; movl %0, %%cr3" : "=r"(cr3) : : "memory");
+    }
+    return ok;
+}
+
+/**
+ * pgdir_release_user - 解除页目录表 pgdir 中用户部分的全部映射，释放页框（共享的页框只减少引用计数）、交换槽和页表
+ * @param pgdir: 待回收的页目录表，不能是当前正在使用的地址空间
+ *
+ * 全程持有 swap_lock：swap_evict 可能正开着中断往交换区写该地址空间中的页，要等它写完再释放页表。
+ */
+void pgdir_release_user(uint32_t *pgdir)
+{
+    uint32_t cr3;
+    asm volatile("movl %%cr3, %0" : "=r"(cr3));
+    ASSERT(addr_v2p((uint32_t)pgdir) != cr3);
+
+    lock_acquire(&swap_lock);
+    uint32_t pde_idx;
+    for (pde_idx = 0; pde_idx < KERNEL_PDE_START; pde_idx++)
+    {
+        if (!(pgdir[pde_idx] & PG_P_1))
+        {
+            continue;
+        }
+        uint32_t table_phy = pgdir[pde_idx] & 0xfffff000;
+        enum intr_status old_status = intr_disable();
+        uint32_t *pte = copy_window_map(table_phy);
+        uint32_t pte_idx;
+        for (pte_idx = 0; pte_idx < PG_TABLE_ENTRIES; pte_idx++)
+        {
+            if ((pte[pte_idx] & PG_P_1) && page_ref_put(pte[pte_idx] & 0xfffff000))
+            {
+                pfree(pte[pte_idx] & 0xfffff000);
+            }
+            else if (!(pte[pte_idx] & PG_P_1) && (pte[pte_idx] & PG_SWAP))
+            {
+                swap_slot_free(pte[pte_idx]);
+            }
+        }
+        copy_window_unmap();
+        intr_set_status(old_status);
+        pfree(table_phy);
+        pgdir[pde_idx] = 0;
+    }
+    lock_release(&swap_lock);
+}
+
+/**
+ * @brief 为已换出的页 page_vaddr 申请用户页框并从交换区读回（调用者需关中断，期间可能阻塞在 swap_lock 上或开中断等盘）
+ *
+ * @return bool 没有页框可用或读盘出错时返回 false
+ */
+static bool swap_fault(uint32_t page_vaddr)
+{
+    uint32_t page_phyaddr = (uint32_t)palloc_order(&user_pool, 0, false); // 可能先换出别的页，不会是这一页
+    if (page_phyaddr == 0)
+    {
+        return false;
+    }
+    bool ok = swap_in(page_vaddr, page_phyaddr);
+    if (!ok || (*pte_ptr(page_vaddr) & 0xfffff000) != page_phyaddr) // 出错，或等锁期间换出被撤销、页已在内存中
+    {
+        pool_free_block((page_phyaddr >= user_pool.phy_addr_start) ? &user_pool : &kernel_pool, page_phyaddr, 0);
+    }
+    return ok;
+}
+
+/**
+ * @brief 只在内核空间中保留 pg_cnt 页的虚拟地址，不映射任何页框，供临时映射窗口使用
+ */
+void *kvaddr_reserve(uint32_t pg_cnt)
+{
+    return vaddr_get(PF_KERNEL, pg_cnt);
+}
+
+/**
+ * @brief 归还 kvaddr_reserve 保留的 pg_cnt 页虚拟地址（其中的映射须已由调用者去掉）
+ */
+void kvaddr_release(void *vaddr, uint32_t pg_cnt)
+{
+    enum intr_status old_status = intr_disable();
+    vaddr_remove(PF_KERNEL, vaddr, pg_cnt);
+    intr_set_status(old_status);
+}
+
+/* 缺页异常的错误码 */
+#define PFEC_P 0x1 // 1：页存在，因权限不符引发；0：页不存在
+#define PFEC_W 0x2 // 1：写访问；0：读访问
+#define PFEC_U 0x4 // 1：发生在 3 特权级；0：发生在 0 特权级
+
+/**
+ * @brief 缺页异常（0x0e）处理程序
+ *
+ * 从 CR2 取出引发缺页的虚拟地址，从中断栈中取出错误码：
+ * 对存在且带 PG_COW 的页的写入是写时复制，交给 cow_fault；
+ * 对不存在但带 PG_SWAP 的页的访问是访问已换出的页，交给 swap_fault 读回；
+ * 0 特权级对内核空间中按需分配区域里尚未映射的页的访问，分配一个清 0 的页框并建立映射，
+ * 返回后处理器会重新执行引发缺页的指令；
+ * 其他情况（地址不属于任何区域，用户进程访问内核空间，或页已存在、属于权限错误）都是真正的错误，交给 exception_handle：
+ * 发生在用户态时结束引发缺页的进程，发生在内核态时打印并悬停。
+ * 缺页异常是同步发生在当前线程中的，且进入中断门时已关中断。
+ */
+static void page_fault_handler(uint8_t vec_nr)
+{
+    uint32_t fault_vaddr;
+    asm volatile("movl %%cr2, %0" : "=r"(fault_vaddr));
+    uint32_t err_code = INTR_FRAME()->err_code;
+
+    uint32_t page_vaddr = fault_vaddr & 0xfffff000;
+    if ((err_code & (PFEC_P | PFEC_W)) == (PFEC_P | PFEC_W) &&
+        (*pde_ptr(page_vaddr) & (PG_P_1 | PG_PS)) == PG_P_1 &&
+        (*pte_ptr(page_vaddr) & (PG_P_1 | PG_COW)) == (PG_P_1 | PG_COW))
+    {
+        if (!cow_fault(page_vaddr))
+        {
+            PANIC("page_fault_handler: out of memory for copy-on-write");
+        }
+        return;
+    }
+    if (!(err_code & PFEC_P) &&
+        (*pde_ptr(page_vaddr) & (PG_P_1 | PG_PS)) == PG_P_1 &&
+        (*pte_ptr(page_vaddr) & (PG_P_1 | PG_SWAP)) == PG_SWAP)
+    {
+        if (!swap_fault(page_vaddr))
+        {
+            PANIC("page_fault_handler: cannot swap in page");
+        }
+        return;
+    }
+
+    // 区域只在内核空间中，只有内核自己的访问才按需分配
+    struct lazy_region *region = (!(err_code & (PFEC_P | PFEC_U)) && fault_vaddr >= 0xc0000000) ? lazy_region_find(fault_vaddr) : NULL;
+    if (region == NULL || ((*pde_ptr(page_vaddr) & PG_P_1) && (*pte_ptr(page_vaddr) & PG_P_1)))
+    {
+        exception_handle(vec_nr, (err_code & PFEC_U) != 0); // 真正的缺页错误
+        return;
+    }
+
+    struct pool *mem_pool = &kernel_pool;
+    bool dma = (region->pf & PF_DMA) != 0;
+    uint32_t page_phyaddr = !dma ? page_zero_take() : 0;
+    bool prezeroed = (page_phyaddr != 0);
+    if (!prezeroed)
+    {
+        page_phyaddr = (uint32_t)palloc_order(mem_pool, 0, dma); // 中断上下文中不经过 magazine
+    }
+    if (page_phyaddr == 0 || !page_table_add((void *)page_vaddr, (void *)page_phyaddr, pf_pte_flags(region->pf)))
+    {
+        PANIC("page_fault_handler: out of memory");
+    }
+    if (!prezeroed)
     {
-        memset(vaddr, 0, pg_cnt * PG_SIZE);
+        page_zero_range((void *)page_vaddr, 1);
     }
-    return vaddr; // 返回虚拟地址
 }
 
 /**
@@ -382,7 +3111,19 @@ void mem_init(void)
 {
     put_str("mem_init start\n");
     // 在 loader.S 中，为了获取内存容量，我们用了三种 BIOS 方法，最终把获取到的内存容量保存在汇编变量 total_mem_bytes 中，其物理地址为 0xb00
-    uint32_t mem_bytes_total = *(uint32_t *)(0xb00);
+    uint32_t mem_bytes_total = *(uint32_t *)(0xc0000b00);
     mem_pool_init(mem_bytes_total);
+    pse_init();
+    kernel_image_protect();
+    identity_map_remove();
+    pge_init();
+    kernel_pgdir_map();
+    copy_window = (uint32_t)vaddr_get(PF_KERNEL, 1); // 只占虚拟地址，平时不映射任何页框
+    ASSERT(copy_window != 0);
+    /* 开启 CR0.WP，内核代用户进程写入写时复制页（如系统调用填写用户缓冲区）时同样触发复制 */
+    uint32_t cr0;
+    asm volatile("movl %%cr0, %0; orl %1, %0; movl %0, %%cr0" : "=&r"(cr0) : "i"(CR0_WP) : "memory");
+    register_handler(0x0e, page_fault_handler); // 注册缺页异常处理程序，支持按需分配
+    block_desc_init(k_block_descs); // 初始化内核内存块描述符数组 descs，为 malloc 做准备
     put_str("mem_init done\n");
 }
@@ -3,6 +3,13 @@
 
 #include "stdint.h"
 #include "bitmap.h"
+#include "list.h"
+#include "avl.h"
+
+/* 为 1 时内核虚拟地址仍用位图管理（逐位扫描，O(页数)），为 0 时用按空闲段组织的 AVL 树（O(log 空闲段数)），可在 makefile 中用 -D 覆盖 */
+#ifndef CONFIG_VADDR_BITMAP
+#define CONFIG_VADDR_BITMAP 0
+#endif
 
 // 虚拟内存池结构，用于虚拟地址管理
 struct virtual_addr
@@ -12,11 +19,68 @@ struct virtual_addr
     // 尽管虚拟地址空间最大是 4GB，但相对来说是无限的，不需要指定地址空间大小
 };
 
+#define MAX_ORDER 10 // 伙伴系统的最大阶，一次最多分配 2^10 个物理连续的页（4MB）
+
 /* 内存池标记，用于判断是哪个地址池 */
 enum pool_flags
 {
     PF_KERNEL = 1, // 内核物理内存池
-    PF_USER = 2    // 用户物理内存池
+    PF_USER = 2,   // 用户物理内存池
+    PF_DMA = 4     // 分配标志，与 PF_KERNEL 或 PF_USER 组合使用：物理页框必须位于 ISA DMA 可访问的 16MB 以下
+};
+
+/* 物理内存区域（zone），按物理地址划分，每个物理内存池各自按区域统计 */
+enum zone_type
+{
+    ZONE_DMA,    // 0 ~ 16MB，ISA DMA 只能访问这一段
+    ZONE_NORMAL, // 16MB ~ 896MB
+    ZONE_HIGH,   // 896MB 以上
+    ZONE_CNT
+};
+
+#define ZONE_DMA_END 0x01000000    // ZONE_DMA 的上界 16MB
+#define ZONE_NORMAL_END 0x38000000 // ZONE_NORMAL 的上界 896MB
+#define ZONE_DMA_RESERVE 512       // ZONE_DMA 水位线的上限（页），低于水位线时不再满足非 DMA 的申请
+
+/**************************  伙伴系统的某一阶  ****************************
+ * 第 k 阶的块由 2^k 个物理页组成，块的编号以 buddy_base 为基准，因此第 i 块的物理地址为 buddy_base + (i << k) * PG_SIZE。
+ * 空闲块用位图记录，为了与 bitmap_scan "查找 0 位" 的习惯一致，位为 0 表示该块空闲，位为 1 表示该块已分配、已被拆分或不在内存池内。
+ * 空闲页框本身并没有映射到内核的虚拟地址空间，无法在其中存放链表指针，所以用位图代替链表作为空闲块的集合，
+ * 借助位图的摘要索引，在某一阶上取出一个空闲块同样是常数级的操作。
+ ***********************************************************************/
+struct free_area
+{
+    struct bitmap free_map; // 本阶的空闲块位图
+    uint32_t nr_free;       // 本阶空闲块的数量
+};
+
+/****************************  物理内存区域  ********************************
+ * 区域的边界（16MB、896MB）都是 4MB 的整数倍，buddy_base 也按 4MB 对齐，因此伙伴系统中任何一块都不会跨越区域边界，
+ * 在某个区域内分配就是在各阶的空闲块位图中只扫描该区域对应的下标范围。
+ ***************************************************************************/
+struct zone
+{
+    uint32_t start_pg;     // 区域在本内存池中的起始页号（相对 buddy_base）
+    uint32_t end_pg;       // 区域的结束页号（不含），与 start_pg 相等表示本内存池没有这个区域
+    uint32_t present_pages; // 区域中可用的页数（不含内存空洞）
+    uint32_t free_pages;   // 区域中空闲的页数
+    uint32_t watermark;    // 非本区域优先的申请退而使用本区域时，须保留的空闲页数
+};
+
+// 物理内存池结构，用于物理地址管理，生成两个实例用于管理 内核内存池 和 用户内存池 中的所有物理内存
+struct pool
+{
+    struct bitmap pool_bitmap; // 本内存池用到的位图结构（以页为单位，管理物理内存地址的分配情况）
+    uint32_t phy_addr_start;   // 本内存池所管理物理内存的起始地址
+    uint32_t pool_size;        // 本内存池字节容量（因为物理地址是有限的）
+
+    /* 伙伴系统：物理页实际从这里分配和释放，pool_bitmap 只记录每一页是否已分配 */
+    uint32_t buddy_base;                       // 块编号的基准物理地址（phy_addr_start 按 2^MAX_ORDER 页向下对齐），保证第 k 阶的块天然按 2^k 页对齐
+    struct free_area free_area[MAX_ORDER + 1]; // 第 0~MAX_ORDER 阶的空闲块
+    struct zone zones[ZONE_CNT];               // 本内存池在各物理内存区域中的部分
+
+    struct bitmap lent_bitmap; // 第 i 位为 1 表示第 i 页已借给另一侧使用（与 pool_bitmap 一一对应）
+    uint16_t *page_ref;        // 第 i 项为第 i 页被写时复制共享的映射数，0 表示未共享（只有一个映射）
 };
 
 // 以下各属性的值是以它们的位次来定义的，并不是 0 或 1，这样方便后面的页表项或页目录项的属性合成
@@ -26,18 +90,245 @@ enum pool_flags
 #define PG_RW_W 2   // R/W 属性位值，读/写/执行
 #define PG_US_S 0   // U/S 属性位值，系统级（表示只允许特权级别为 0、1、2 的程序访问此页内存，3 特权级程序不被允许）
 #define PG_US_U 4   // U/S 属性位值，用户（表示允许所有特权级别程序访问此页内存）
+#define PG_PCD 0x10 // PCD 位，置 1 表示此页禁止缓存（用于设备内存等）
+#define PG_A 0x20   // 页表项的 A 位（accessed），处理器访问该页时自动置 1，换页的时钟算法据此判断冷热
+#define PG_PS 0x80  // 页目录项的 PS 位，置 1 表示该页目录项直接映射一个 4MB 大页（需开启 CR4.PSE）
+#define PG_G 0x100  // 页表项的 G 位，置 1 表示全局页，重新加载 CR3 时其 TLB 条目不被清除（需开启 CR4.PGE）
+#define PG_COW 0x200 // 页表项中留给软件使用的第 9 位，置 1 表示此页与其他地址空间写时复制共享（同时 R/W 位为 0）
+#define PG_SWAP 0x400 // 页表项中留给软件使用的第 10 位，P 为 0 时置 1 表示此页已换出，31~12 位为交换槽号
+
+#define PG_TABLE_ENTRIES 1024 // 一张页表中的页表项数
+#define MAP_BATCH 32          // malloc_page 每批申请并用 map_range 映射的页框数（不超过 32，便于用一个 32 位掩码记录）
+#define TLB_FLUSH_BATCH 32    // unmap_range 去掉的映射不超过此页数时逐页 invlpg，超过时重新加载 CR3
+
+#define CR4_PSE 0x10 // CR4 的第 4 位，开启后页目录项才能映射 4MB 大页
+#define CR4_PGE 0x80 // CR4 的第 7 位，开启后页表项的 G 位才生效
+#define CR0_WP 0x10000 // CR0 的第 16 位，开启后特权级 0 写只读页同样引发缺页异常（写时复制依赖它）
+
+#define KERNEL_PGDIR_PHY 0x100000 // loader 建立的内核页目录表的物理地址，内核线程都使用它
+
+#define KERNEL_ELF_HDR 0xc0001000 // 内核映像的 ELF 头：loader 按程序头复制的第一个段从文件开头（ELF 头）开始，位于入口 0xc0001500 所在页
+#define PT_LOAD 1                 // 程序头类型：需要加载的段
+#define PF_W 2                    // 程序头标志：段可写
+
+/* 32 位 ELF 文件头 */
+struct elf32_ehdr
+{
+    uint8_t e_ident[16];
+    uint16_t e_type;
+    uint16_t e_machine;
+    uint32_t e_version;
+    uint32_t e_entry;
+    uint32_t e_phoff; // 程序头表在文件中的偏移
+    uint32_t e_shoff;
+    uint32_t e_flags;
+    uint16_t e_ehsize;
+    uint16_t e_phentsize; // 每个程序头的大小
+    uint16_t e_phnum;     // 程序头的个数
+    uint16_t e_shentsize;
+    uint16_t e_shnum;
+    uint16_t e_shstrndx;
+};
+
+/* 32 位 ELF 程序头 */
+struct elf32_phdr
+{
+    uint32_t p_type;
+    uint32_t p_offset;
+    uint32_t p_vaddr;
+    uint32_t p_paddr;
+    uint32_t p_filesz;
+    uint32_t p_memsz;
+    uint32_t p_flags;
+    uint32_t p_align;
+};
+
+
+
+/******************  每线程的物理页框缓存（magazine）  ******************
+ * 线程先从自己的 magazine 中取物理页框，取空时再一次性从内存池批量补充 PG_MAG_BATCH 个；
+ * 释放的页框也先放回 magazine，放满时再成批归还给内存池。
+ * magazine 中的页框在 pool_bitmap 和伙伴系统中仍记为已分配，归线程私有。
+ * 内核物理内存池和用户物理内存池各用一个 magazine。
+ * magazine 只缓存 ZONE_NORMAL、ZONE_HIGH 中的页框；有 PF_DMA 限制的申请不经过 magazine，直接从 ZONE_DMA 分配。
+ ***********************************************************************/
+#define PG_MAG_SIZE 16 // magazine 的容量（页框数）
+#define PG_MAG_BATCH 8 // 每次批量补充或归还的页框数
+
+struct page_magazine
+{
+    uint32_t frames[PG_MAG_SIZE]; // 缓存的物理页框地址
+    uint32_t cnt;                 // 当前缓存的页框数
+    uint32_t alloc_hits;          // 分配时直接从 magazine 取到页框的次数
+    uint32_t alloc_misses;        // 分配时 magazine 为空、需要从内存池补充的次数
+    uint32_t free_hits;           // 释放时直接放入 magazine 的次数
+    uint32_t free_overflows;      // 释放时 magazine 已满、需要成批归还内存池的次数
+};
+
+/******************  内核与用户两侧共享的物理页框仓库  ******************
+ * 物理页框仍按地址分属 kernel_pool 和 user_pool，两者的页数即两侧的软配额；
+ * 某一侧自己的内存池用尽时，可以从另一侧的内存池借页框，只要出借方借出后仍留有其配额的 1/2^RESERVOIR_RESERVE_SHIFT。
+ * 借出的页框在出借方内存池的 lent_bitmap 中标记，释放时据此记回借用方的账上。
+ ***********************************************************************/
+#define RESERVOIR_RESERVE_SHIFT 3 // 出借方至少保留配额的 1/8 不出借
+
+enum reservoir_side
+{
+    RS_KERNEL, // 内核一侧
+    RS_USER,   // 用户一侧
+    RS_CNT
+};
+
+struct reservoir_stat
+{
+    uint32_t quota;         // 软配额，即本侧内存池的可用页数
+    uint32_t used;          // 本侧当前占用的页数（含借来的页框，以及 magazine、预先清 0 缓存中的页框）
+    uint32_t peak;          // used 的历史峰值
+    uint32_t borrowed;      // 本侧当前从另一侧借来的页数
+    uint32_t borrow_events; // 本侧向另一侧借页框的次数
+    uint32_t lend_refusals; // 本侧需要借页框、但另一侧已到保留线而拒绝的次数
+};
+
+/* 按需分配（demand-zero）的虚拟地址区域：只占虚拟地址，页框在首次访问触发缺页异常时才分配 */
+struct lazy_region
+{
+    uint32_t vaddr_start; // 区域的起始虚拟地址
+    uint32_t pg_cnt;      // 区域的页数（为 0 表示此表项空闲）
+    enum pool_flags pf;   // 分配标志（PF_KERNEL，可带 PF_DMA），缺页时按它分配页框
+};
+
+#define LAZY_REGION_CNT 16 // 最多同时存在的按需分配区域数
+
+/* 预先清 0 页框的统计 */
+struct page_zero_stat
+{
+    uint32_t bg_zeroed;      // 后台线程清 0 的页数
+    uint32_t prezeroed_hits; // 分配时直接用上预先清 0 页框的次数（即从关键路径上移走的清 0 次数）
+    uint32_t inline_zeroed;  // 仍在关键路径上就地清 0 的页数
+};
+
+/* 内存块（arena 中按规格划分出的小块，空闲时通过 free_elem 挂在对应描述符的 free_list 上） */
+struct mem_block
+{
+    struct list_elem free_elem;
+};
+
+/* 内存块描述符，每种规格（16B ~ 1024B）各一个 */
+struct mem_block_desc
+{
+    uint32_t block_size;       // 内存块大小
+    uint32_t blocks_per_arena; // 一个 arena 中可容纳此规格内存块的数量
+    struct list free_list;     // 目前可用的 mem_block 链表
+};
+
+/* 内核虚拟地址的一个空闲段（extent），同时挂在按地址排序和按大小排序的两棵树上 */
+struct vaddr_extent
+{
+    struct avl_node addr_node; // 在 vaddr_addr_tree 中的结点，空闲时借用 addr_node.left 串成空闲结点链
+    struct avl_node size_node; // 在 vaddr_size_tree 中的结点
+    uint32_t start;            // 起始页号（相对 kernel_vaddr.vaddr_start）
+    uint32_t pg_cnt;           // 页数
+};
 
+#define VADDR_EXTENT_MAX 8192 // 空闲段结点的上限，结点表在初始化时从元数据区域一次性分配
 
+#define DESC_CNT 7 // 内存块描述符的个数（16、32、64、128、256、512、1024 字节共 7 种规格）
 
 extern struct pool kernel_pool, user_pool;
+extern struct virtual_addr kernel_vaddr;
+extern struct page_zero_stat page_zero_stat;
+extern struct reservoir_stat reservoir_stat[RS_CNT];
+extern bool pge_enabled;
+extern uint32_t *kernel_pgdir;
+static void e820_parse(uint32_t total_mem_bytes, uint32_t low_limit);
+static void pool_mark_usable(struct pool *m_pool);
 static void mem_pool_init(uint32_t all_mem);
 static void *vaddr_get(enum pool_flags pf, uint32_t pg_cnt);
+static int extent_addr_less(struct avl_node *a, struct avl_node *b);
+static int extent_size_less(struct avl_node *a, struct avl_node *b);
+static struct vaddr_extent *extent_new(uint32_t start, uint32_t pg_cnt);
+static void extent_delete(struct vaddr_extent *ext);
+static void extent_resize(struct vaddr_extent *ext, uint32_t start, uint32_t pg_cnt);
+static uint32_t kvaddr_nodes(uint32_t pg_cnt);
+static void kvaddr_init(uint32_t pg_cnt);
+static int kvaddr_alloc(uint32_t pg_cnt, uint32_t align, uint32_t offset);
+static void kvaddr_free(uint32_t pg_idx, uint32_t pg_cnt);
 uint32_t *pte_ptr(uint32_t vaddr);
 uint32_t *pde_ptr(uint32_t vaddr);
+static int zone_alloc(struct pool *m_pool, uint32_t order, bool dma);
+static void zone_print(const char *name, struct pool *m_pool);
+static enum reservoir_side pool_side(struct pool *m_pool);
+static uint32_t pool_free_pages(struct pool *m_pool);
+static int reservoir_borrow(struct pool *m_pool, uint32_t order, bool dma);
+static uint32_t pool_claim(struct pool *src, uint32_t pg_idx, uint32_t order, struct pool *m_pool);
+static void *palloc_order(struct pool *m_pool, uint32_t order, bool dma);
 static void *palloc(struct pool *m_pool);
-static void page_table_add(void *_vaddr, void *_page_phyaddr);
+static void pool_free_block(struct pool *m_pool, uint32_t pg_phy_addr, uint32_t order);
+static struct page_magazine *page_mag_of(struct pool *m_pool);
+static bool page_magazine_refill(struct pool *m_pool, struct page_magazine *mag);
+static void page_magazine_drain(struct pool *m_pool, struct page_magazine *mag, uint32_t cnt);
+void page_mag_release(struct page_magazine *mags);
+void pfree(uint32_t pg_phy_addr);
+static bool page_table_new(uint32_t *pde, uint32_t vaddr);
+static bool map_range_do(uint32_t vaddr, const uint32_t *paddrs, uint32_t paddr, uint32_t pg_cnt, uint32_t flags);
+bool map_range(uint32_t vaddr, const uint32_t *paddrs, uint32_t pg_cnt, uint32_t flags);
+bool map_range_contig(uint32_t vaddr, uint32_t paddr, uint32_t pg_cnt, uint32_t flags);
+void unmap_range(uint32_t vaddr, uint32_t pg_cnt, bool free_frames);
+static bool page_table_add(void *_vaddr, void *_page_phyaddr, uint32_t flags);
+static uint32_t pf_pte_flags(enum pool_flags pf);
 void *malloc_page(enum pool_flags pf, uint32_t pg_cnt);
+static void *malloc_page_zero(enum pool_flags pf, uint32_t pg_cnt, bool zero, void *caller);
+static void *malloc_page_map(enum pool_flags pf, uint32_t pg_cnt, bool zero);
 void *get_kernel_pages(uint32_t pg_cnt);
+void *malloc_page_contig(enum pool_flags pf, uint32_t order);
+static void *malloc_page_contig_tag(enum pool_flags pf, uint32_t order, void *caller);
+static void *malloc_page_contig_map(enum pool_flags pf, uint32_t order);
+void *get_kernel_contig_pages(uint32_t order);
+uint32_t addr_v2p(uint32_t vaddr);
+static void vaddr_remove(enum pool_flags pf, void *_vaddr, uint32_t pg_cnt);
+void mfree_page(enum pool_flags pf, void *_vaddr, uint32_t pg_cnt);
+static void mfree_page_unmap(enum pool_flags pf, void *_vaddr, uint32_t pg_cnt);
+static void malloc_page_rollback(enum pool_flags pf, void *vaddr_start, uint32_t mapped_cnt, uint32_t pg_cnt);
+static void pse_init(void);
+static void kernel_image_protect(void);
+static void identity_map_remove(void);
+static void pge_init(void);
+static void kernel_pgdir_map(void);
+void *get_a_page(enum pool_flags pf, uint32_t vaddr);
+static void *vaddr_get_huge(enum pool_flags pf, uint32_t pg_cnt);
+static void page_table_huge_add(uint32_t vaddr, uint32_t page_phyaddr);
+static void page_table_huge_remove(uint32_t vaddr);
+static void *malloc_page_huge(enum pool_flags pf, uint32_t pg_cnt);
+void block_desc_init(struct mem_block_desc *desc_array);
+static bool uheap_ptr_ok(uint32_t vaddr, uint32_t len);
+bool uheap_elem_ok(struct list *plist, struct list_elem *elem);
+int32_t user_str_len(const char *str, uint32_t max_len);
+static struct list_elem *uheap_pop(struct list *plist);
+static bool uheap_append(struct list *plist, struct list_elem *elem);
+static bool uheap_remove(struct list *plist, struct list_elem *elem);
+static struct mem_block_desc *uheap_desc(struct mem_block_desc *key);
+void *sys_malloc(uint32_t size);
+static void sys_free_user(void *ptr);
+void sys_free(void *ptr);
+static void page_zero_range(void *vaddr, uint32_t pg_cnt);
+static uint32_t page_zero_take(void);
+static void page_zero_thread(void *arg);
+void page_zero_init(void);
+void *malloc_page_lazy(enum pool_flags pf, uint32_t pg_cnt);
+static struct lazy_region *lazy_region_find(uint32_t vaddr);
+uint16_t *page_ref_of(uint32_t pg_phy_addr);
+static void page_ref_share(uint32_t pg_phy_addr);
+static bool page_ref_put(uint32_t pg_phy_addr);
+static void *copy_window_map(uint32_t pg_phy_addr);
+static void copy_window_unmap(void);
+static void page_copy_to_frame(uint32_t dst_phy_addr, const void *src);
+static bool cow_fault(uint32_t page_vaddr);
+static bool swap_fault(uint32_t page_vaddr);
+void *kvaddr_reserve(uint32_t pg_cnt);
+void kvaddr_release(void *vaddr, uint32_t pg_cnt);
+bool pgdir_copy_user(uint32_t *child_pgdir, bool cow);
+void pgdir_release_user(uint32_t *pgdir);
+static void page_fault_handler(uint8_t vec_nr);
 void mem_init(void);
 
 #endif
\ No newline at end of file
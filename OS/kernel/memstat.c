@@ -0,0 +1,693 @@
+#include "memstat.h"
+#include "print.h"
+#include "serial.h"
+#include "console.h"
+#include "interrupt.h"
+#include "debug.h"
+#include "swap.h"
+#include "thread.h"
+#include "time.h"
+
+#define PG_SIZE 4096 // 页的大小（4096B，4K）
+
+/*****************************  内存统计  *********************************
+ * 分配与释放的计数、耗时在 memory.c 的 malloc_page 等接口中随调用记录；
+ * 各内存池的空闲页数、碎片情况则在 memstat_dump 时扫描位图现场算出。
+ *
+ * memstat_dump 同时输出到屏幕和串口 COM1，格式便于宿主机上的脚本解析：
+ *  ① 每条记录占一行，以 "memstat " 开头
+ *  ② 其后是空格分隔的 key=value，数值一律为不带 0x 前缀的十六进制（与 put_int 一致）
+ *  ③ 直方图等数组用逗号分隔
+ *  ④ 整次输出以 "memstat begin" 开始，以 "memstat end" 结束
+ ***************************************************************************/
+
+struct mem_op_stat mem_op_stat[RS_CNT]; // 内核与用户两侧的分配接口调用统计
+
+#if MEMSTAT_CALLSITE
+static struct callsite_stat callsite_stat[MEMSTAT_CALLSITE_CNT]; // 各调用点的分配统计
+static uint32_t callsite_overflow = 0;                          // 调用点表已满、未能记录的分配次数
+#endif
+
+/**
+ * @brief 记录一次页分配
+ *
+ * @param pf 内存池标志
+ * @param pg_cnt 申请的页数
+ * @param cycles 本次分配的耗时（TSC 周期数）
+ * @param caller 调用点地址（分配接口的返回地址）
+ * @param ok 分配是否成功
+ */
+void memstat_alloc(enum pool_flags pf, uint32_t pg_cnt, uint32_t cycles, void *caller UNUSED, bool ok)
+{
+    struct mem_op_stat *stat = &mem_op_stat[(pf & PF_KERNEL) ? RS_KERNEL : RS_USER];
+    enum intr_status old_status = intr_disable();
+    stat->alloc_calls++;
+    stat->alloc_cycles_total += cycles;
+    if (cycles > stat->alloc_cycles_max)
+    {
+        stat->alloc_cycles_max = cycles;
+    }
+    if (!ok)
+    {
+        stat->alloc_fails++;
+    }
+    else
+    {
+        stat->alloc_pages += pg_cnt;
+    }
+
+#if MEMSTAT_CALLSITE
+    /* 调用点表很小，线性查找即可 */
+    uint32_t idx;
+    for (idx = 0; idx < MEMSTAT_CALLSITE_CNT; idx++)
+    {
+        if (callsite_stat[idx].caller == (uint32_t)caller || callsite_stat[idx].caller == 0)
+        {
+            break;
+        }
+    }
+    if (idx == MEMSTAT_CALLSITE_CNT)
+    {
+        callsite_overflow++;
+    }
+    else
+    {
+        callsite_stat[idx].caller = (uint32_t)caller;
+        callsite_stat[idx].alloc_calls++;
+        if (ok)
+        {
+            callsite_stat[idx].alloc_bytes += pg_cnt * PG_SIZE;
+        }
+    }
+#endif
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 记录一次页释放
+ */
+void memstat_free(enum pool_flags pf, uint32_t pg_cnt)
+{
+    struct mem_op_stat *stat = &mem_op_stat[(pf & PF_KERNEL) ? RS_KERNEL : RS_USER];
+    enum intr_status old_status = intr_disable();
+    stat->free_calls++;
+    stat->free_pages += pg_cnt;
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 清空碎片统计，total 为被统计的总页数
+ */
+void memstat_frag_reset(struct frag_info *info, uint32_t total)
+{
+    uint32_t idx;
+    info->total = total;
+    info->free = 0;
+    info->largest_run = 0;
+    info->run_cnt = 0;
+    for (idx = 0; idx < FRAG_HIST_CNT; idx++)
+    {
+        info->hist[idx] = 0;
+    }
+}
+
+/**
+ * @brief 把一个长度为 run 页的空闲段计入碎片统计
+ */
+void memstat_frag_add(struct frag_info *info, uint32_t run)
+{
+    uint32_t bucket = 0;
+    while (bucket < FRAG_HIST_CNT - 1 && (run >> (bucket + 1)) != 0)
+    {
+        bucket++; // bucket = floor(log2(run))
+    }
+    info->hist[bucket]++;
+    info->free += run;
+    info->run_cnt++;
+    if (run > info->largest_run)
+    {
+        info->largest_run = run;
+    }
+}
+
+/**
+ * @brief 统计位图 btmp 中的空闲页数、最长连续空闲段以及空闲段长度的分布
+ *
+ * 借助位图的摘要索引逐段跳过，扫描期间关中断以得到一致的快照。
+ *
+ * @param btmp 要统计的位图（位为 0 表示空闲）
+ * @param info 存放结果
+ */
+void memstat_frag(struct bitmap *btmp, struct frag_info *info)
+{
+    uint32_t total = btmp->btmp_bytes_len * 8;
+    uint32_t idx = 0;
+    int bit_idx;
+    memstat_frag_reset(info, total);
+
+    enum intr_status old_status = intr_disable();
+    while ((bit_idx = bitmap_scan_range(btmp, idx, total)) != -1)
+    {
+        uint32_t run = bitmap_free_run(btmp, bit_idx, total);
+        memstat_frag_add(info, run);
+        idx = bit_idx + run;
+    }
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 同时向屏幕和串口输出字符串
+ */
+void memstat_put_str(char *str)
+{
+    put_str(str);
+    serial_put_str(str);
+}
+
+/**
+ * @brief 同时向屏幕和串口以十六进制输出整数
+ */
+void memstat_put_int(uint32_t num)
+{
+    put_int(num);
+    serial_put_int(num);
+}
+
+/**
+ * @brief 输出一份碎片统计，记录形如 "memstat <key>=<name> total=.. free=.. largest=.. runs=.. hist=a,b,.."
+ */
+static void memstat_dump_frag(char *key, char *name, struct frag_info *info)
+{
+    memstat_put_str("memstat ");
+    memstat_put_str(key);
+    memstat_put_str("=");
+    memstat_put_str(name);
+    memstat_put_str(" total=");
+    memstat_put_int(info->total);
+    memstat_put_str(" free=");
+    memstat_put_int(info->free);
+    memstat_put_str(" largest=");
+    memstat_put_int(info->largest_run);
+    memstat_put_str(" runs=");
+    memstat_put_int(info->run_cnt);
+    memstat_put_str(" hist=");
+    uint32_t idx;
+    for (idx = 0; idx < FRAG_HIST_CNT; idx++)
+    {
+        if (idx > 0)
+        {
+            memstat_put_str(",");
+        }
+        memstat_put_int(info->hist[idx]);
+    }
+    memstat_put_str("\n");
+}
+
+/**
+ * @brief 输出一个物理内存池的统计：位图碎片、各区域、配额以及分配接口的调用情况
+ */
+static void memstat_dump_pool(char *name, struct pool *m_pool, enum reservoir_side side)
+{
+    static char *zone_name[ZONE_CNT] = {"DMA", "NORMAL", "HIGH"};
+    struct frag_info info;
+    memstat_frag(&m_pool->pool_bitmap, &info);
+    memstat_dump_frag("pool", name, &info);
+
+    uint32_t zone_idx;
+    for (zone_idx = 0; zone_idx < ZONE_CNT; zone_idx++)
+    {
+        struct zone *zone = &m_pool->zones[zone_idx];
+        memstat_put_str("memstat zone=");
+        memstat_put_str(name);
+        memstat_put_str(".");
+        memstat_put_str(zone_name[zone_idx]);
+        memstat_put_str(" present=");
+        memstat_put_int(zone->present_pages);
+        memstat_put_str(" free=");
+        memstat_put_int(zone->free_pages);
+        memstat_put_str(" watermark=");
+        memstat_put_int(zone->watermark);
+        memstat_put_str("\n");
+    }
+
+    struct reservoir_stat *rs = &reservoir_stat[side];
+    memstat_put_str("memstat side=");
+    memstat_put_str(name);
+    memstat_put_str(" quota=");
+    memstat_put_int(rs->quota);
+    memstat_put_str(" used=");
+    memstat_put_int(rs->used);
+    memstat_put_str(" peak=");
+    memstat_put_int(rs->peak);
+    memstat_put_str(" borrowed=");
+    memstat_put_int(rs->borrowed);
+    memstat_put_str(" borrows=");
+    memstat_put_int(rs->borrow_events);
+    memstat_put_str(" refusals=");
+    memstat_put_int(rs->lend_refusals);
+    memstat_put_str("\n");
+
+    struct mem_op_stat *ops = &mem_op_stat[side];
+    memstat_put_str("memstat ops=");
+    memstat_put_str(name);
+    memstat_put_str(" allocs=");
+    memstat_put_int(ops->alloc_calls);
+    memstat_put_str(" fails=");
+    memstat_put_int(ops->alloc_fails);
+    memstat_put_str(" alloc_pages=");
+    memstat_put_int(ops->alloc_pages);
+    memstat_put_str(" frees=");
+    memstat_put_int(ops->free_calls);
+    memstat_put_str(" free_pages=");
+    memstat_put_int(ops->free_pages);
+    memstat_put_str(" cycles_hi=");
+    memstat_put_int((uint32_t)(ops->alloc_cycles_total >> 32));
+    memstat_put_str(" cycles_lo=");
+    memstat_put_int((uint32_t)ops->alloc_cycles_total);
+    memstat_put_str(" cycles_max=");
+    memstat_put_int(ops->alloc_cycles_max);
+    memstat_put_str("\n");
+}
+
+/**
+ * @brief 把内存统计完整地输出到屏幕和串口
+ *
+ * 输出期间持有终端锁，避免与其他线程的输出交错，因此须在 console_init 之后、在线程上下文中调用。
+ */
+void memstat_dump(void)
+{
+    console_acquire();
+    memstat_put_str("memstat begin\n");
+    memstat_dump_pool("kernel", &kernel_pool, RS_KERNEL);
+    memstat_dump_pool("user", &user_pool, RS_USER);
+    struct frag_info info;
+    vaddr_frag(&info);
+    memstat_dump_frag("vaddr", "kernel", &info);
+    memstat_put_str("memstat zero bg_zeroed=");
+    memstat_put_int(page_zero_stat.bg_zeroed);
+    memstat_put_str(" prezeroed_hits=");
+    memstat_put_int(page_zero_stat.prezeroed_hits);
+    memstat_put_str(" inline_zeroed=");
+    memstat_put_int(page_zero_stat.inline_zeroed);
+    memstat_put_str("\n");
+    memstat_put_str("memstat swap out=");
+    memstat_put_int(swap_stat.swap_out);
+    memstat_put_str(" in=");
+    memstat_put_int(swap_stat.swap_in);
+    memstat_put_str(" evicts=");
+    memstat_put_int(swap_stat.evict_calls);
+    memstat_put_str(" evict_fails=");
+    memstat_put_int(swap_stat.evict_fails);
+    memstat_put_str(" scanned=");
+    memstat_put_int(swap_stat.scanned);
+    memstat_put_str(" io_errors=");
+    memstat_put_int(swap_stat.io_errors);
+    memstat_put_str(" cycles_hi=");
+    memstat_put_int((uint32_t)(swap_stat.scan_cycles >> 32));
+    memstat_put_str(" cycles_lo=");
+    memstat_put_int((uint32_t)swap_stat.scan_cycles);
+    memstat_put_str("\n");
+    memstat_put_str("memstat tick tickless=");
+    memstat_put_int(CONFIG_TICKLESS);
+    memstat_put_str(" ticks=");
+    memstat_put_int(ticks);
+    memstat_put_str(" irqs=");
+    memstat_put_int(tick_stat.timer_irqs);
+    memstat_put_str(" oneshots=");
+    memstat_put_int(tick_stat.oneshots);
+    memstat_put_str(" early_wakes=");
+    memstat_put_int(tick_stat.early_wakes);
+    memstat_put_str(" idle_ticks=");
+    memstat_put_int(idle_thread->elapsed_ticks);
+    memstat_put_str("\n");
+
+#if MEMSTAT_CALLSITE
+    uint32_t idx;
+    for (idx = 0; idx < MEMSTAT_CALLSITE_CNT && callsite_stat[idx].caller != 0; idx++)
+    {
+        memstat_put_str("memstat callsite=");
+        memstat_put_int(callsite_stat[idx].caller);
+        memstat_put_str(" allocs=");
+        memstat_put_int(callsite_stat[idx].alloc_calls);
+        memstat_put_str(" bytes=");
+        memstat_put_int(callsite_stat[idx].alloc_bytes);
+        memstat_put_str("\n");
+    }
+    memstat_put_str("memstat callsite_overflow=");
+    memstat_put_int(callsite_overflow);
+    memstat_put_str("\n");
+#endif
+    memstat_put_str("memstat end\n");
+    console_release();
+}
+
+/**
+ * @brief 重复 rounds 次 "重新加载 CR3，再逐页读一遍 pages 中的 pg_cnt 页"，返回总耗时（TSC 周期数）
+ */
+static uint64_t tlb_bench_round(uint32_t *pages, uint32_t pg_cnt, uint32_t rounds)
+{
+    uint64_t start = rdtsc();
+    uint32_t round;
+    for (round = 0; round < rounds; round++)
+    {
+        uint32_t cr3;
+        asm volatile("movl %%cr3, %0; movl %0, %%cr3" : "=r"(cr3) : : "memory"); // 模拟一次页目录切换
+        uint32_t idx;
+        for (idx = 0; idx < pg_cnt; idx++)
+        {
+            (void)*(volatile uint32_t *)((uint32_t)pages + idx * PG_SIZE); // 每页读一次，TLB 未命中时要重新走页表
+        }
+    }
+    return rdtsc() - start;
+}
+
+/**
+ * @brief 测量页目录切换后 TLB 重新填充的开销：全局页开启与关闭各测一次
+ *
+ * 申请 pg_cnt 页内核内存，分别在 CR4.PGE 开启（内核页的 TLB 条目跨 CR3 加载保留）和暂时关闭（每次 CR3 加载都清空）时，
+ * 重复 rounds 次 "重新加载 CR3 + 逐页访问"，把两种情况的总周期数以 "memstat tlb ..." 记录输出到屏幕和串口。
+ * 处理器不支持全局页时两次测量相同。测量期间关中断，避免时钟中断和线程切换混入。
+ */
+void memstat_tlb_bench(uint32_t pg_cnt, uint32_t rounds)
+{
+    uint32_t *pages = get_kernel_pages(pg_cnt);
+    if (pages == NULL)
+    {
+        return;
+    }
+    enum intr_status old_status = intr_disable();
+    tlb_bench_round(pages, pg_cnt, 1); // 预热
+    uint64_t global_cycles = tlb_bench_round(pages, pg_cnt, rounds);
+
+    uint32_t cr4;
+    asm volatile("movl %%cr4, %0" : "=r"(cr4));
+    asm volatile("movl %0, %%cr4" : : "r"(cr4 & ~CR4_PGE) : "memory"); // 关闭后 G 位不再生效
+    tlb_bench_round(pages, pg_cnt, 1);
+    uint64_t flush_cycles = tlb_bench_round(pages, pg_cnt, rounds);
+    asm volatile("movl %0, %%cr4" : : "r"(cr4) : "memory"); // 恢复原来的 CR4
+    intr_set_status(old_status);
+    mfree_page(PF_KERNEL, pages, pg_cnt);
+
+    console_acquire();
+    memstat_put_str("memstat tlb pages=");
+    memstat_put_int(pg_cnt);
+    memstat_put_str(" rounds=");
+    memstat_put_int(rounds);
+    memstat_put_str(" pge=");
+    memstat_put_int(pge_enabled);
+    memstat_put_str(" global_hi=");
+    memstat_put_int((uint32_t)(global_cycles >> 32));
+    memstat_put_str(" global_lo=");
+    memstat_put_int((uint32_t)global_cycles);
+    memstat_put_str(" flush_hi=");
+    memstat_put_int((uint32_t)(flush_cycles >> 32));
+    memstat_put_str(" flush_lo=");
+    memstat_put_int((uint32_t)flush_cycles);
+    memstat_put_str("\n");
+    console_release();
+}
+
+#define PSE_BENCH_PAGES 1024 // 4MB，恰好是一个大页
+
+/**
+ * @brief 重复 rounds 次 "逐页读一遍从 base 起的 PSE_BENCH_PAGES 页"，返回总耗时（TSC 周期数）
+ *
+ * 每页读的位置错开一个缓存行，让各页的访问落在不同的缓存组上，开销主要来自 TLB 的命中与否。
+ */
+static uint64_t pse_bench_round(uint32_t base, uint32_t rounds)
+{
+    uint64_t start = rdtsc();
+    uint32_t round;
+    for (round = 0; round < rounds; round++)
+    {
+        uint32_t idx;
+        for (idx = 0; idx < PSE_BENCH_PAGES; idx++)
+        {
+            (void)*(volatile uint32_t *)(base + idx * PG_SIZE + (idx % 64) * 64);
+        }
+    }
+    return rdtsc() - start;
+}
+
+/**
+ * @brief 测量 4KB 页与 4MB 大页的 TLB 压力：同一块 4MB 缓冲区分别经 4KB 页和一个 PSE 大页映射，各测一次
+ *
+ * 用 get_kernel_pages 申请 4MB（开启了 PSE 时由一个 4MB 大页映射），再在另一段内核虚拟地址上用 1024 个 4KB 页表项映射同一块物理内存。
+ * 两个视图访问的是相同的物理缓存行，差别只在于 4KB 视图要占用 1024 个 TLB 条目、4MB 视图只需一个。
+ * 各重复 rounds 次逐页访问，总周期数以 "memstat pse rounds=.. pse=.. small_hi=.. small_lo=.. huge_hi=.. huge_lo=.." 记录输出，
+ * pse 为 0 表示缓冲区没能用大页映射（处理器不支持 PSE），此时两次测量都是 4KB 页。测量期间关中断。
+ */
+void memstat_pse_bench(uint32_t rounds)
+{
+    uint32_t huge = (uint32_t)get_kernel_pages(PSE_BENCH_PAGES);
+    if (huge == 0)
+    {
+        return;
+    }
+    uint32_t small = (uint32_t)kvaddr_reserve(PSE_BENCH_PAGES);
+    if (small == 0 || !map_range_contig(small, addr_v2p(huge), PSE_BENCH_PAGES, PG_RW_W))
+    {
+        if (small != 0)
+        {
+            kvaddr_release((void *)small, PSE_BENCH_PAGES);
+        }
+        mfree_page(PF_KERNEL, (void *)huge, PSE_BENCH_PAGES);
+        return;
+    }
+    bool pse = (*pde_ptr(huge) & PG_PS) != 0;
+
+    enum intr_status old_status = intr_disable();
+    pse_bench_round(small, 1); // 预热
+    uint64_t small_cycles = pse_bench_round(small, rounds);
+    pse_bench_round(huge, 1);
+    uint64_t huge_cycles = pse_bench_round(huge, rounds);
+    intr_set_status(old_status);
+
+    unmap_range(small, PSE_BENCH_PAGES, false); // 页框属于 huge，只去掉别名映射
+    kvaddr_release((void *)small, PSE_BENCH_PAGES);
+    mfree_page(PF_KERNEL, (void *)huge, PSE_BENCH_PAGES);
+
+    console_acquire();
+    memstat_put_str("memstat pse rounds=");
+    memstat_put_int(rounds);
+    memstat_put_str(" pse=");
+    memstat_put_int(pse);
+    memstat_put_str(" small_hi=");
+    memstat_put_int((uint32_t)(small_cycles >> 32));
+    memstat_put_str(" small_lo=");
+    memstat_put_int((uint32_t)small_cycles);
+    memstat_put_str(" huge_hi=");
+    memstat_put_int((uint32_t)(huge_cycles >> 32));
+    memstat_put_str(" huge_lo=");
+    memstat_put_int((uint32_t)huge_cycles);
+    memstat_put_str("\n");
+    console_release();
+}
+
+#define HEAP_BENCH_BATCH 64 // 每轮连续申请后再全部释放的次数（指针放在调用者栈上）
+
+/**
+ * @brief 测量小块堆内存与整页分配的吞吐：sys_malloc/sys_free 与 get_kernel_pages(1)/mfree_page 各测一次
+ *
+ * 每轮先连续申请 HEAP_BENCH_BATCH 次（size 字节或 1 页），再按申请顺序全部释放，重复 rounds 轮，
+ * 两种方式的总周期数以 "memstat heap size=.. ops=.. malloc_hi=.. malloc_lo=.. page_hi=.. page_lo=.." 记录输出，
+ * ops 为每种方式的申请次数（失败的申请同样计入）。须在内核线程中调用，不关中断，测得的是包括锁在内的完整路径。
+ */
+void memstat_heap_bench(uint32_t size, uint32_t rounds)
+{
+    void *ptrs[HEAP_BENCH_BATCH];
+    uint32_t round, idx;
+
+    uint64_t start = rdtsc();
+    for (round = 0; round < rounds; round++)
+    {
+        for (idx = 0; idx < HEAP_BENCH_BATCH; idx++)
+        {
+            ptrs[idx] = sys_malloc(size);
+        }
+        for (idx = 0; idx < HEAP_BENCH_BATCH; idx++)
+        {
+            sys_free(ptrs[idx]); // 申请失败的为 NULL，sys_free 直接返回
+        }
+    }
+    uint64_t malloc_cycles = rdtsc() - start;
+
+    start = rdtsc();
+    for (round = 0; round < rounds; round++)
+    {
+        for (idx = 0; idx < HEAP_BENCH_BATCH; idx++)
+        {
+            ptrs[idx] = get_kernel_pages(1);
+        }
+        for (idx = 0; idx < HEAP_BENCH_BATCH; idx++)
+        {
+            if (ptrs[idx] != NULL)
+            {
+                mfree_page(PF_KERNEL, ptrs[idx], 1);
+            }
+        }
+    }
+    uint64_t page_cycles = rdtsc() - start;
+
+    console_acquire();
+    memstat_put_str("memstat heap size=");
+    memstat_put_int(size);
+    memstat_put_str(" ops=");
+    memstat_put_int(rounds * HEAP_BENCH_BATCH);
+    memstat_put_str(" malloc_hi=");
+    memstat_put_int((uint32_t)(malloc_cycles >> 32));
+    memstat_put_str(" malloc_lo=");
+    memstat_put_int((uint32_t)malloc_cycles);
+    memstat_put_str(" page_hi=");
+    memstat_put_int((uint32_t)(page_cycles >> 32));
+    memstat_put_str(" page_lo=");
+    memstat_put_int((uint32_t)page_cycles);
+    memstat_put_str("\n");
+    console_release();
+}
+
+/**************************  位图扫描的对比  ******************************
+ * 对 32MB、128MB、512MB 物理内存对应大小的位图（每位一页）各测一次三种扫描方式：
+ *  byte：改为按字扫描之前逐字节、逐位扫描的做法（bitmap_scan_bytes，仅供对比）
+ *  word：按 32 位字扫描，不挂摘要索引
+ *  sum：按 32 位字扫描，并用两级摘要索引跳过已满的字
+ * 位图的前 7/8 全部占用，其后每隔一位空闲一位，最后 BITMAP_BENCH_TAIL 位全部空闲，近似内存池用了很久、空闲页零散地留在高端的情形：
+ * 申请 1 位要越过前 7/8，申请 BITMAP_BENCH_RUN 位要一直扫到末尾。
+ * 每种方式重复 rounds 次 "扫描 1 位"（scan1）、"扫描 BITMAP_BENCH_RUN 位"（run）和 "扫描 1 位并占用、再释放"（alloc），
+ * 每种大小以 "memstat bitmap mb=.. bits=.. rounds=.. scan1_byte=.. scan1_word=.. scan1_sum=.. run_byte=.. ... alloc_sum=.." 输出一行，
+ * 数值为平均每次的周期数（总周期数超出 32 位时记为 ffffffff）。每项测量期间关中断。
+ ***********************************************************************/
+#define BITMAP_BENCH_RUN 16  // 多位扫描申请的位数
+#define BITMAP_BENCH_TAIL 64 // 位图末尾全部空闲的位数
+
+static const uint32_t bitmap_bench_mb[] = {32, 128, 512};
+
+/**
+ * @brief 改为按字扫描之前的 bitmap_scan：先逐字节找到第一个不为 0xff 的字节，再逐位数出 cnt 个连续的 0，失败返回 -1
+ */
+static int bitmap_scan_bytes(struct bitmap *btmp, uint32_t cnt)
+{
+    uint32_t idx_byte = 0;
+    while (idx_byte < btmp->btmp_bytes_len && btmp->bits[idx_byte] == 0xff)
+    {
+        idx_byte++;
+    }
+    if (idx_byte == btmp->btmp_bytes_len)
+    {
+        return -1;
+    }
+    uint32_t next_bit = idx_byte * 8;
+    while (bitmap_scan_test(btmp, next_bit))
+    {
+        next_bit++;
+    }
+    uint32_t bit_end = btmp->btmp_bytes_len * 8;
+    uint32_t count = 0;
+    for (; next_bit < bit_end; next_bit++)
+    {
+        count = bitmap_scan_test(btmp, next_bit) ? 0 : count + 1;
+        if (count == cnt)
+        {
+            return next_bit - cnt + 1;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief 在 btmp 上重复 rounds 次扫描 cnt 位（alloc 为真时找到后占用再释放），bytes 为真时用 bitmap_scan_bytes，返回平均每次的周期数
+ */
+static uint32_t bitmap_bench_round(struct bitmap *btmp, uint32_t cnt, bool alloc, bool bytes, uint32_t rounds)
+{
+    enum intr_status old_status = intr_disable();
+    uint64_t start = rdtsc();
+    uint32_t round;
+    for (round = 0; round < rounds; round++)
+    {
+        int bit_idx = bytes ? bitmap_scan_bytes(btmp, cnt) : bitmap_scan(btmp, cnt);
+        if (alloc && bit_idx != -1)
+        {
+            bitmap_set_range(btmp, bit_idx, cnt, 1);
+            bitmap_set_range(btmp, bit_idx, cnt, 0);
+        }
+    }
+    uint64_t cycles = rdtsc() - start;
+    intr_set_status(old_status);
+    return (cycles >> 32) ? 0xffffffff : (uint32_t)cycles / rounds;
+}
+
+/**
+ * @brief 对比逐字节扫描、按字扫描和带摘要索引的按字扫描在不同大小的位图上的耗时（见上方说明）
+ */
+void memstat_bitmap_bench(uint32_t rounds)
+{
+    if (rounds == 0)
+    {
+        return;
+    }
+    uint32_t max_bytes = bitmap_bench_mb[sizeof(bitmap_bench_mb) / sizeof(bitmap_bench_mb[0]) - 1] * (1024 * 1024 / PG_SIZE) / 8;
+    uint32_t pg_cnt = DIV_ROUND_UP(max_bytes + bitmap_summary_bytes(max_bytes), PG_SIZE);
+    uint8_t *buf = get_kernel_pages(pg_cnt);
+    if (buf == NULL)
+    {
+        return;
+    }
+
+    uint32_t idx;
+    for (idx = 0; idx < sizeof(bitmap_bench_mb) / sizeof(bitmap_bench_mb[0]); idx++)
+    {
+        struct bitmap btmp;
+        btmp.btmp_bytes_len = bitmap_bench_mb[idx] * (1024 * 1024 / PG_SIZE) / 8;
+        btmp.bits = buf;
+        btmp.summary = (uint32_t *)(buf + max_bytes); // max_bytes 是 4 的倍数
+        bitmap_init(&btmp);
+        uint32_t bits = btmp.btmp_bytes_len * 8;
+        uint32_t bit_idx = bits / 8 * 7;
+        bitmap_set_range(&btmp, 0, bit_idx, 1);
+        for (; bit_idx < bits - BITMAP_BENCH_TAIL; bit_idx += 2)
+        {
+            bitmap_set(&btmp, bit_idx, 1);
+        }
+
+        // 先测带摘要的做法，再去掉摘要测另外两种；后两种只改位图、不更新摘要，但每次都把占用的位还原
+        uint32_t scan1_sum = bitmap_bench_round(&btmp, 1, false, false, rounds);
+        uint32_t run_sum = bitmap_bench_round(&btmp, BITMAP_BENCH_RUN, false, false, rounds);
+        uint32_t alloc_sum = bitmap_bench_round(&btmp, 1, true, false, rounds);
+        btmp.summary = NULL;
+        uint32_t scan1_word = bitmap_bench_round(&btmp, 1, false, false, rounds);
+        uint32_t run_word = bitmap_bench_round(&btmp, BITMAP_BENCH_RUN, false, false, rounds);
+        uint32_t alloc_word = bitmap_bench_round(&btmp, 1, true, false, rounds);
+        uint32_t scan1_byte = bitmap_bench_round(&btmp, 1, false, true, rounds);
+        uint32_t run_byte = bitmap_bench_round(&btmp, BITMAP_BENCH_RUN, false, true, rounds);
+        uint32_t alloc_byte = bitmap_bench_round(&btmp, 1, true, true, rounds);
+
+        console_acquire();
+        memstat_put_str("memstat bitmap mb=");
+        memstat_put_int(bitmap_bench_mb[idx]);
+        memstat_put_str(" bits=");
+        memstat_put_int(bits);
+        memstat_put_str(" rounds=");
+        memstat_put_int(rounds);
+        memstat_put_str(" scan1_byte=");
+        memstat_put_int(scan1_byte);
+        memstat_put_str(" scan1_word=");
+        memstat_put_int(scan1_word);
+        memstat_put_str(" scan1_sum=");
+        memstat_put_int(scan1_sum);
+        memstat_put_str(" run_byte=");
+        memstat_put_int(run_byte);
+        memstat_put_str(" run_word=");
+        memstat_put_int(run_word);
+        memstat_put_str(" run_sum=");
+        memstat_put_int(run_sum);
+        memstat_put_str(" alloc_byte=");
+        memstat_put_int(alloc_byte);
+        memstat_put_str(" alloc_word=");
+        memstat_put_int(alloc_word);
+        memstat_put_str(" alloc_sum=");
+        memstat_put_int(alloc_sum);
+        memstat_put_str("\n");
+        console_release();
+    }
+    mfree_page(PF_KERNEL, buf, pg_cnt);
+}
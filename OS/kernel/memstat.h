@@ -0,0 +1,72 @@
+#ifndef __KERNEL_MEMSTAT_H
+#define __KERNEL_MEMSTAT_H
+
+#include "stdint.h"
+#include "memory.h"
+
+#define MEMSTAT_CALLSITE 1      // 为 1 时按调用点（malloc_page 等的返回地址）累计分配的页数，置 0 可省去这部分开销
+#define MEMSTAT_CALLSITE_CNT 32 // 最多记录的调用点个数，超出后新的调用点计入 callsite_overflow
+#define FRAG_HIST_CNT 21        // 空闲段长度直方图的桶数，第 i 桶统计长度在 [2^i, 2^(i+1)) 页的空闲段（2^20 页即 4GB）
+
+/* 某一侧（内核或用户）页分配接口的调用统计 */
+struct mem_op_stat
+{
+    uint32_t alloc_calls;        // malloc_page / get_kernel_pages / malloc_page_contig / malloc_page_lazy 的调用次数
+    uint32_t alloc_fails;        // 其中失败的次数
+    uint32_t alloc_pages;        // 成功分配的页数
+    uint32_t free_calls;         // mfree_page 的调用次数
+    uint32_t free_pages;         // 释放的页数
+    uint32_t alloc_cycles_max;   // 单次分配耗时的最大值（时间戳计数器的周期数）
+    uint64_t alloc_cycles_total; // 分配耗时的总和
+};
+
+/* 一个调用点的分配统计 */
+struct callsite_stat
+{
+    uint32_t caller;      // 调用点地址（为 0 表示此表项空闲）
+    uint32_t alloc_calls; // 分配次数
+    uint32_t alloc_bytes; // 成功分配的字节数
+};
+
+/* 一张位图的碎片情况（位为 0 表示空闲） */
+struct frag_info
+{
+    uint32_t total;               // 位图管理的总页数
+    uint32_t free;                // 空闲页数
+    uint32_t largest_run;         // 最长的连续空闲段的页数
+    uint32_t run_cnt;             // 连续空闲段的个数
+    uint32_t hist[FRAG_HIST_CNT]; // 空闲段长度的直方图
+};
+
+/**
+ * @brief 读取时间戳计数器（TSC），用于测量分配的耗时
+ */
+static inline uint64_t rdtsc(void)
+{
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+extern struct mem_op_stat mem_op_stat[RS_CNT];
+void memstat_alloc(enum pool_flags pf, uint32_t pg_cnt, uint32_t cycles, void *caller, bool ok);
+void memstat_free(enum pool_flags pf, uint32_t pg_cnt);
+void memstat_frag_reset(struct frag_info *info, uint32_t total);
+void memstat_frag_add(struct frag_info *info, uint32_t run);
+void memstat_frag(struct bitmap *btmp, struct frag_info *info);
+void vaddr_frag(struct frag_info *info); // 在 memory.c 中实现
+void memstat_put_str(char *str);
+void memstat_put_int(uint32_t num);
+static void memstat_dump_frag(char *key, char *name, struct frag_info *info);
+static void memstat_dump_pool(char *name, struct pool *m_pool, enum reservoir_side side);
+void memstat_dump(void);
+static uint64_t tlb_bench_round(uint32_t *pages, uint32_t pg_cnt, uint32_t rounds);
+void memstat_tlb_bench(uint32_t pg_cnt, uint32_t rounds);
+static uint64_t pse_bench_round(uint32_t base, uint32_t rounds);
+void memstat_pse_bench(uint32_t rounds);
+void memstat_heap_bench(uint32_t size, uint32_t rounds);
+static int bitmap_scan_bytes(struct bitmap *btmp, uint32_t cnt);
+static uint32_t bitmap_bench_round(struct bitmap *btmp, uint32_t cnt, bool alloc, bool bytes, uint32_t rounds);
+void memstat_bitmap_bench(uint32_t rounds);
+
+#endif
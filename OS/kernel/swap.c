@@ -0,0 +1,291 @@
+#include "swap.h"
+#include "memory.h"
+#include "memstat.h"
+#include "ide.h"
+#include "process.h"
+#include "interrupt.h"
+#include "debug.h"
+#include "print.h"
+#include "list.h"
+#include "sync.h"
+
+#define PG_SIZE 4096
+#define SECTORS_PER_PAGE (PG_SIZE / SECTOR_SIZE)
+#define USER_VPN_END (0xc0000000 / PG_SIZE) // 用户空间的虚拟页号上界
+
+/*****************************  换页（swap）  *********************************
+ * 用户物理内存池（连同可借用的内核一侧）用尽时，palloc_order 调用 swap_evict 换出一个冷页，腾出的页框直接交给申请者。
+ * 冷页用时钟算法近似 LRU 挑选：时钟指针依次扫过各用户进程的用户页表项，访问位（PG_A）为 1 的清 0 后跳过，
+ * 为 0 的（自上一圈以来没被访问过）写入硬盘上的交换区，页表项改为不存在并记下交换槽号：
+ *     | 交换槽号（31~12 位） | PG_SWAP | PG_COW | ... | US | RW | P=0 |
+ * 之后访问该页引发缺页异常，由 page_fault_handler 申请页框并调用 swap_in 读回。
+ * 写时复制共享的页（引用计数不为 0）不换出；共享方都已退出或写过、只剩自己的页仍带 PG_COW（R/W 为 0），
+ * 换出时连同 PG_COW 一起保留，换入后的写入照常由 cow_fault 恢复可写。
+ * 换出和换入都可能发生在缺页异常中，调用时已关中断；硬盘以查询方式读写，等盘期间 ide_wait 临时开中断，其他线程照常运行。
+ * 因此交换槽位图、时钟指针、临时映射窗口和正在换出的页都由 swap_lock 保护，同一时刻只有一个线程在读写交换区：
+ * 换出时先把页表项改为不存在、占好交换槽再写盘，写盘期间进程访问该页会缺页，在 swap_in 中等锁，等换出完成后再读回；
+ * 进程退出时 pgdir_release_user 同样先拿锁，正在换出的页所在的页表不会被中途释放。
+ ******************************************************************************/
+
+struct swap_stat swap_stat;
+struct lock swap_lock;            // 串行化交换区的读写，见上
+static struct bitmap swap_slots;  // 交换槽位图，位为 1 表示该槽存有换出的页
+static uint32_t swap_window = 0;  // 两页临时映射窗口：[0] 映射被扫描进程的页表，[1] 映射换入换出的页框
+static pid_t hand_pid = 0;        // 时钟指针所在的进程（pid 不小于它的第一个用户进程）
+static uint32_t hand_vpn = 0;     // 时钟指针在该进程中的下一个虚拟页号
+
+/**
+ * @brief 把页框 pg_phy_addr 映射到第 idx 个窗口上，返回其虚拟地址（调用者需关中断并持有 swap_lock）
+ */
+static void *swap_window_map(uint32_t idx, uint32_t pg_phy_addr)
+{
+    uint32_t vaddr = swap_window + idx * PG_SIZE;
+    *pte_ptr(vaddr) = (pg_phy_addr | PG_US_S | PG_RW_W | PG_P_1);
+    asm volatile("invlpg %0" : : "m"(*(char *)vaddr) : "memory");
+    return (void *)vaddr;
+}
+
+/**
+ * @brief 解除第 idx 个窗口的映射
+ */
+static void swap_window_unmap(uint32_t idx)
+{
+    uint32_t vaddr = swap_window + idx * PG_SIZE;
+    *pte_ptr(vaddr) = 0;
+    asm volatile("invlpg %0" : : "m"(*(char *)vaddr) : "memory");
+}
+
+/**
+ * @brief 在交换槽 slot 与页框 pg_phy_addr 之间传送一页，write 为 true 时写入交换区
+ *
+ * @return bool 硬盘出错时返回 false
+ */
+static bool swap_io(uint32_t slot, uint32_t pg_phy_addr, bool write)
+{
+    void *buf = swap_window_map(1, pg_phy_addr);
+    uint32_t lba = SWAP_LBA_START + slot * SECTORS_PER_PAGE;
+    bool ok = write ? ide_write(lba, buf, SECTORS_PER_PAGE) : ide_read(lba, buf, SECTORS_PER_PAGE);
+    swap_window_unmap(1);
+    if (!ok)
+    {
+        swap_stat.io_errors++;
+    }
+    return ok;
+}
+
+/**
+ * @brief 返回 pid 不小于 pid 的用户进程中 pid 最小的一个，没有时返回 NULL
+ */
+static struct task_struct *swap_next_task(pid_t pid)
+{
+    struct task_struct *next = NULL;
+    struct list_elem *elem = thread_all_list.head.next;
+    while (elem != &thread_all_list.tail)
+    {
+        struct task_struct *pthread = elem2entry(struct task_struct, all_list_tag, elem);
+        if (pthread->pgdir != NULL && pthread->pid >= pid && (next == NULL || pthread->pid < next->pid))
+        {
+            next = pthread;
+        }
+        elem = elem->next;
+    }
+    return next;
+}
+
+/**
+ * @brief 从时钟指针处扫描进程 task 的用户页表项，找到冷页就把它换到交换槽 slot
+ *
+ * @param frame 换出成功时存放腾出的页框，扫到进程的用户空间末尾仍没有找到时存放 0
+ * @return bool 写交换区出错时返回 false
+ */
+static bool swap_scan_task(struct task_struct *task, uint32_t slot, uint32_t *frame)
+{
+    uint32_t cr3;
+    asm volatile("movl %%cr3, %0" : "=r"(cr3));
+    bool current = (addr_v2p((uint32_t)task->pgdir) == cr3); // 当前地址空间中改动的页表项要刷新 TLB，其他地址空间的在切换时已整体刷新
+    *frame = 0;
+    while (hand_vpn < USER_VPN_END)
+    {
+        uint32_t pde_idx = hand_vpn / PG_TABLE_ENTRIES;
+        uint32_t pde = task->pgdir[pde_idx];
+        if (!(pde & PG_P_1))
+        {
+            hand_vpn = (pde_idx + 1) * PG_TABLE_ENTRIES;
+            continue;
+        }
+
+        uint32_t *pte = swap_window_map(0, pde & 0xfffff000);
+        for (; hand_vpn < (pde_idx + 1) * PG_TABLE_ENTRIES; hand_vpn++)
+        {
+            uint32_t *entry = &pte[hand_vpn % PG_TABLE_ENTRIES];
+            if ((*entry & (PG_P_1 | PG_US_U)) != (PG_P_1 | PG_US_U))
+            {
+                continue;
+            }
+            swap_stat.scanned++;
+            uint32_t pg_phy_addr = *entry & 0xfffff000;
+            if (*page_ref_of(pg_phy_addr) != 0)
+            {
+                continue;
+            }
+            uint32_t vaddr = hand_vpn * PG_SIZE;
+            if (*entry & PG_A) // 上一圈以来被访问过，给它第二次机会
+            {
+                *entry &= ~PG_A;
+                if (current)
+                {
+                    asm volatile("invlpg %0" : : "m"(*(char *)vaddr) : "memory");
+                }
+                continue;
+            }
+
+            // 写盘时会开中断，先把页表项改为不存在，进程在此期间的访问都会缺页并在 swap_in 中等待换出完成
+            uint32_t old_entry = *entry;
+            uint32_t swap_entry = (slot << 12) | PG_SWAP | (old_entry & (PG_US_U | PG_RW_W | PG_COW));
+            *entry = swap_entry;
+            if (current)
+            {
+                asm volatile("invlpg %0" : : "m"(*(char *)vaddr) : "memory");
+            }
+            bitmap_set(&swap_slots, slot, 1);
+            hand_vpn++;
+            bool ok = swap_io(slot, pg_phy_addr, true);
+            if (!ok && *entry == swap_entry)
+            {
+                *entry = old_entry; // 写盘失败，页仍留在内存中
+                bitmap_set(&swap_slots, slot, 0);
+                swap_window_unmap(0);
+                return false;
+            }
+            // 写盘期间进程可能已解除该页的映射（交换槽随之释放），页框同样空了出来
+            if (ok)
+            {
+                swap_stat.swap_out++;
+            }
+            swap_window_unmap(0);
+            *frame = pg_phy_addr;
+            return true;
+        }
+        swap_window_unmap(0);
+    }
+    return true;
+}
+
+/**
+ * swap_evict - 换出一个冷的用户页，返回腾出的页框
+ *
+ * @return: 页框的物理地址，它在所属内存池中仍记为已分配，由调用者直接使用；交换区已满、没有可换出的页或硬盘出错时返回 0
+ *
+ * 时钟指针最多转过三圈：起点可能在一圈的中途，第一整圈清掉访问位，第二整圈必能找到冷页（只要有可换出的页）。
+ * 调用者需关中断且在线程上下文中：拿 swap_lock 可能阻塞，写盘期间会临时开中断。
+ */
+uint32_t swap_evict(void)
+{
+    ASSERT(intr_get_status() == INTR_OFF);
+    if (swap_slots.bits == NULL)
+    {
+        return 0; // swap_init 之前不换页
+    }
+    lock_acquire(&swap_lock);
+    uint64_t start = rdtsc();
+    swap_stat.evict_calls++;
+
+    uint32_t frame = 0;
+    int slot = bitmap_scan(&swap_slots, 1);
+    uint32_t laps = 0;
+    while (slot != -1 && frame == 0 && laps < 3)
+    {
+        struct task_struct *task = swap_next_task(hand_pid);
+        if (task == NULL)
+        {
+            laps++;
+            hand_pid = 0;
+            hand_vpn = 0;
+            if (swap_next_task(0) == NULL)
+            {
+                break; // 没有用户进程
+            }
+            continue;
+        }
+        if (task->pid != hand_pid)
+        {
+            hand_pid = task->pid;
+            hand_vpn = 0;
+        }
+        if (!swap_scan_task(task, slot, &frame))
+        {
+            break;
+        }
+        if (frame == 0)
+        {
+            hand_pid = task->pid + 1;
+            hand_vpn = 0;
+        }
+    }
+
+    if (frame == 0)
+    {
+        swap_stat.evict_fails++;
+    }
+    swap_stat.scan_cycles += rdtsc() - start;
+    lock_release(&swap_lock);
+    return frame;
+}
+
+/**
+ * swap_in - 把换出的页 page_vaddr 读回到页框 pg_phy_addr，并恢复页表项
+ *
+ * @return: 读交换区出错时返回 false，页表项保持不变；等锁期间该页的换出因写盘出错而撤销时，页表项已恢复原样，
+ *          同样返回 true，但没有用到 pg_phy_addr，由调用者比较页表项后归还
+ *
+ * 在缺页异常中调用，此时已关中断。
+ */
+bool swap_in(uint32_t page_vaddr, uint32_t pg_phy_addr)
+{
+    uint32_t *pte = pte_ptr(page_vaddr);
+    lock_acquire(&swap_lock); // 该页可能正在被别的线程换出，等它写完盘
+    if ((*pte & (PG_P_1 | PG_SWAP)) != PG_SWAP)
+    {
+        lock_release(&swap_lock);
+        return true;
+    }
+    uint32_t slot = *pte >> 12;
+    bool ok = swap_io(slot, pg_phy_addr, false);
+    if (ok)
+    {
+        *pte = pg_phy_addr | (*pte & (PG_US_U | PG_RW_W | PG_COW)) | PG_P_1;
+        bitmap_set(&swap_slots, slot, 0);
+        swap_stat.swap_in++;
+    }
+    lock_release(&swap_lock);
+    return ok;
+}
+
+/**
+ * @brief 释放换出页的页表项 pte 占用的交换槽（解除映射时调用，调用者需关中断）
+ */
+void swap_slot_free(uint32_t pte)
+{
+    ASSERT((pte & (PG_P_1 | PG_SWAP)) == PG_SWAP);
+    bitmap_set(&swap_slots, pte >> 12, 0);
+}
+
+/**
+ * @brief 初始化交换区：申请交换槽位图，保留临时映射窗口（须在 ide_init 之后调用）
+ */
+void swap_init(void)
+{
+    put_str("swap_init start\n");
+    swap_window = (uint32_t)kvaddr_reserve(2);
+    ASSERT(swap_window != 0);
+    lock_init(&swap_lock);
+    swap_slots.btmp_bytes_len = SWAP_SLOT_CNT / 8;
+    swap_slots.summary = NULL;
+    uint8_t *bits = get_kernel_pages(DIV_ROUND_UP(SWAP_SLOT_CNT / 8, PG_SIZE));
+    ASSERT(bits != NULL);
+    enum intr_status old_status = intr_disable();
+    swap_slots.bits = bits;
+    bitmap_init(&swap_slots);
+    intr_set_status(old_status);
+    put_str("swap_init done\n");
+}
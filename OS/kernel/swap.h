@@ -0,0 +1,36 @@
+#ifndef __KERNEL_SWAP_H
+#define __KERNEL_SWAP_H
+
+#include "stdint.h"
+#include "thread.h"
+#include "sync.h"
+
+#define SWAP_LBA_START 32768 // 交换区在硬盘上的起始扇区（16MB 处，内核映像只占最前面的几百个扇区）
+#define SWAP_SLOT_CNT 8192   // 交换槽数，每槽一页，共 32MB（hd60M.img 约 60MB）
+
+/* 换页的统计 */
+struct swap_stat
+{
+    uint32_t swap_out;     // 换出的页数
+    uint32_t swap_in;      // 换入的页数
+    uint32_t evict_calls;  // 用户物理内存池用尽、调用 swap_evict 的次数
+    uint32_t evict_fails;  // 其中没能换出任何页的次数（交换区已满或没有可换出的页）
+    uint32_t scanned;      // 时钟算法检查过的页表项数（只计存在的用户页）
+    uint32_t io_errors;    // 读写交换区出错的次数
+    uint64_t scan_cycles;  // swap_evict 的总耗时（含写盘）
+};
+
+extern struct swap_stat swap_stat;
+extern struct lock swap_lock;
+
+static void *swap_window_map(uint32_t idx, uint32_t pg_phy_addr);
+static void swap_window_unmap(uint32_t idx);
+static bool swap_io(uint32_t slot, uint32_t pg_phy_addr, bool write);
+static struct task_struct *swap_next_task(pid_t pid);
+static bool swap_scan_task(struct task_struct *task, uint32_t slot, uint32_t *frame);
+uint32_t swap_evict(void);
+bool swap_in(uint32_t page_vaddr, uint32_t pg_phy_addr);
+void swap_slot_free(uint32_t pte);
+void swap_init(void);
+
+#endif
@@ -0,0 +1,245 @@
+#include "avl.h"
+#include "debug.h"
+
+/**
+ * @brief 初始化一棵空树，元素的次序由 less 决定
+ */
+void avl_init(struct avl_tree *tree, avl_less *less)
+{
+    tree->root = NULL;
+    tree->less = less;
+}
+
+/**
+ * @brief 返回子树的高度，空树为 0
+ */
+static int32_t avl_height(struct avl_node *node)
+{
+    return node == NULL ? 0 : node->height;
+}
+
+/**
+ * @brief 根据左右子树重新计算结点的高度
+ */
+static void avl_update(struct avl_node *node)
+{
+    int32_t lh = avl_height(node->left);
+    int32_t rh = avl_height(node->right);
+    node->height = (lh > rh ? lh : rh) + 1;
+}
+
+/**
+ * @brief 左旋：node 的右孩子成为子树的新根
+ */
+static struct avl_node *avl_rotate_left(struct avl_node *node)
+{
+    struct avl_node *root = node->right;
+    node->right = root->left;
+    root->left = node;
+    avl_update(node);
+    avl_update(root);
+    return root;
+}
+
+/**
+ * @brief 右旋：node 的左孩子成为子树的新根
+ */
+static struct avl_node *avl_rotate_right(struct avl_node *node)
+{
+    struct avl_node *root = node->left;
+    node->left = root->right;
+    root->right = node;
+    avl_update(node);
+    avl_update(root);
+    return root;
+}
+
+/**
+ * @brief 插入或删除后恢复以 node 为根的子树的平衡（左右子树高度差不超过 1），返回新的子树根
+ */
+static struct avl_node *avl_rebalance(struct avl_node *node)
+{
+    avl_update(node);
+    int32_t balance = avl_height(node->left) - avl_height(node->right);
+    if (balance > 1)
+    {
+        if (avl_height(node->left->left) < avl_height(node->left->right))
+        {
+            node->left = avl_rotate_left(node->left); // LR 型先转成 LL 型
+        }
+        return avl_rotate_right(node);
+    }
+    if (balance < -1)
+    {
+        if (avl_height(node->right->right) < avl_height(node->right->left))
+        {
+            node->right = avl_rotate_right(node->right); // RL 型先转成 RR 型
+        }
+        return avl_rotate_left(node);
+    }
+    return node;
+}
+
+/**
+ * @brief 把 node 插入以 root 为根的子树，返回新的子树根
+ */
+static struct avl_node *avl_insert_at(struct avl_tree *tree, struct avl_node *root, struct avl_node *node)
+{
+    if (root == NULL)
+    {
+        node->left = node->right = NULL;
+        node->height = 1;
+        return node;
+    }
+    if (tree->less(node, root))
+    {
+        root->left = avl_insert_at(tree, root->left, node);
+    }
+    else
+    {
+        ASSERT(tree->less(root, node)); // 键不能重复
+        root->right = avl_insert_at(tree, root->right, node);
+    }
+    return avl_rebalance(root);
+}
+
+/**
+ * @brief 把元素结点 node 插入树中，O(log n)
+ */
+void avl_insert(struct avl_tree *tree, struct avl_node *node)
+{
+    tree->root = avl_insert_at(tree, tree->root, node);
+}
+
+/**
+ * @brief 从以 root 为根的子树中摘下键最小的结点存入 *min，返回新的子树根
+ */
+static struct avl_node *avl_remove_min(struct avl_node *root, struct avl_node **min)
+{
+    if (root->left == NULL)
+    {
+        *min = root;
+        return root->right;
+    }
+    root->left = avl_remove_min(root->left, min);
+    return avl_rebalance(root);
+}
+
+/**
+ * @brief 从以 root 为根的子树中删除 node，返回新的子树根
+ */
+static struct avl_node *avl_remove_at(struct avl_tree *tree, struct avl_node *root, struct avl_node *node)
+{
+    ASSERT(root != NULL); // node 必须在树中
+    if (root == node)
+    {
+        if (root->left == NULL || root->right == NULL)
+        {
+            return root->left != NULL ? root->left : root->right;
+        }
+        /* 有两个孩子时，用右子树中键最小的结点顶替 node 的位置 */
+        struct avl_node *min;
+        struct avl_node *right = avl_remove_min(root->right, &min);
+        min->left = root->left;
+        min->right = right;
+        return avl_rebalance(min);
+    }
+    if (tree->less(node, root))
+    {
+        root->left = avl_remove_at(tree, root->left, node);
+    }
+    else
+    {
+        root->right = avl_remove_at(tree, root->right, node);
+    }
+    return avl_rebalance(root);
+}
+
+/**
+ * @brief 从树中删除元素结点 node（node 必须在树中），O(log n)
+ */
+void avl_remove(struct avl_tree *tree, struct avl_node *node)
+{
+    tree->root = avl_remove_at(tree, tree->root, node);
+}
+
+/**
+ * @brief 返回键最小的结点，空树返回 NULL
+ */
+struct avl_node *avl_first(struct avl_tree *tree)
+{
+    struct avl_node *node = tree->root;
+    while (node != NULL && node->left != NULL)
+    {
+        node = node->left;
+    }
+    return node;
+}
+
+/**
+ * @brief 返回第一个键不小于 key 的结点，没有时返回 NULL
+ *
+ * key 只用来比较，可以是调用者临时构造、不在树中的结点。
+ */
+struct avl_node *avl_lower_bound(struct avl_tree *tree, struct avl_node *key)
+{
+    struct avl_node *node = tree->root;
+    struct avl_node *found = NULL;
+    while (node != NULL)
+    {
+        if (tree->less(node, key))
+        {
+            node = node->right;
+        }
+        else
+        {
+            found = node;
+            node = node->left;
+        }
+    }
+    return found;
+}
+
+/**
+ * @brief 返回第一个键大于 key 的结点，没有时返回 NULL（key 在树中时即为它的后继）
+ */
+struct avl_node *avl_upper_bound(struct avl_tree *tree, struct avl_node *key)
+{
+    struct avl_node *node = tree->root;
+    struct avl_node *found = NULL;
+    while (node != NULL)
+    {
+        if (tree->less(key, node))
+        {
+            found = node;
+            node = node->left;
+        }
+        else
+        {
+            node = node->right;
+        }
+    }
+    return found;
+}
+
+/**
+ * @brief 返回最后一个键小于 key 的结点，没有时返回 NULL（key 在树中时即为它的前驱）
+ */
+struct avl_node *avl_prev(struct avl_tree *tree, struct avl_node *key)
+{
+    struct avl_node *node = tree->root;
+    struct avl_node *found = NULL;
+    while (node != NULL)
+    {
+        if (tree->less(node, key))
+        {
+            found = node;
+            node = node->right;
+        }
+        else
+        {
+            node = node->left;
+        }
+    }
+    return found;
+}
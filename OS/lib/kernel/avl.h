@@ -0,0 +1,44 @@
+#ifndef __LIB_KERNEL_AVL_H
+#define __LIB_KERNEL_AVL_H
+#include "global.h"
+#include "stdint.h"
+#include "list.h"
+
+/*********************  侵入式 AVL 树  ***********************
+ * 与链表一样，结点 avl_node 嵌入在实际元素项中，用 elem2entry 取回元素项；
+ * 元素之间的次序由建树时给定的 less 回调决定，树中各元素的键必须互不相同。
+ * 树本身不加锁，由使用者负责互斥（例如关中断）。
+ *************************************************************/
+struct avl_node
+{
+    struct avl_node *left;  // 左子树（键更小的元素）
+    struct avl_node *right; // 右子树（键更大的元素）
+    int32_t height;         // 以此结点为根的子树高度，叶子为 1
+};
+
+/* 比较函数类型：a 的键小于 b 的键时返回非 0 */
+typedef int(avl_less)(struct avl_node *a, struct avl_node *b);
+
+struct avl_tree
+{
+    struct avl_node *root;
+    avl_less *less;
+};
+
+void avl_init(struct avl_tree *tree, avl_less *less);
+void avl_insert(struct avl_tree *tree, struct avl_node *node);
+void avl_remove(struct avl_tree *tree, struct avl_node *node);
+struct avl_node *avl_first(struct avl_tree *tree);
+struct avl_node *avl_lower_bound(struct avl_tree *tree, struct avl_node *key);
+struct avl_node *avl_upper_bound(struct avl_tree *tree, struct avl_node *key);
+struct avl_node *avl_prev(struct avl_tree *tree, struct avl_node *key);
+static int32_t avl_height(struct avl_node *node);
+static void avl_update(struct avl_node *node);
+static struct avl_node *avl_rotate_left(struct avl_node *node);
+static struct avl_node *avl_rotate_right(struct avl_node *node);
+static struct avl_node *avl_rebalance(struct avl_node *node);
+static struct avl_node *avl_insert_at(struct avl_tree *tree, struct avl_node *root, struct avl_node *node);
+static struct avl_node *avl_remove_min(struct avl_node *root, struct avl_node **min);
+static struct avl_node *avl_remove_at(struct avl_tree *tree, struct avl_node *root, struct avl_node *node);
+
+#endif
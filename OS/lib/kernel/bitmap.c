@@ -5,16 +5,190 @@
 #include "interrupt.h"
 #include "debug.h"
 
+/* 摘要索引一级所占的 32 位字数（每个位图字对应 1 位） */
+#define SUMMARY_WORDS(btmp) ((BITMAP_WORDS(btmp) + 31) / 32)
+/* 第一级摘要 "有空闲位" 与第二级摘要 "全部空闲" 的起始地址 */
+#define SUMMARY_FREE(btmp) ((btmp)->summary)
+#define SUMMARY_FULL(btmp) ((btmp)->summary + SUMMARY_WORDS(btmp))
+
+/**
+ * @brief 返回 value 中最低的为 1 的位的下标（bsf 指令）
+ *
+ * @param value 待查找的值，调用者须保证不为 0（为 0 时 bsf 的结果未定义）
+ * @return uint32_t 最低的 1 所在的位下标
+ */
+static inline uint32_t bitmap_bsf(uint32_t value)
+{
+    uint32_t idx;
+    asm("bsfl %1, %0" : "=r"(idx) : "rm"(value));
+    return idx;
+}
+
+/**
+ * @brief 以 32 位字为单位读取位图的第 word_idx 个字
+ *
+ * 位图的字节长度不一定是 4 的倍数，最后一个字不足 4 字节的部分按 "已占用"（全 1）补齐，
+ * 这样扫描时就不会越过位图的末尾。
+ *
+ * @param btmp 指向位图结构的指针
+ * @param word_idx 字的下标
+ * @return uint32_t 读取到的 32 位字（第 i 位对应位图中第 word_idx * 32 + i 位）
+ */
+static uint32_t bitmap_word(struct bitmap *btmp, uint32_t word_idx)
+{
+    uint32_t byte_idx = word_idx * 4;
+    if (byte_idx + 4 <= btmp->btmp_bytes_len)
+    {
+        return *(uint32_t *)(btmp->bits + byte_idx); // x86 是小端序，字内第 i 位恰好对应位图的第 byte_idx * 8 + i 位
+    }
+
+    uint32_t word = 0xffffffff;
+    uint32_t i = 0;
+    while (byte_idx + i < btmp->btmp_bytes_len)
+    {
+        word &= ~(0xff << (i * 8));
+        word |= (uint32_t)btmp->bits[byte_idx + i] << (i * 8);
+        i++;
+    }
+    return word;
+}
+
+/**
+ * @brief 根据位图第 word_idx 个字的当前内容刷新两级摘要中对应的位
+ *
+ * @param btmp 指向位图结构的指针
+ * @param word_idx 发生变化的字的下标
+ */
+static void bitmap_summary_update(struct bitmap *btmp, uint32_t word_idx)
+{
+    if (btmp->summary == NULL)
+    {
+        return;
+    }
+    uint32_t word = bitmap_word(btmp, word_idx);
+    uint32_t mask = BITMAP_MASK << (word_idx % 32);
+    uint32_t *free_map = SUMMARY_FREE(btmp);
+    uint32_t *full_map = SUMMARY_FULL(btmp);
+
+    if (word != 0xffffffff)
+    {
+        free_map[word_idx / 32] |= mask; // 字内还有空闲位
+    }
+    else
+    {
+        free_map[word_idx / 32] &= ~mask;
+    }
+
+    if (word == 0)
+    {
+        full_map[word_idx / 32] |= mask; // 整个字都空闲
+    }
+    else
+    {
+        full_map[word_idx / 32] &= ~mask;
+    }
+}
+
+/**
+ * @brief 在摘要的某一级中，从第 from 位开始查找第一个值为 want 的位
+ *
+ * @param map 摘要某一级的起始地址
+ * @param nwords 位图的字数（摘要的有效位数）
+ * @param from 开始查找的位下标
+ * @param want 要查找的位值（1 或 0）
+ * @return uint32_t 找到的位下标，找不到时返回 nwords
+ */
+static uint32_t summary_find(uint32_t *map, uint32_t nwords, uint32_t from, bool want)
+{
+    while (from < nwords)
+    {
+        uint32_t value = want ? map[from / 32] : ~map[from / 32];
+        value &= 0xffffffff << (from % 32); // 屏蔽掉 from 之前的位
+        if (value != 0)
+        {
+            uint32_t idx = (from & ~31) + bitmap_bsf(value);
+            return idx < nwords ? idx : nwords;
+        }
+        from = (from & ~31) + 32;
+    }
+    return nwords;
+}
+
+/**
+ * @brief 从第 from 个字开始，查找第一个含有空闲位的字
+ *
+ * 有摘要时借助第一级摘要跳过整字已满的区域，否则逐字比较。
+ *
+ * @return uint32_t 字的下标，找不到时返回位图的字数
+ */
+static uint32_t bitmap_next_free_word(struct bitmap *btmp, uint32_t from)
+{
+    uint32_t nwords = BITMAP_WORDS(btmp);
+    if (btmp->summary != NULL)
+    {
+        return summary_find(SUMMARY_FREE(btmp), nwords, from, true);
+    }
+    while (from < nwords && bitmap_word(btmp, from) == 0xffffffff)
+    {
+        from++;
+    }
+    return from;
+}
+
+/**
+ * @brief 从第 from 个字开始，查找第一个不是 "整字空闲" 的字
+ *
+ * 用于在连续的全空闲字上一次性跨过，有摘要时借助第二级摘要完成。
+ *
+ * @return uint32_t 字的下标，找不到时返回位图的字数
+ */
+static uint32_t bitmap_next_used_word(struct bitmap *btmp, uint32_t from)
+{
+    uint32_t nwords = BITMAP_WORDS(btmp);
+    if (btmp->summary != NULL)
+    {
+        return summary_find(SUMMARY_FULL(btmp), nwords, from, false);
+    }
+    while (from < nwords && bitmap_word(btmp, from) == 0)
+    {
+        from++;
+    }
+    return from;
+}
+
+/**
+ * @brief 计算长度为 btmp_bytes_len 字节的位图所需的两级摘要的字节数
+ *
+ * @param btmp_bytes_len 位图的字节长度
+ * @return uint32_t 两级摘要共占用的字节数（4 字节对齐）
+ */
+uint32_t bitmap_summary_bytes(uint32_t btmp_bytes_len)
+{
+    uint32_t words = (btmp_bytes_len + 3) / 4;
+    return ((words + 31) / 32) * 4 * 2;
+}
+
 /**
  * @brief 将位图 btmp 初始化
  *
  * 该函数负责初始化位图 btmp 的所有位，将它们全部设置为 0。
+ * 若位图挂接了摘要索引，同时按 "全部空闲" 建立两级摘要。
  *
  * @param struct bitmap* btmp 指向需要初始化的位图结构的指针
  */
 void bitmap_init(struct bitmap *btmp)
 {
     memset(btmp->bits, 0, btmp->btmp_bytes_len);
+    if (btmp->summary != NULL)
+    {
+        uint32_t nwords = BITMAP_WORDS(btmp);
+        memset(btmp->summary, 0, bitmap_summary_bytes(btmp->btmp_bytes_len));
+        uint32_t word_idx;
+        for (word_idx = 0; word_idx < nwords; word_idx++)
+        {
+            bitmap_summary_update(btmp, word_idx);
+        }
+    }
 }
 
 /**
@@ -34,77 +208,205 @@ bool bitmap_scan_test(struct bitmap *btmp, uint32_t bit_idx)
     return (btmp->bits[byte_idx] & (BITMAP_MASK << bit_odd));
 }
 
+/**
+ * @brief 在 [from, end) 范围内查找第一个已占用的位
+ *
+ * 逐字检查，整字空闲的区域借助第二级摘要一次跨过。
+ *
+ * @return uint32_t 已占用位的下标，范围内全部空闲时返回 end
+ */
+static uint32_t bitmap_find_used(struct bitmap *btmp, uint32_t from, uint32_t end)
+{
+    while (from < end)
+    {
+        uint32_t word_idx = from / 32;
+        uint32_t word = bitmap_word(btmp, word_idx) & (0xffffffff << (from % 32)); // 屏蔽掉 from 之前的位
+        if (word != 0)
+        {
+            uint32_t pos = word_idx * 32 + bitmap_bsf(word);
+            return pos < end ? pos : end;
+        }
+        from = bitmap_next_used_word(btmp, word_idx + 1) * 32;
+    }
+    return end;
+}
+
 /**
  * @brief 在位图中申请连续的空闲位
  *
  * 该函数负责在位图中寻找连续的 cnt 个空闲位，并返回其起始位的下标。
  *
+ * 位图以 32 位字为单位扫描：
+ *  ① cnt 为 1 时，借助第一级摘要定位第一个含空闲位的字，再用 bsf 取出字内第一个空闲位
+ *  ② cnt 大于 1 时，整字已满的区域借助第一级摘要跳过，整字空闲的区域借助第二级摘要一次跨过，
+ *     只有部分占用的字才在字内用 bsf 按 "空闲段 / 占用段" 跳跃
+ *
  * @param struct bitmap* btmp 指向位图结构的指针
  * @param uint32_t cnt 需要申请的连续位的数量
 
- * @return int 找到的连续位起始下标，若失败则返回 -1
+ * @return int 找到的连续位起始下标，若失败（包括位图已满）则返回 -1
  */
 int bitmap_scan(struct bitmap *btmp, uint32_t cnt)
 {
-    uint32_t idx_byte = 0; // 用于记录空闲位所在的字节索引
-    // 寻找第一个不为 0xff 的字节（字节的值不为 0xff，说明该字节里面至少有一个 0）
-    while ((0xFF == btmp->bits[idx_byte]) && (idx_byte < btmp->btmp_bytes_len))
-    {
-        // 表示该字节已分配，若为 0xff，则表示该字节内已无空闲位，向下一个字节继续找
-        idx_byte++;
-    }
-
-    ASSERT(idx_byte < btmp->btmp_bytes_len);
-
-    if (idx_byte == btmp->btmp_bytes_len) // 如果没有找到空闲字节（该字节数组找不到可用空间），返回 -1
+    uint32_t nwords = BITMAP_WORDS(btmp);
+    if (cnt == 0 || cnt > btmp->btmp_bytes_len * 8)
     {
         return -1;
     }
 
-    // 若在位图数组范围内的某字节内找到空闲位
-    // 在该字节内逐位扫描，记录字节内第一个空闲位的下标
-    int idx_bit = 0;
-    // 和 btmp->bits[idx_byte] 这个字节逐位对比（查找字节内的空闲位）
-    while ((uint8_t)(BITMAP_MASK << idx_bit) & btmp->bits[idx_byte])
+    uint32_t word_idx = bitmap_next_free_word(btmp, 0); // 第一个含空闲位的字
+    if (word_idx == nwords)
     {
-        idx_bit++;
+        return -1; // 位图已满
     }
 
-    uint32_t bit_idx_start = idx_byte * 8 + idx_bit; // 将字节内位索引转换为整个位图的位索引
-
-    // 若只需要 1 个空闲位，直接返回
+    // 若只需要 1 个空闲位，直接取出字内第一个 0 所在的位
     if (cnt == 1)
     {
-        return bit_idx_start;
+        return word_idx * 32 + bitmap_bsf(~bitmap_word(btmp, word_idx));
     }
 
-    uint32_t bit_left = (btmp->btmp_bytes_len * 8 - bit_idx_start - 1); // 记录还有多少位可以判断
-    uint32_t next_bit = bit_idx_start + 1;                              // 记录下一个待查找的位
-    uint32_t count = 1;                                                 // 记录找到的空闲位的个数
-
-    bit_idx_start = -1; // 先将其置为 -1，若找不到连续的位就直接返回
-
-    while (bit_left-- > 0)
+    uint32_t count = 0;         // 记录当前连续空闲位的个数
+    uint32_t bit_idx_start = 0; // 记录当前连续空闲位的起始下标
+    while (word_idx < nwords)
     {
-        if (!(bitmap_scan_test(btmp, next_bit))) // 判断下一个待查找的 next_bit 位是否为 0
+        uint32_t word = bitmap_word(btmp, word_idx);
+        if (word == 0)
         {
-            count++; // 找到空闲位，计数加 1
+            // 整字空闲，一次跨过后面所有连续的全空闲字
+            uint32_t end = bitmap_next_used_word(btmp, word_idx);
+            if (count == 0)
+            {
+                bit_idx_start = word_idx * 32;
+            }
+            count += (end - word_idx) * 32;
+            if (count >= cnt)
+            {
+                return bit_idx_start;
+            }
+            word_idx = end;
+            continue;
         }
-        else
+
+        if (word == 0xffffffff)
         {
-            count = 0; // 如果遇到占用的位，重新计数
+            // 整字已满，连续计数中断，直接跳到下一个含空闲位的字
+            count = 0;
+            word_idx = bitmap_next_free_word(btmp, word_idx + 1);
+            continue;
         }
 
-        if (count == cnt) // 若找到连续 cnt 个空闲位
+        // 字内部分占用，按 "空闲段 / 占用段" 跳跃
+        uint32_t pos = 0;
+        while (pos < 32)
         {
-            bit_idx_start = next_bit - cnt + 1; // 连续 cnt 个空闲位的起始下标
-            break;
+            uint32_t rest = word >> pos; // 右移后高位补 0，但只有 rest 为 0 时才会用到这些位
+            uint32_t len;
+            if (!(rest & BITMAP_MASK))
+            {
+                len = rest ? bitmap_bsf(rest) : 32 - pos; // 空闲段的长度
+                if (count == 0)
+                {
+                    bit_idx_start = word_idx * 32 + pos;
+                }
+                count += len;
+                if (count >= cnt)
+                {
+                    return bit_idx_start;
+                }
+            }
+            else
+            {
+                len = bitmap_bsf(~rest); // 占用段的长度（~rest 的高位为 1，最多到字的末尾）
+                count = 0;
+            }
+            pos += len;
         }
+        word_idx++;
+    }
+
+    return -1;
+}
 
-        next_bit++;
+/**
+ * @brief 在 [bit_start, bit_end) 范围内查找第一个空闲位
+ *
+ * 借助第一级摘要跳过整字已满的区域，再用 bsf 取出字内第一个空闲位。
+ *
+ * @param struct bitmap* btmp 指向位图结构的指针
+ * @param uint32_t bit_start 范围的起始位下标
+ * @param uint32_t bit_end 范围的结束位下标（不含），超出位图时按位图末尾处理
+ * @return int 找到的空闲位下标，范围内没有空闲位时返回 -1
+ */
+int bitmap_scan_range(struct bitmap *btmp, uint32_t bit_start, uint32_t bit_end)
+{
+    uint32_t total = btmp->btmp_bytes_len * 8;
+    if (bit_end > total)
+    {
+        bit_end = total;
+    }
+    uint32_t idx = bit_start;
+    while (idx < bit_end)
+    {
+        uint32_t word_idx = idx / 32;
+        uint32_t word = ~bitmap_word(btmp, word_idx) & (0xffffffff << (idx % 32)); // 取反后 1 即空闲位，并屏蔽掉 idx 之前的位
+        if (word != 0)
+        {
+            uint32_t pos = word_idx * 32 + bitmap_bsf(word);
+            return pos < bit_end ? (int)pos : -1;
+        }
+        idx = bitmap_next_free_word(btmp, word_idx + 1) * 32;
     }
+    return -1;
+}
 
-    return bit_idx_start;
+/**
+ * @brief 返回从 bit_idx 开始、到 bit_end 为止的连续空闲位的个数
+ *
+ * @param struct bitmap* btmp 指向位图结构的指针
+ * @param uint32_t bit_idx 空闲段的起始位下标
+ * @param uint32_t bit_end 统计的结束位下标（不含），超出位图时按位图末尾处理
+ * @return uint32_t 连续空闲位的个数，bit_idx 已被占用时为 0
+ */
+uint32_t bitmap_free_run(struct bitmap *btmp, uint32_t bit_idx, uint32_t bit_end)
+{
+    uint32_t total = btmp->btmp_bytes_len * 8;
+    if (bit_end > total)
+    {
+        bit_end = total;
+    }
+    return bit_idx < bit_end ? bitmap_find_used(btmp, bit_idx, bit_end) - bit_idx : 0;
+}
+
+/**
+ * @brief 在位图中申请按 align 对齐的连续空闲位
+ *
+ * 查找满足 bit_idx % align == offset 的连续 cnt 个空闲位。用于分配虚拟地址需要按大页对齐的场合，
+ * 此时 offset 用来抵消地址池起始地址本身相对于对齐边界的偏移。
+ * 候选起点上遇到已占用的位时，直接跳到该位之后的下一个对齐位置。
+ *
+ * @param struct bitmap* btmp 指向位图结构的指针
+ * @param uint32_t cnt 需要申请的连续位的数量
+ * @param uint32_t align 起始下标的对齐粒度（位数）
+ * @param uint32_t offset 起始下标对 align 取模后应得的余数
+ * @return int 找到的连续位起始下标，失败返回 -1
+ */
+int bitmap_scan_align(struct bitmap *btmp, uint32_t cnt, uint32_t align, uint32_t offset)
+{
+    ASSERT(align > 0);
+    uint32_t total = btmp->btmp_bytes_len * 8;
+    uint32_t bit_idx_start = offset % align;
+    while (cnt > 0 && bit_idx_start + cnt <= total)
+    {
+        uint32_t used = bitmap_find_used(btmp, bit_idx_start, bit_idx_start + cnt);
+        if (used == bit_idx_start + cnt)
+        {
+            return bit_idx_start;
+        }
+        // 起点在 used 之前的候选都会覆盖到 used，跳到 used 之后的第一个对齐位置
+        bit_idx_start += ((used - bit_idx_start) / align + 1) * align;
+    }
+    return -1;
 }
 
 /**
@@ -132,4 +434,53 @@ void bitmap_set(struct bitmap *btmp, uint32_t bit_idx, int8_t value)
     {
         btmp->bits[byte_idx] &= ~(BITMAP_MASK << bit_odd);
     }
+    bitmap_summary_update(btmp, bit_idx / 32);
+}
+
+/**
+ * @brief 将位图中从 bit_idx 开始的连续 cnt 位设置为 value
+ *
+ * 首尾不足一个字的部分逐位设置，中间完整的字整字写入，最后统一刷新涉及到的摘要位，
+ * 用于代替 "循环调用 bitmap_set" 的多页申请与释放。
+ *
+ * @param btmp 指向位图结构的指针
+ * @param bit_idx 起始位索引
+ * @param cnt 要设置的位数
+ * @param value 要设置的值（0 或 1）
+ */
+void bitmap_set_range(struct bitmap *btmp, uint32_t bit_idx, uint32_t cnt, int8_t value)
+{
+    ASSERT((value == 0) || (value == 1));
+    ASSERT(bit_idx + cnt <= btmp->btmp_bytes_len * 8);
+    if (cnt == 0)
+    {
+        return;
+    }
+
+    uint32_t idx = bit_idx;
+    uint32_t end = bit_idx + cnt;
+    while (idx < end)
+    {
+        if (idx % 32 == 0 && idx + 32 <= end)
+        {
+            *(uint32_t *)(btmp->bits + idx / 8) = value ? 0xffffffff : 0; // 整字写入
+            idx += 32;
+            continue;
+        }
+        if (value)
+        {
+            btmp->bits[idx / 8] |= (BITMAP_MASK << (idx % 8));
+        }
+        else
+        {
+            btmp->bits[idx / 8] &= ~(BITMAP_MASK << (idx % 8));
+        }
+        idx++;
+    }
+
+    uint32_t word_idx;
+    for (word_idx = bit_idx / 32; word_idx <= (end - 1) / 32; word_idx++)
+    {
+        bitmap_summary_update(btmp, word_idx);
+    }
 }
@@ -7,16 +7,33 @@ typedef int bool;
 #define true 1
 #define false 0
 
+/* 位图按 32 位字组织时的字数（最后一个字可能不满 4 字节） */
+#define BITMAP_WORDS(btmp) (((btmp)->btmp_bytes_len + 3) / 4)
+
 struct bitmap
 {
     uint32_t btmp_bytes_len; // 位图的字节长度
     // 在遍历位图时，整体上以字节为单位，细节上是以为为单位，所以此处位图的指针必须是单字节
     uint8_t *bits; // 位图的指针
+
+    /**
+     * 两级摘要索引（可选，为 NULL 时 bitmap_scan 退化为逐字扫描）
+     * 摘要按位图的 32 位字建立，每个字对应摘要中的 1 位，共两级，连续存放在 summary 指向的内存中：
+     *  ① 第一级 "有空闲位"：第 w 位为 1 表示位图第 w 个字中至少有一个 0
+     *  ② 第二级 "全部空闲"：第 w 位为 1 表示位图第 w 个字全部为 0
+     * 摘要所需的字节数由 bitmap_summary_bytes 计算，由使用者分配好内存后在 bitmap_init 之前赋值
+     */
+    uint32_t *summary;
 };
 
 void bitmap_init(struct bitmap *btmp);
+uint32_t bitmap_summary_bytes(uint32_t btmp_bytes_len);
 bool bitmap_scan_test(struct bitmap *btmp, uint32_t bit_idx);
 int bitmap_scan(struct bitmap *btmp, uint32_t cnt);
+int bitmap_scan_range(struct bitmap *btmp, uint32_t bit_start, uint32_t bit_end);
+uint32_t bitmap_free_run(struct bitmap *btmp, uint32_t bit_idx, uint32_t bit_end);
+int bitmap_scan_align(struct bitmap *btmp, uint32_t cnt, uint32_t align, uint32_t offset);
 void bitmap_set(struct bitmap *btmp, uint32_t bit_idx, int8_t value);
+void bitmap_set_range(struct bitmap *btmp, uint32_t bit_idx, uint32_t cnt, int8_t value);
 
-#endif
\ No newline at end of file
+#endif
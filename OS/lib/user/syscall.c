@@ -0,0 +1,162 @@
+#include "syscall.h"
+#include "fork.h"
+
+/**
+ * 系统调用的用户态接口：子功能号放在 eax 中，参数依次放在 ebx、ecx、edx 中，通过 int 0x80 进入内核，
+ * 内核中 syscall_handler 把返回值写回中断栈中的 eax，因此 int 0x80 之后 eax 即为返回值。
+ */
+
+/* 无参数的系统调用 */
+#define _syscall0(NUMBER) ({ \
+    int retval;              \
+    asm volatile(            \
+        "int $0x80"          \
+        : "=a"(retval)       \
+        : "a"(NUMBER)        \
+        : "memory");         \
+    retval;                  \
+})
+
+/* 一个参数的系统调用 */
+#define _syscall1(NUMBER, ARG1) ({ \
+    int retval;                    \
+    asm volatile(                  \
+        "int $0x80"                \
+        : "=a"(retval)             \
+        : "a"(NUMBER), "b"(ARG1)   \
+        : "memory");               \
+    retval;                        \
+})
+
+/* 两个参数的系统调用 */
+#define _syscall2(NUMBER, ARG1, ARG2) ({     \
+    int retval;                              \
+    asm volatile(                            \
+        "int $0x80"                          \
+        : "=a"(retval)                       \
+        : "a"(NUMBER), "b"(ARG1), "c"(ARG2)  \
+        : "memory");                         \
+    retval;                                  \
+})
+
+/* 三个参数的系统调用 */
+#define _syscall3(NUMBER, ARG1, ARG2, ARG3) ({         \
+    int retval;                                        \
+    asm volatile(                                      \
+        "int $0x80"                                    \
+        : "=a"(retval)                                 \
+        : "a"(NUMBER), "b"(ARG1), "c"(ARG2), "d"(ARG3) \
+        : "memory");                                   \
+    retval;                                            \
+})
+
+/**
+ * 经由 sysenter 的快速系统调用：参数寄存器与 int 0x80 相同，另外把 ebp 压入用户栈、用 ebp 传递用户栈指针，用 esi 传递返回地址，
+ * 内核在 sysenter_entry 中据此用 sysexit 返回到标号 1 处，此时 esp 指向压入的 ebp。
+ * ecx、edx 会被 sysexit 用掉，esi 被用来传递返回地址，作为输出列出以告知编译器它们被破坏。
+ */
+#define _sysenter(NUMBER, ARG1, ARG2, ARG3) ({                          \
+    int retval, clobber_c, clobber_d, clobber_S;                        \
+    asm volatile(                                                       \
+        "pushl %%ebp\n\t"                                               \
+        "movl $1f, %%esi\n\t"                                           \
+        "movl %%esp, %%ebp\n\t"                                         \
+        "sysenter\n"                                                    \
+        "1:\n\t"                                                        \
+        "popl %%ebp"                                                    \
+        : "=a"(retval), "=c"(clobber_c), "=d"(clobber_d), "=S"(clobber_S) \
+        : "a"(NUMBER), "b"(ARG1), "1"(ARG2), "2"(ARG3)                  \
+        : "memory");                                                    \
+    retval;                                                             \
+})
+
+/**
+ * @brief 返回当前任务的 pid
+ */
+uint32_t getpid(void)
+{
+    return USER_INFO->sysenter_enabled ? getpid_sysenter() : getpid_int80();
+}
+
+/**
+ * @brief 经由 int 0x80 的 getpid（syscall_bench 用它与 sysenter 路径对比）
+ */
+uint32_t getpid_int80(void)
+{
+    return _syscall0(SYS_GETPID);
+}
+
+/**
+ * @brief 经由 sysenter 的 getpid，只能在 sysenter_enabled 为真时调用
+ */
+uint32_t getpid_sysenter(void)
+{
+    return _sysenter(SYS_GETPID, 0, 0, 0);
+}
+
+/**
+ * @brief 打印字符串 str，返回打印的字符数，str 不可访问或过长时返回 -1
+ */
+int32_t write(char *str)
+{
+    if (USER_INFO->sysenter_enabled)
+    {
+        return _sysenter(SYS_WRITE, str, 0, 0);
+    }
+    return _syscall1(SYS_WRITE, str);
+}
+
+/**
+ * @brief 从用户堆中申请 size 字节的内存
+ */
+void *malloc(uint32_t size)
+{
+    if (USER_INFO->sysenter_enabled)
+    {
+        return (void *)_sysenter(SYS_MALLOC, size, 0, 0);
+    }
+    return (void *)_syscall1(SYS_MALLOC, size);
+}
+
+/**
+ * @brief 释放 malloc 申请的内存 ptr
+ */
+void free(void *ptr)
+{
+    if (USER_INFO->sysenter_enabled)
+    {
+        _sysenter(SYS_FREE, ptr, 0, 0);
+        return;
+    }
+    _syscall1(SYS_FREE, ptr);
+}
+
+/**
+ * @brief 复制当前进程（写时复制），父进程返回子进程的 pid，子进程返回 0，失败返回 -1
+ *
+ * 子进程要沿用进入内核时中断栈中的用户态上下文，所以总是经由 int 0x80。
+ */
+pid_t fork(void)
+{
+    return _syscall1(SYS_FORK, 0);
+}
+
+/**
+ * @brief 立即复制全部用户页的 fork（fork_bench 用它与写时复制对比）
+ */
+pid_t fork_eager(void)
+{
+    return _syscall1(SYS_FORK, FORK_EAGER);
+}
+
+/**
+ * @brief 结束当前进程，不返回（还没有 wait，status 暂不使用）
+ */
+void exit(int32_t status)
+{
+    if (USER_INFO->sysenter_enabled)
+    {
+        _sysenter(SYS_EXIT, status, 0, 0);
+    }
+    _syscall1(SYS_EXIT, status);
+}
@@ -0,0 +1,28 @@
+#ifndef __LIB_USER_SYSCALL_H
+#define __LIB_USER_SYSCALL_H
+#include "stdint.h"
+#include "thread.h"
+#include "process.h"
+
+/* 系统调用号，与 syscall_table 中的下标一一对应 */
+enum SYSCALL_NR
+{
+    SYS_GETPID,
+    SYS_WRITE,
+    SYS_MALLOC,
+    SYS_FREE,
+    SYS_FORK,
+    SYS_EXIT
+};
+
+uint32_t getpid(void);
+uint32_t getpid_int80(void);
+uint32_t getpid_sysenter(void);
+int32_t write(char *str);
+void *malloc(uint32_t size);
+void free(void *ptr);
+pid_t fork(void);
+pid_t fork_eager(void);
+void exit(int32_t status);
+
+#endif
@@ -97,6 +97,7 @@ void sema_up(struct semaphore *psema)
     ASSERT(psema->value == 1); // 检查信号量值是否正确
 
     intr_set_status(old_status); // 恢复之前的中断状态
+    thread_preempt();            // 被唤醒的线程级别更高时，开中断后立即让出处理器
 }
 
 /**
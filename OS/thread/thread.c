@@ -7,18 +7,186 @@
 #include "interrupt.h"
 #include "print.h"
 #include "list.h"
+#include "sync.h"
+#include "process.h"
+#include "time.h"
+#include "timer.h"
 
 #define PG_SIZE 4096 // PCB 的大小为 4K
 
 struct task_struct *main_thread;     // ① 主线程的 PCB 指针
                                      // 进入内核后一直执行的是 main 函数，它就是一个线程，后面会将其完善成线程的结构（加入全部线程队列），因此为其提前定义了个 PCB
-struct list thread_ready_list;       // ② 就绪队列（调度器要选择某个线程上处理器的话，必然先将所有线程收集到就绪队列，以后每创建一个线程就将其加到此队列中）
+struct task_struct *idle_thread;     // ② idle 线程的 PCB 指针，就绪队列为空时调度它
 struct list thread_all_list;         // ③ 所有线程的队列（如果线程因为某些原因阻塞，不能放在就绪队列中，需要有个地方能找到它，得知道我们共创建了多少线程）
-static struct list_elem *thread_tag; // ④ 用于保存队列中的线程节点（队列中的节点不是线程的 PCB，而是线程 PCB 中的 tag，即 general_tag 或 all_list_tag）
-                                     // 对线程的管理都是基于线程 PCB 的，因此必须要将 tag 转换成 PCB，在转换过程中需要记录 tag 的值
+
+static struct lock pid_lock;         // ④ 分配 pid 时用的锁
+static struct bitmap pid_pool;       // ⑤ pid 位图，位为 1 表示该 pid 已被占用
+static uint8_t pid_bits[MAX_PID / 8 + 1];
+static pid_t next_pid = 1;           // ⑥ 下一次从这个 pid 开始找空闲的 pid（避免刚释放的 pid 马上被复用）
+
+static struct task_struct *reaper_thread; // ⑦ 回收已退出线程的 reaper 线程
+static struct list reap_list;             // ⑧ 已退出、等待 reaper 回收的线程（经 general_tag 串起）
+
+/******************************  PCB 缓存  **********************************
+ * 线程回收后 PCB 页不归还内存池，而是铺好 "栈魔数 + 线程栈框架"（首次运行时由 switch_to 弹出、ret 到 kernel_thread）后放入缓存；
+ * thread_start 从缓存中取出一页，只需写入名称、pid、优先级、待执行的函数等少数字段，
+ * 省去了分配页框、修改页表、整页清 0 以及 init_thread 中对 PCB 的清 0。
+ * 缓存中的页仍是已映射的内核页，经 general_tag 串在 pcb_cache 上。
+ ******************************************************************************/
+static struct list pcb_cache;     // ⑨ 空闲的 PCB 页
+static uint32_t pcb_cache_cnt = 0;
+
+/****************************  多级就绪队列  ******************************
+ * 调度器要选择某个线程上处理器的话，必然先将所有线程收集到就绪队列，以后每创建一个线程就将其加到就绪队列中。
+ * 就绪队列按优先级分为 PRIO_LEVELS 级，第 0 级最高；bitmap 的第 i 位为 1 表示第 i 级非空，
+ * 调度时用 bsf 找到最低的 1 位即最高的非空级别，取其队首，与就绪线程的个数无关。
+ * 为了不让低优先级的线程饿死，就绪队列有两组：用完时间片的线程进入 expired 组，其余进入 active 组，
+ * active 组取空后两组互换，因此每个就绪线程在一轮中至少运行一个时间片。
+ * 多级反馈：用完整个时间片的线程降一级（最多比基础级别低 MLFQ_DEMOTE_MAX 级），时间片没用完就阻塞的线程升一级（不超过基础级别）；
+ * active 组中出现比当前线程级别更高的线程时，当前线程在下一次时钟中断（或开中断时的唤醒）被抢占。
+ **************************************************************************/
+static struct prio_array prio_arrays[2];
+static struct prio_array *active = &prio_arrays[0];  // 本轮尚未用完时间片的线程
+static struct prio_array *expired = &prio_arrays[1]; // 本轮已用完时间片、等下一轮的线程
 
 extern void switch_to(struct task_struct *cur, struct task_struct *next);
 
+/**
+ * @brief 分配 pid：从 next_pid 起找第一个空闲的 pid，到 MAX_PID 后回到 1 继续找
+ */
+static pid_t allocate_pid(void)
+{
+    lock_acquire(&pid_lock);
+    int pid = bitmap_scan_range(&pid_pool, next_pid, MAX_PID + 1);
+    if (pid == -1)
+    {
+        pid = bitmap_scan_range(&pid_pool, 1, next_pid);
+    }
+    ASSERT(pid != -1);
+    bitmap_set(&pid_pool, pid, 1);
+    next_pid = (pid == MAX_PID) ? 1 : pid + 1;
+    lock_release(&pid_lock);
+    return (pid_t)pid;
+}
+
+/**
+ * @brief 释放 pid，它可以被以后创建的线程复用
+ */
+void release_pid(pid_t pid)
+{
+    ASSERT(pid > 0);
+    lock_acquire(&pid_lock);
+    bitmap_set(&pid_pool, pid, 0);
+    lock_release(&pid_lock);
+}
+
+/**
+ * @brief 为 fork 出的子进程分配 pid（allocate_pid 是静态函数，在此封装一层）
+ */
+pid_t fork_pid(void)
+{
+    return allocate_pid();
+}
+
+/**
+ * @brief 优先级 prio 对应的基础就绪队列级别：priority 越大级别越高（数值越小）
+ */
+static uint8_t prio_base_level(uint8_t prio)
+{
+#if CONFIG_SCHED_FIFO
+    return 0;
+#else
+    return (prio >= PRIO_LEVELS) ? 0 : PRIO_LEVELS - 1 - prio;
+#endif
+}
+
+/**
+ * @brief 把线程 pthread 加入 array 组中其所在级别的就绪队列，front 为 true 时加在队首（调用者需关中断）
+ */
+static void prio_array_add(struct prio_array *array, struct task_struct *pthread, bool front)
+{
+    ASSERT(intr_get_status() == INTR_OFF && pthread->sched_level < PRIO_LEVELS);
+    struct list *queue = &array->queues[pthread->sched_level];
+    ASSERT(!elem_find(queue, &pthread->general_tag));
+    if (front)
+    {
+        list_push(queue, &pthread->general_tag);
+    }
+    else
+    {
+        list_append(queue, &pthread->general_tag);
+    }
+    array->bitmap |= (1 << pthread->sched_level);
+}
+
+/**
+ * @brief 把线程 pthread 加入 active 组的就绪队列（新建、被唤醒或被抢占的线程），front 为 true 时加在队首
+ */
+void ready_enqueue(struct task_struct *pthread, bool front)
+{
+    prio_array_add(active, pthread, front);
+    tick_resume(); // 可运行的线程多了一个，恢复周期时钟以便按时间片轮转和抢占
+}
+
+/**
+ * @brief 取出 active 组中最高非空级别的队首线程，active 组为空时先与 expired 组互换
+ */
+static struct task_struct *ready_dequeue(void)
+{
+    if (active->bitmap == 0)
+    {
+        struct prio_array *tmp = active;
+        active = expired;
+        expired = tmp;
+    }
+    ASSERT(active->bitmap != 0);
+    uint32_t level;
+    asm("bsf %1, %0" : "=r"(level) : "rm"(active->bitmap));
+    struct list *queue = &active->queues[level];
+    struct list_elem *tag = list_pop(queue);
+    if (list_empty(queue))
+    {
+        active->bitmap &= ~(1 << level);
+    }
+    return elem2entry(struct task_struct, general_tag, tag);
+}
+
+/**
+ * @brief 两组就绪队列是否都为空（除正在运行的线程外没有可运行的线程）
+ */
+bool ready_empty(void)
+{
+    return active->bitmap == 0 && expired->bitmap == 0;
+}
+
+/**
+ * @brief active 组中是否有比 cur 级别更高的线程
+ */
+bool ready_preempts(struct task_struct *cur)
+{
+    return (active->bitmap & ((1 << cur->sched_level) - 1)) != 0;
+}
+
+/**
+ * @brief 就绪队列中有比当前线程级别更高的线程时让出处理器
+ *
+ * 只在开中断的线程上下文中生效（中断处理程序运行时 IF 为 0），唤醒高优先级线程后调用，使其不必等到下一次时钟中断。
+ */
+void thread_preempt(void)
+{
+    if (intr_get_status() != INTR_ON)
+    {
+        return;
+    }
+    intr_disable();
+    struct task_struct *cur = running_thread();
+    if (cur->status == TASK_RUNNING && ready_preempts(cur))
+    {
+        schedule();
+    }
+    intr_enable();
+}
+
 /**
  * @brief 返回取当前线程的 PCB 指针
  *
@@ -57,6 +225,7 @@ static void kernel_thread(thread_func *function, void *func_arg)
     /* 执行 function 前要开中断（任务调度的保证）, 避免后续的时钟中断被屏蔽，导致无法调度其他线程 */
     intr_enable();
     function(func_arg); // 执行传入的函数 function，并传递参数 func_arg
+    thread_exit();      // function 返回即线程结束
 }
 
 /**
@@ -118,6 +287,7 @@ void thread_create(struct task_struct *pthread, thread_func function, void *func
 void init_thread(struct task_struct *pthread, char *name, int prio)
 {
     memset(pthread, 0, sizeof(*pthread)); // 将线程所在的线程控制块(PCB)全部清0 ———— 一页
+    pthread->pid = allocate_pid();
     strcpy(pthread->name, name);          // 设置线程名称
     if (pthread == main_thread)           // 判断是否为主线程
     {
@@ -133,12 +303,68 @@ void init_thread(struct task_struct *pthread, char *name, int prio)
     pthread->self_kstack = (uint32_t *)((uint32_t)pthread + PG_SIZE); // 在线程创建之初，设置 0 特权级的内核栈指针（中断栈、线程栈）为 PCB 的最顶端
     pthread->priority = prio;                                         // 设置线程优先级（将来它的作用体现任务（线程和进程的统称）在处理器上执行的时间片长度，即优先级越高，执行的时间片越长）
     pthread->ticks = prio;                                            // 初始化时间片
+    pthread->sched_level = prio_base_level(prio);                     // 从基础级别的就绪队列开始
     pthread->elapsed_ticks = 0;                                       // 线程已经运行的时间片数为 0（表示线程尚未执行过）
     pthread->pgdir = NULL;                                            // 用户线程没有自己的地址空间(没有页表)，因此将线程的页表置为 NULL
     // PCB 的最顶端是 0 特权级栈，将来线程在内核态下的任何操作都是用此 PCB 中的栈，如果出现了某些异常导致入栈操作过多，这会破坏 PCB 低处的线程信息
     // 为此，需要检测这些线程信息是否被破坏了，stack_magic 被安排在线程信息的最边缘，它作为栈的边缘
     // 目前用不到此值，以后再进行线程调度时会检测它
-    pthread->stack_magic = 0x19870916; // 设置内核保护的自定义魔数，用于检测栈溢出（自定义个值就行，这与代码功能无关）
+    pthread->stack_magic = STACK_MAGIC; // 设置内核保护的自定义魔数，用于检测栈溢出（自定义个值就行，这与代码功能无关）
+}
+
+/**
+ * @brief 在 PCB 页中铺好线程首次运行所需的框架：栈魔数、指向线程栈的 self_kstack，以及 eip 为 kernel_thread 的线程栈
+ */
+static void pcb_skeleton(struct task_struct *pthread)
+{
+    pthread->stack_magic = STACK_MAGIC;
+    pthread->self_kstack = (uint32_t *)((uint32_t)pthread + PG_SIZE - sizeof(struct intr_stack) - sizeof(struct thread_stack));
+    struct thread_stack *kthread_stack = (struct thread_stack *)pthread->self_kstack;
+    kthread_stack->eip = kernel_thread;
+    kthread_stack->ebp = kthread_stack->ebx = kthread_stack->edi = kthread_stack->esi = 0;
+}
+
+/**
+ * @brief 取一页铺好框架的 PCB：缓存不空时直接取出，否则从内核内存池申请（已清 0）后铺框架
+ *
+ * @return struct task_struct* 内存不足时返回 NULL
+ */
+static struct task_struct *pcb_alloc(void)
+{
+    enum intr_status old_status = intr_disable();
+    if (pcb_cache_cnt > 0)
+    {
+        struct list_elem *tag = list_pop(&pcb_cache);
+        pcb_cache_cnt--;
+        intr_set_status(old_status);
+        return elem2entry(struct task_struct, general_tag, tag);
+    }
+    intr_set_status(old_status);
+
+    struct task_struct *pthread = get_kernel_pages(1);
+    if (pthread != NULL)
+    {
+        pcb_skeleton(pthread);
+    }
+    return pthread;
+}
+
+/**
+ * @brief 回收 PCB 页：缓存未满（且开启了 CONFIG_PCB_CACHE）时重新铺好框架放入缓存，否则归还内存池
+ */
+static void pcb_free(struct task_struct *pthread)
+{
+    enum intr_status old_status = intr_disable();
+    if (CONFIG_PCB_CACHE && pcb_cache_cnt < PCB_CACHE_MAX)
+    {
+        pcb_skeleton(pthread);
+        list_push(&pcb_cache, &pthread->general_tag);
+        pcb_cache_cnt++;
+        intr_set_status(old_status);
+        return;
+    }
+    intr_set_status(old_status);
+    mfree_page(PF_KERNEL, pthread, 1);
 }
 
 /**
@@ -152,18 +378,41 @@ void init_thread(struct task_struct *pthread, char *name, int prio)
  * @param prio 线程优先级
  * @param function 函数指针，表示在线程中执行的函数
  * @param func_arg 传递给线程执行函数的参数
- * @return struct task_struct* 返回新创建的线程 PCB 指针
+ * @param joinable 为 true 时线程退出后由创建者 thread_join 回收，否则由 reaper 线程自动回收
+ * @return struct task_struct* 返回新创建的线程 PCB 指针，内存不足时返回 NULL
  */
-struct task_struct *thread_start(char *name,
-                                 int prio,
-                                 thread_func function,
-                                 void *func_arg)
-
+static struct task_struct *thread_spawn(char *name, int prio, thread_func function, void *func_arg, bool joinable)
 {
+#if CONFIG_PCB_CACHE
+    struct task_struct *thread = pcb_alloc(); // 取一页铺好框架的 PCB（缓存中的或新申请的），线程栈中只需填入函数和参数
+    if (thread == NULL)
+    {
+        return NULL;
+    }
+    thread->pid = allocate_pid();
+    strcpy(thread->name, name);
+    thread->status = TASK_READY;
+    thread->priority = prio;
+    thread->ticks = prio;
+    thread->sched_level = prio_base_level(prio);
+    thread->elapsed_ticks = 0;
+    thread->join_waiter = NULL;
+    thread->pgdir = NULL;
+    memset(thread->page_mag, 0, sizeof(thread->page_mag));
+    struct thread_stack *kthread_stack = (struct thread_stack *)thread->self_kstack;
+    kthread_stack->function = function;
+    kthread_stack->func_arg = func_arg;
+#else
     struct task_struct *thread = get_kernel_pages(1); // 从内核空间中分配一页内存（4096）作为 PCB 的起始地址
                                                       // 注意：无论是进程或线程的 PCB，这都是给内核调度器使用的结构，属于内核管理的数据，因此将来用户进程的 PCB 也要依然从内核物理内存池中申请
+    if (thread == NULL)
+    {
+        return NULL;
+    }
     init_thread(thread, name, prio);                  // 初始化刚刚创建的 thread 线程的 PCB
     thread_create(thread, function, func_arg);        // 初始化线程栈 thread_stack，待执行的函数和参数放到 thread_stack 中相应的位置
+#endif
+    thread->joinable = joinable;
 
     // 使用汇编代码启动线程，将线程栈顶设为 esp（此时 esp 为指向线程栈的最低处），并弹出被调用函数需要保护的 4 个寄存器值（ABI）
     // 通过 ret 指令返回到 void (*eip)(thread_func *func, void *func_arg); 所对应的 kernel_thread 函数（这个函数的两个参数通过 ebp +4 和 +8 得到，ebp 会自动跳过 unused_retaddr 返回地址占位符）
@@ -175,18 +424,37 @@ struct task_struct *thread_start(char *name,
     //               ret"
     //              : : "g"(thread->self_kstack) : "memory");
 
-    /* 确保线程"标签"节点没在就绪队列 thread_ready_list 中 */
-    ASSERT(!elem_find(&thread_ready_list, &thread->general_tag));
+    enum intr_status old_status = intr_disable();
     // 队列中的节点就是线程 PCB 的成员 general_tag 线程"标签"节点（优点：struct list_elem 节点类型只有 8 字节，这个队列显得轻量小巧；如果使用 PCB 做节点，尺寸太大）
-    list_append(&thread_ready_list, &thread->general_tag); // 将线程"标签"节点加入到就绪队列中
+    ready_enqueue(thread, false); // 将线程"标签"节点加入到就绪队列中
 
     /* 确保线程"标签"节点没在全局队列 thread_all_list 中 */
     ASSERT(!elem_find(&thread_all_list, &thread->all_list_tag));
     list_append(&thread_all_list, &thread->all_list_tag); // 将线程"标签"节点加入到全局队列中
+    intr_set_status(old_status);
 
     return thread; // 返回线程 PCB 的指针
 }
 
+/**
+ * @brief 创建并启动一个新线程，它退出后由 reaper 线程自动回收（见 thread_spawn）
+ */
+struct task_struct *thread_start(char *name,
+                                 int prio,
+                                 thread_func function,
+                                 void *func_arg)
+{
+    return thread_spawn(name, prio, function, func_arg, false);
+}
+
+/**
+ * @brief 创建并启动一个新线程，创建者须调用 thread_join 等待它退出并回收它（见 thread_spawn）
+ */
+struct task_struct *thread_start_joinable(char *name, int prio, thread_func function, void *func_arg)
+{
+    return thread_spawn(name, prio, function, func_arg, true);
+}
+
 /* 实现任务调度 */
 void schedule()
 {
@@ -195,30 +463,59 @@ void schedule()
 
     // 获取当前正在运行的线程 PCB 指针
     struct task_struct *cur = running_thread();
-    if (cur->status == TASK_RUNNING)
+    uint8_t base_level = prio_base_level(cur->priority);
+    if (cur == idle_thread)
     {
-        // 如果当前线程 cur 的时间片 ticks 到了，将其加入到就绪队列的尾部
-        ASSERT(!elem_find(&thread_ready_list, &cur->general_tag));
-        list_append(&thread_ready_list, &cur->general_tag);
-        // 将当前线程的时间片 ticks 重置为其优先级 priority（为了下次运行时不会马上被换下处理器）
+        // idle 线程不论是自己阻塞、被抢占还是时间片用完，都不进入就绪队列，只在就绪队列为空时由下面唤醒，
+        // 这样 ready_empty() 为真就表示没有线程要运行，时钟中断据此判断能否停掉周期时钟
+        cur->status = TASK_BLOCKED;
         cur->ticks = cur->priority;
+    }
+    else if (cur->status == TASK_RUNNING)
+    {
+        if (cur->ticks == 0)
+        {
+            // 如果当前线程 cur 的时间片 ticks 到了，降一级后将其加入到 expired 组就绪队列的尾部
+            if (cur->sched_level < PRIO_LEVELS - 1 && cur->sched_level < base_level + MLFQ_DEMOTE_MAX && !CONFIG_SCHED_FIFO)
+            {
+                cur->sched_level++;
+            }
+            // 将当前线程的时间片 ticks 重置为其优先级 priority（为了下次运行时不会马上被换下处理器）
+            cur->ticks = cur->priority;
+            prio_array_add(CONFIG_SCHED_FIFO ? active : expired, cur, false); // 单一 FIFO 队列时直接排到队尾
+        }
+        else
+        {
+            // 时间片没用完，是被更高级别的线程抢占，排在本级队首，下次轮到本级时接着用剩下的时间片
+            ready_enqueue(cur, true);
+        }
         cur->status = TASK_READY; // 将状态设置为就绪
     }
+    else if (cur->status == TASK_READY)
+    {
+        // thread_yield 已按当前级别把它放入就绪队列，级别不能再变（否则与所在队列不符），什么都不用做
+    }
     else
     {
         // 如果线程因为某事件阻塞被换下处理器，不需要将其加入到就绪队列，因为当前线程并不在就绪队列中（需要事件完成后才能继续上 CPU 运行）
         // （比如对 0 值的信号就行 P 操作就会让线程阻塞，到同步机制时会介绍）
+        // 时间片没用完就阻塞的线程多半是交互型或 I/O 型的，升一级，使其被唤醒后能尽快得到调度
+        if (cur->ticks > 0 && cur->sched_level > base_level)
+        {
+            cur->sched_level--;
+        }
     }
 
-    // 确保就绪队列中有现成可供调度
-    ASSERT(!list_empty(&thread_ready_list));
-    thread_tag = NULL; // 清空全局变量 thread_tag，避免上次的残留值影响（由于是全局变量）
+    // 就绪队列为空时唤醒 idle 线程，由它 hlt 等待中断
+    if (ready_empty())
+    {
+        thread_unblock(idle_thread);
+    }
 
-    // 从就绪队列 thread_ready_list 中弹出第一个线程，准备将其调度到 CPU 上
-    thread_tag = list_pop(&thread_ready_list);
-    // thread_tag 并不是线程，它仅仅是线程 PCB 中的 general_tag 或 all_list_tag，要获得线程的信息，必须将其转换成 PCB 指针才行，因此我们用到了宏 elem2entry
-    struct task_struct *next = elem2entry(struct task_struct, general_tag, thread_tag);
+    // 从最高非空级别的就绪队列中弹出第一个线程，准备将其调度到 CPU 上
+    struct task_struct *next = ready_dequeue();
     next->status = TASK_RUNNING; // 设置新线程的状态为运行中（表示新线程可以上处理器了）
+    process_activate(next);      // 激活任务页表（用户进程还要更新 TSS 中的 0 级栈）
     switch_to(cur, next);        // 切换新线程（切换寄存器映像）———— 将线程 cur 的上下文保护好，再将线程 next 的上下文装在到处理器，实现任务切换
 
     // 执行完 switch.S 后，此处内核栈已经切换为 next 被调度任务的内核栈（此处的线程是被调度后的线程）
@@ -226,6 +523,27 @@ void schedule()
     // （利用恢复第一部分用户任务进入中断前保存的的全部寄存器上下文环境彻底恢复 next 被调度线程的用户任务（执行完中断处理程序后，会返回到 kernel.S 中的 intr_exit（恢复用户程序的上下文环境）））
 }
 
+/**
+ * @brief idle 线程：就绪队列为空时由 schedule 唤醒，停掉周期时钟后 hlt，直到下一个中断到来
+ *
+ * sti 之后的一条指令执行完才响应中断，因此 "sti; hlt" 之间不会漏掉中断。
+ * 中断处理完后 hlt 返回，idle 线程重新阻塞自己，让中断中被唤醒的线程上处理器。
+ * 若在中断中就被抢占，schedule 直接把它置为阻塞而不放入就绪队列，再次被唤醒时从 hlt 之后接着执行。
+ */
+static void idle(void *arg UNUSED)
+{
+    while (1)
+    {
+        thread_block(TASK_BLOCKED);
+        intr_disable();
+        tick_stop(~0u); // 定时到时间轮上最近的定时器（不超过计数器的上限）
+        asm volatile("sti; hlt" : : : "memory");
+        intr_disable();
+        tick_resume(); // 被时钟以外的中断唤醒时补记已经过的滴答
+        intr_enable();
+    }
+}
+
 /**
  * @brief 将内核中的 main 函数设置为主线程
  *
@@ -253,7 +571,7 @@ static void make_main_thread(void)
  *
  * 当前运行线程的 status 必然是 TASK_RUNNING，此状态的线程在调度器中会被重新加到就绪队列中。
  * 由于要实现的功能是线程阻塞，也就是当前线程暂时不能运行。达到这一目的的原理是：
- * 		让调度器 schedule 无法再调度它，也就是当前线程不能再被加到就绪队列 thread_ready_list 中。
+ * 		让调度器 schedule 无法再调度它，也就是当前线程不能再被加到就绪队列中。
  *
  * 回顾: 在调度器 schedule 函数中，它会对当前线程的 status 判断。若当前线程的 status 为 TASK_RUNNING，这说明当前线程
  *       只是时间片到了，此次调度并不是由于阻塞而引发的，因此会将其重新加入到就绪队列中并置其状态为TASK_READY。
@@ -296,17 +614,152 @@ void thread_unblock(struct task_struct *pthread)
     ASSERT((pthread->status == TASK_BLOCKED) || (pthread->status == TASK_WAITING) || (pthread->status == TASK_HANGING));
     if (pthread->status != TASK_READY)
     {
-        ASSERT(!elem_find(&thread_ready_list, &pthread->general_tag));
-        if (elem_find(&thread_ready_list, &pthread->general_tag))
-        {
-            PANIC("thread_unblock: blocked thread in ready_list\n");
-        }
-        // 通过 list_push 将阻塞的线程重新添加到就绪队列中（队首），因此保证了这个睡了很久的线程能被优先调度（使其尽快得到调度）
-        list_push(&thread_ready_list, &pthread->general_tag);
+        // 将阻塞的线程重新添加到其级别的就绪队列中（队首），因此保证了这个睡了很久的线程能被优先调度（使其尽快得到调度）
+        ready_enqueue(pthread, true);
         // 更改此线程的状态为就绪态
         pthread->status = TASK_READY;
     }
     intr_set_status(old_status);
+    thread_preempt(); // 被唤醒的线程级别更高时立即让出处理器
+}
+
+/**
+ * @brief 主动让出处理器，当前线程放到 expired 组的队尾，本轮中其他就绪的线程都运行过之后才轮到它
+ *
+ * 与时间片用完的处理相同（只是不降级），因此反复让出的线程也不会饿死级别更低的线程。
+ * 入队后状态置为 TASK_READY，schedule 据此认出主动让出，不再按阻塞处理去改 sched_level。
+ */
+void thread_yield(void)
+{
+    struct task_struct *cur = running_thread();
+    enum intr_status old_status = intr_disable();
+    prio_array_add(CONFIG_SCHED_FIFO ? active : expired, cur, false);
+    cur->status = TASK_READY;
+    schedule();
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 睡眠定时器到期时唤醒线程 arg
+ */
+static void thread_sleep_wakeup(void *arg)
+{
+    thread_unblock((struct task_struct *)arg);
+}
+
+/**
+ * @brief 当前线程睡眠 ms 毫秒（向上取整到滴答），期间阻塞不占用处理器
+ *
+ * 定时器放在当前线程的栈上，线程被唤醒之前它一直有效。ms 为 0 时相当于 thread_yield。
+ */
+void thread_sleep(uint32_t ms)
+{
+    uint32_t sleep_ticks = DIV_ROUND_UP(ms, MS_PER_TICK);
+    if (sleep_ticks == 0)
+    {
+        thread_yield();
+        return;
+    }
+    struct timer timer;
+    timer_setup(&timer, thread_sleep_wakeup, running_thread());
+    enum intr_status old_status = intr_disable();
+    timer_add(&timer, sleep_ticks);
+    thread_block(TASK_BLOCKED);
+    intr_set_status(old_status);
+}
+
+/**
+ * thread_exit - 结束当前线程
+ *
+ * 线程函数返回时由 kernel_thread 自动调用，也可以在线程中直接调用。线程置为 TASK_DIED 后不再被调度，
+ * 它的 PCB（连同其中正在使用的内核栈）要等切换到别的线程之后才能释放：
+ * 可以被 join 的线程交给正在 thread_join 中等待的创建者（或稍后调用 thread_join 的创建者），其他线程交给 reaper 线程。
+ */
+void thread_exit(void)
+{
+    struct task_struct *cur = running_thread();
+    ASSERT(cur != main_thread && cur != idle_thread && cur != reaper_thread);
+    intr_disable();
+    cur->status = TASK_DIED;
+    if (cur->joinable)
+    {
+        if (cur->join_waiter != NULL)
+        {
+            thread_unblock(cur->join_waiter);
+        }
+    }
+    else
+    {
+        list_append(&reap_list, &cur->general_tag);
+        if (reaper_thread->status == TASK_HANGING)
+        {
+            thread_unblock(reaper_thread);
+        }
+    }
+    schedule();
+    PANIC("thread_exit: dead thread was scheduled");
+}
+
+/**
+ * @brief 回收已退出的线程 pthread：移出全部队列，归还页框缓存、用户地址空间、pid 和 PCB 页
+ */
+static void thread_reap(struct task_struct *pthread)
+{
+    ASSERT(pthread->status == TASK_DIED && pthread != running_thread());
+    enum intr_status old_status = intr_disable();
+    list_remove(&pthread->all_list_tag);
+    intr_set_status(old_status);
+
+    page_mag_release(pthread->page_mag);
+    if (pthread->pgdir != NULL)
+    {
+        pgdir_release_user(pthread->pgdir);
+        mfree_page(PF_KERNEL, pthread->pgdir, 1);
+        uint32_t bitmap_pg_cnt = DIV_ROUND_UP(pthread->userprog_vaddr.vaddr_bitmap.btmp_bytes_len, PG_SIZE);
+        mfree_page(PF_KERNEL, pthread->userprog_vaddr.vaddr_bitmap.bits, bitmap_pg_cnt);
+    }
+    release_pid(pthread->pid);
+    pcb_free(pthread);
+}
+
+/**
+ * @brief reaper 线程：回收 reap_list 中已退出的线程，没有时以 TASK_HANGING 阻塞
+ *
+ * 用专门的阻塞状态，使 thread_exit 能区分它是在等待 reap_list，还是阻塞在 mfree_page 的锁上。
+ */
+static void reaper(void *arg UNUSED)
+{
+    while (1)
+    {
+        enum intr_status old_status = intr_disable();
+        while (list_empty(&reap_list))
+        {
+            thread_block(TASK_HANGING);
+        }
+        struct list_elem *tag = list_pop(&reap_list);
+        intr_set_status(old_status);
+        struct task_struct *pthread = elem2entry(struct task_struct, general_tag, tag);
+        thread_reap(pthread);
+    }
+}
+
+/**
+ * thread_join - 等待 thread_start_joinable 创建的线程 pthread 退出，然后回收它
+ *
+ * 每个线程只能被 join 一次，返回后 pthread 指向的 PCB 已释放。
+ */
+void thread_join(struct task_struct *pthread)
+{
+    ASSERT(pthread->joinable && pthread->join_waiter == NULL);
+    enum intr_status old_status = intr_disable();
+    while (pthread->status != TASK_DIED)
+    {
+        pthread->join_waiter = running_thread();
+        thread_block(TASK_WAITING);
+    }
+    pthread->join_waiter = NULL;
+    intr_set_status(old_status);
+    thread_reap(pthread);
 }
 
 /**
@@ -315,12 +768,42 @@ void thread_unblock(struct task_struct *pthread)
 void thread_init(void)
 {
     put_str("thread_init start\n");
-    // 通过 list_init 函数将就绪队列 thread_ready_list 和全部队列 thread_all_list 初始化
+    // 通过 list_init 函数将两组各级就绪队列和全部队列 thread_all_list 初始化
     // 初始化的内容就是将队列置空，也就是使队列首尾相接
-    list_init(&thread_ready_list);
+    uint32_t level;
+    for (level = 0; level < PRIO_LEVELS; level++)
+    {
+        list_init(&prio_arrays[0].queues[level]);
+        list_init(&prio_arrays[1].queues[level]);
+    }
     list_init(&thread_all_list);
+    list_init(&reap_list);
+    list_init(&pcb_cache);
+    lock_init(&pid_lock);
+    pid_pool.bits = pid_bits;
+    pid_pool.btmp_bytes_len = sizeof(pid_bits);
+    pid_pool.summary = NULL;
+    bitmap_init(&pid_pool);
+    bitmap_set(&pid_pool, 0, 1); // pid 0 不分配
 
     /* 将当前已运行的主函数 main 封装为线程（本质上就是在其 PCB 中写入了线程信息） */
     make_main_thread();
+#if CONFIG_PCB_CACHE
+    /* 预先准备几页 PCB，最初的几次 thread_start 也不必申请页框 */
+    uint32_t idx;
+    for (idx = 0; idx < PCB_CACHE_PREFILL; idx++)
+    {
+        struct task_struct *pthread = get_kernel_pages(1);
+        if (pthread == NULL)
+        {
+            break;
+        }
+        pcb_free(pthread);
+    }
+#endif
+    /* 创建 idle 线程，它第一次运行时就阻塞自己，以后就绪队列为空时才被唤醒 */
+    idle_thread = thread_start("idle", 10, idle, NULL);
+    /* 创建 reaper 线程，回收不被 join 的已退出线程 */
+    reaper_thread = thread_start("reaper", 31, reaper, NULL);
     put_str("thread_init done\n");
 }
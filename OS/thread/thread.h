@@ -3,6 +3,33 @@
 
 #include "stdint.h"
 #include "list.h"
+#include "memory.h"
+
+#define STACK_MAGIC 0x19870916 // PCB 边界处的魔数，用于检测栈溢出
+
+/* 为 1 时调度器退回单一 FIFO 就绪队列（priority 只决定时间片长度），为 0 时用多级优先级队列，可在 makefile 中用 -D 覆盖 */
+#ifndef CONFIG_SCHED_FIFO
+#define CONFIG_SCHED_FIFO 0
+#endif
+
+#define PRIO_LEVELS 32     // 就绪队列的级数，第 0 级优先级最高，正好用一个 32 位的位图记录哪些级非空
+#define MLFQ_DEMOTE_MAX 3  // 反复用完时间片的线程最多比其基础级别降低的级数
+#define MAX_PID 32767      // pid 的上限（pid_t 为 16 位有符号数），pid 随线程回收而释放、循环使用
+
+/* 为 1 时线程的 PCB 页回收后留在缓存中，连同线程栈的框架一起复用，为 0 时每次都从内存池申请、清 0，可在 makefile 中用 -D 覆盖 */
+#ifndef CONFIG_PCB_CACHE
+#define CONFIG_PCB_CACHE 1
+#endif
+
+#define PCB_CACHE_MAX 64    // 缓存中最多保留的 PCB 页数，超出的归还内存池
+#define PCB_CACHE_PREFILL 8 // thread_init 时预先准备好的 PCB 页数
+
+/* 一组多级就绪队列，调度器有 active、expired 两组 */
+struct prio_array
+{
+    uint32_t bitmap;                 // 第 i 位为 1 表示第 i 级队列非空
+    struct list queues[PRIO_LEVELS]; // 各级就绪队列
+};
 
 /* 自定义通用函数类型，它将在很多线程函数中作为形参类型 */
 // thread_func：这是新的类型别名，用来代指一个函数类型。它是用户定义的名称，表示任意符合这个签名的函数的类型。
@@ -11,6 +38,8 @@ typedef void thread_func(void *); // 定义返回值为 void 的函数类型
                                   // 用来指定线程中运行的函数类型
                                   // （我们在线程中打算运行某段代码（函数）时，需要一个参数来接收该函数的地址，因此这里先定义这个返回值 void 的函数类型）
 
+typedef int16_t pid_t;
+
 /* 进程或线程的状态 */
 enum task_status // 进程和线程的区别是它们是否独自拥有地址空间（页表）
 {
@@ -95,6 +124,7 @@ struct task_struct
     uint32_t *self_kstack;   // 各线程的内核栈顶指针，当线程被创建时，self_kstack 被初始化为自己的 PCB 所在的页的顶端
                              // 之后再运行时，在被换下处理器之前，会把线程的上下文信息（寄存器映像）保存在 0 特权级栈中
                              // self_kstack 便用来记录 0 特权级栈在保存线程上下文后的新栈顶，在下一次此线程又被调度到处理器上时，可以把 self_kstack 的值加载到处理器中运行
+    pid_t pid;               // 任务的 pid，由 allocate_pid 分配
     enum task_status status; // 线程状态
     char name[16];           // 记录任务（线程/进程）的名字
     uint8_t priority;        // 线程优先级（用于决定进程/线程的时间片，及被调度到处理器上后的运行时间）
@@ -105,14 +135,18 @@ struct task_struct
      * 调度器把 priority 重新赋值给 ticks，这样当此线程下一次又被调度时，将再次在处理器上运行 ticks 个时间片
      */
     uint8_t ticks;
+    uint8_t sched_level; // 当前所在的就绪队列级别（0 最高），由 priority 决定基础级别，按运行情况在其下 MLFQ_DEMOTE_MAX 级内浮动
 
     uint32_t elapsed_ticks; // 记录任务在处理器上运行的 ticks 时钟滴答数，从开始执行，到运行结束所经历的总时钟数
 
+    bool joinable;                   // 为 true 时退出后由创建者调用 thread_join 回收，否则由 reaper 线程回收
+    struct task_struct *join_waiter; // 正在 thread_join 中等待本线程退出的线程
+
     /******** 以下两个标签仅仅是加入队列时用的，将来从队列中把它们取出来时，还需要再通过 offset 宏与 elem2entry 宏的 "反操作"，实现从 &general_tag 到 &thread 的地址转换，将它们还原成线程的 PCB 地址后才能使用（这两个线程 "标签" 定义在 thread.c 中） ********
 
     /*
      * ① 就绪队列中的"标签"节点
-     * 它是线程的"标签"，当线程被加入到就绪队列 thread_ready_list 或其他等待队列中时，就把该线程 PCB 中 general_tag 的地址加入队列
+     * 它是线程的"标签"，当线程被加入到就绪队列或其他等待队列中时，就把该线程 PCB 中 general_tag 的地址加入队列
      * general_tag 的作用是用于线程在一般的队列中的结点
      *		一个 struct list_elem 类型的节点只有一对前驱和后继指针，它只能被加入到一个队列
     */
@@ -130,23 +164,55 @@ struct task_struct
     uint32_t *pgdir; // 进程自己页表的虚拟地址（如果该任务为线程，则 pgdir 为 NULL）
                      // 页表加载时还是要被转换成物理地址的
 
+    struct virtual_addr userprog_vaddr;            // 用户进程的虚拟地址池（内核线程不使用）
+    struct mem_block_desc u_block_desc[DESC_CNT]; // 用户进程堆的内存块描述符，sys_malloc 在用户进程中从这里分配
+    uint32_t user_arg;                            // 传给用户程序的参数，start_process 把它写入用户栈顶的 USER_INFO
+    struct mem_block_desc *u_desc_base;           // 用户 arena 中记录描述符所用的基址（创建进程时的 u_block_desc，fork 的子进程继承父进程的），sys_free 据此换算下标
+
+    struct page_magazine page_mag[2]; // 线程私有的物理页框缓存，[0] 对应内核物理内存池，[1] 对应用户物理内存池
+
     uint32_t stack_magic; // 栈的边界标记，用于检测栈的溢出（由于 0 级栈和 PCB 是在同一页，栈位于页的顶端并向下扩展，因此担心压栈过程中会把 PCB 中的信息给覆盖，所以
                           // 所以每次在线程或进程调度时要判断是否触及到了进程信息的边界，也就是判断 stack_magic 的值是否为初始化的内容）
                           // stack_magic 是一个魔数
 };
 
+extern struct task_struct *idle_thread;
+
 struct task_struct *running_thread();
+static void pcb_skeleton(struct task_struct *pthread);
+static struct task_struct *pcb_alloc(void);
+static void pcb_free(struct task_struct *pthread);
+static struct task_struct *thread_spawn(char *name, int prio, thread_func function, void *func_arg, bool joinable);
 struct task_struct *thread_start(char *name,
                                  int prio,
                                  thread_func function,
                                  void *func_arg);
+struct task_struct *thread_start_joinable(char *name, int prio, thread_func function, void *func_arg);
 void init_thread(struct task_struct *pthread, char *name, int prio);
 void thread_create(struct task_struct *pthread, thread_func function, void *func_arg);
 static void kernel_thread(thread_func *function, void *func_arg);
 void schedule();
 static void make_main_thread(void);
 void thread_init(void);
+static void idle(void *arg);
 void thread_block(enum task_status stat);
 void thread_unblock(struct task_struct *pthread);
+void thread_yield(void);
+static void thread_sleep_wakeup(void *arg);
+void thread_sleep(uint32_t ms);
+static pid_t allocate_pid(void);
+void release_pid(pid_t pid);
+void thread_exit(void);
+static void thread_reap(struct task_struct *pthread);
+static void reaper(void *arg);
+void thread_join(struct task_struct *pthread);
+static uint8_t prio_base_level(uint8_t prio);
+static void prio_array_add(struct prio_array *array, struct task_struct *pthread, bool front);
+void ready_enqueue(struct task_struct *pthread, bool front);
+static struct task_struct *ready_dequeue(void);
+bool ready_empty(void);
+bool ready_preempts(struct task_struct *cur);
+void thread_preempt(void);
+pid_t fork_pid(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,270 @@
+#include "thread_bench.h"
+#include "thread.h"
+#include "sync.h"
+#include "interrupt.h"
+#include "console.h"
+#include "memstat.h"
+#include "time.h"
+#include "global.h"
+
+/**************************  调度延迟测量  ******************************
+ * 创建 busy_cnt 个一直占用处理器的忙线程和一个同级别的唤醒线程，它们的 priority 都是 16；
+ * 另有一个 priority 为 31 的等待线程反复在信号量上阻塞。唤醒线程每个时钟滴答 sema_up 一次并记下时间戳，
+ * 等待线程从 sema_down 返回时算出 "唤醒 -> 上处理器" 的延迟，rounds 次之后以
+ * "sched fifo=.. busy=.. rounds=.. lat_hi=.. lat_lo=.. lat_max=.." 输出延迟总和与最大值（TSC 周期数）。
+ * CONFIG_SCHED_FIFO 为 1 时被唤醒的线程要排在所有忙线程之后，延迟随 busy_cnt 增长；为 0 时它立即抢占唤醒线程。
+ * 测量结束后各线程退出，由 reaper 线程回收。
+ ***********************************************************************/
+#define SCHED_BENCH_BUSY_PRIO 16 // 忙线程与唤醒线程的优先级
+#define SCHED_BENCH_WAIT_PRIO 31 // 等待线程的优先级
+
+static struct semaphore sched_bench_sema;       // 等待线程在其上阻塞
+static volatile uint64_t sched_bench_wake_tsc;  // 最近一次唤醒的时间戳
+static volatile bool sched_bench_done = false;  // 等待线程测完后置 1，忙线程和唤醒线程随之停下
+static uint32_t sched_bench_busy_cnt;
+
+/**
+ * @brief 忙线程：一直占用处理器直到测量结束
+ */
+static void sched_bench_busy(void *arg UNUSED)
+{
+    while (!sched_bench_done)
+    {
+    }
+}
+
+/**
+ * @brief 唤醒线程：每个时钟滴答唤醒一次等待线程
+ */
+static void sched_bench_waker(void *arg UNUSED)
+{
+    while (!sched_bench_done)
+    {
+        uint32_t start = *(volatile uint32_t *)&ticks;
+        while (*(volatile uint32_t *)&ticks == start && !sched_bench_done)
+        {
+        }
+        enum intr_status old_status = intr_disable();
+        if (sched_bench_sema.value == 0 && !list_empty(&sched_bench_sema.waiters))
+        {
+            sched_bench_wake_tsc = rdtsc();
+            sema_up(&sched_bench_sema);
+        }
+        intr_set_status(old_status);
+        thread_preempt();
+    }
+}
+
+/**
+ * @brief 等待线程：rounds 次阻塞与被唤醒，统计延迟后输出
+ */
+static void sched_bench_waiter(void *arg)
+{
+    uint32_t rounds = (uint32_t)arg;
+    uint64_t total = 0;
+    uint32_t max = 0;
+    uint32_t round;
+    for (round = 0; round < rounds; round++)
+    {
+        sema_down(&sched_bench_sema);
+        uint32_t lat = (uint32_t)(rdtsc() - sched_bench_wake_tsc);
+        total += lat;
+        if (lat > max)
+        {
+            max = lat;
+        }
+    }
+    sched_bench_done = true;
+
+    console_acquire();
+    memstat_put_str("sched fifo=");
+    memstat_put_int(CONFIG_SCHED_FIFO);
+    memstat_put_str(" busy=");
+    memstat_put_int(sched_bench_busy_cnt);
+    memstat_put_str(" rounds=");
+    memstat_put_int(rounds);
+    memstat_put_str(" lat_hi=");
+    memstat_put_int((uint32_t)(total >> 32));
+    memstat_put_str(" lat_lo=");
+    memstat_put_int((uint32_t)total);
+    memstat_put_str(" lat_max=");
+    memstat_put_int(max);
+    memstat_put_str("\n");
+    console_release();
+}
+
+/**
+ * @brief 测量高优先级线程被唤醒后得到处理器的延迟（见上方说明）
+ */
+void sched_bench(uint32_t busy_cnt, uint32_t rounds)
+{
+    sema_init(&sched_bench_sema, 0);
+    sched_bench_done = false;
+    sched_bench_busy_cnt = busy_cnt;
+    uint32_t idx;
+    for (idx = 0; idx < busy_cnt; idx++)
+    {
+        thread_start("sched_busy", SCHED_BENCH_BUSY_PRIO, sched_bench_busy, NULL);
+    }
+    thread_start("sched_waker", SCHED_BENCH_BUSY_PRIO, sched_bench_waker, NULL);
+    thread_start("sched_waiter", SCHED_BENCH_WAIT_PRIO, sched_bench_waiter, (void *)rounds);
+}
+
+/**************************  线程创建与退出的压力测试  ******************************
+ * 一个 priority 为 16 的测试线程不停地循环：每轮创建 batch 个可 join 的线程并逐个 thread_join，
+ * 再创建 batch 个不被 join 的线程交给 reaper 回收；每个线程只把计数加 1 就返回。
+ * 每 CHURN_REPORT_ROUNDS 轮以 "churn rounds=.. threads=.. kernel_used=.. cyc_hi=.. cyc_lo=.." 输出累计的轮数、
+ * 线程数、内核一侧占用的页数和这些轮 "创建 + 运行 + 回收" 的耗时（TSC 周期数）。
+ * 回收正常时 kernel_used 保持平稳，测试可以一直运行下去；创建失败（内核内存耗尽）时输出 "churn exhausted" 后停止。
+ ***********************************************************************/
+#define CHURN_PRIO 16          // 测试线程与被创建线程的优先级
+#define CHURN_REPORT_ROUNDS 256 // 每多少轮输出一次
+#define CHURN_BATCH_MAX 64      // batch 的上限（可 join 的线程指针放在测试线程只有一页的栈上）
+
+static volatile uint32_t churn_runs = 0; // 被创建的线程实际运行的次数
+
+/**
+ * @brief 被创建的线程：计数后返回（返回即退出）
+ */
+static void churn_worker(void *arg UNUSED)
+{
+    enum intr_status old_status = intr_disable();
+    churn_runs++;
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 测试线程：反复创建、运行、回收线程
+ */
+static void churn_bench_thread(void *arg)
+{
+    uint32_t batch = (uint32_t)arg;
+    struct task_struct *joinable[CHURN_BATCH_MAX];
+    uint32_t rounds = 0;
+    uint64_t start = rdtsc();
+    while (1)
+    {
+        uint32_t idx;
+        bool exhausted = false;
+        for (idx = 0; idx < batch && !exhausted; idx++)
+        {
+            joinable[idx] = thread_start_joinable("churn_j", CHURN_PRIO, churn_worker, NULL);
+            exhausted = (joinable[idx] == NULL);
+        }
+        uint32_t created = exhausted ? idx - 1 : batch;
+        for (idx = 0; idx < created; idx++)
+        {
+            thread_join(joinable[idx]);
+        }
+        for (idx = 0; idx < batch && !exhausted; idx++)
+        {
+            exhausted = (thread_start("churn_d", CHURN_PRIO, churn_worker, NULL) == NULL);
+        }
+        if (exhausted)
+        {
+            console_acquire();
+            memstat_put_str("churn exhausted\n");
+            console_release();
+            return;
+        }
+
+        if (++rounds % CHURN_REPORT_ROUNDS == 0)
+        {
+            uint64_t cycles = rdtsc() - start;
+            console_acquire();
+            memstat_put_str("churn rounds=");
+            memstat_put_int(rounds);
+            memstat_put_str(" threads=");
+            memstat_put_int(churn_runs);
+            memstat_put_str(" kernel_used=");
+            memstat_put_int(reservoir_stat[RS_KERNEL].used);
+            memstat_put_str(" cyc_hi=");
+            memstat_put_int((uint32_t)(cycles >> 32));
+            memstat_put_str(" cyc_lo=");
+            memstat_put_int((uint32_t)cycles);
+            memstat_put_str("\n");
+            console_release();
+            start = rdtsc();
+        }
+    }
+}
+
+/**
+ * @brief 启动线程创建与退出的压力测试（见上方说明），每轮创建 2 * batch 个线程（batch 超过 CHURN_BATCH_MAX 时按上限计）
+ */
+void churn_bench(uint32_t batch)
+{
+    if (batch > CHURN_BATCH_MAX)
+    {
+        batch = CHURN_BATCH_MAX;
+    }
+    thread_start("churn_bench", CHURN_PRIO, churn_bench_thread, (void *)batch);
+}
+
+/**************************  线程创建延迟测量  ******************************
+ * priority 为 16 的测试线程重复 rounds 次：记下时间戳，thread_start_joinable 创建一个 priority 为 31 的线程，
+ * 再 thread_preempt 让它立即上处理器；新线程一运行就记下时间戳并返回，测试线程随后 thread_join 回收它。
+ * 以 "spawn cache=.. rounds=.. create_hi=.. create_lo=.. first_run_hi=.. first_run_lo=.." 输出
+ * thread_start 本身的耗时总和与 "创建 + 首次运行" 的耗时总和（TSC 周期数）。
+ * CONFIG_PCB_CACHE 为 0 时每次都要申请并清 0 PCB 页，用来对比。
+ ***********************************************************************/
+#define SPAWN_BENCH_PRIO 16 // 测试线程的优先级
+#define SPAWN_FIRST_PRIO 31 // 被创建线程的优先级，高于测试线程才能立即抢占
+
+static volatile uint64_t spawn_first_run_tsc; // 被创建的线程首次运行的时间戳
+
+/**
+ * @brief 被创建的线程：记下首次运行的时间戳后返回
+ */
+static void spawn_first_run(void *arg UNUSED)
+{
+    spawn_first_run_tsc = rdtsc();
+}
+
+/**
+ * @brief 测试线程：rounds 次创建、首次运行、回收
+ */
+static void spawn_bench_thread(void *arg)
+{
+    uint32_t rounds = (uint32_t)arg;
+    uint64_t create = 0;
+    uint64_t first_run = 0;
+    uint32_t round;
+    for (round = 0; round < rounds; round++)
+    {
+        uint64_t start = rdtsc();
+        struct task_struct *pthread = thread_start_joinable("spawn", SPAWN_FIRST_PRIO, spawn_first_run, NULL);
+        if (pthread == NULL)
+        {
+            break;
+        }
+        create += rdtsc() - start;
+        thread_preempt();
+        thread_join(pthread);
+        first_run += spawn_first_run_tsc - start;
+    }
+
+    console_acquire();
+    memstat_put_str("spawn cache=");
+    memstat_put_int(CONFIG_PCB_CACHE);
+    memstat_put_str(" rounds=");
+    memstat_put_int(round);
+    memstat_put_str(" create_hi=");
+    memstat_put_int((uint32_t)(create >> 32));
+    memstat_put_str(" create_lo=");
+    memstat_put_int((uint32_t)create);
+    memstat_put_str(" first_run_hi=");
+    memstat_put_int((uint32_t)(first_run >> 32));
+    memstat_put_str(" first_run_lo=");
+    memstat_put_int((uint32_t)first_run);
+    memstat_put_str("\n");
+    console_release();
+}
+
+/**
+ * @brief 测量线程 "创建 + 首次运行" 的延迟（见上方说明）
+ */
+void spawn_bench(uint32_t rounds)
+{
+    thread_start("spawn_bench", SPAWN_BENCH_PRIO, spawn_bench_thread, (void *)rounds);
+}
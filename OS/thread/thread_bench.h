@@ -0,0 +1,16 @@
+#ifndef __THREAD_THREAD_BENCH_H
+#define __THREAD_THREAD_BENCH_H
+#include "stdint.h"
+
+static void sched_bench_busy(void *arg);
+static void sched_bench_waker(void *arg);
+static void sched_bench_waiter(void *arg);
+void sched_bench(uint32_t busy_cnt, uint32_t rounds);
+static void churn_worker(void *arg);
+static void churn_bench_thread(void *arg);
+void churn_bench(uint32_t batch);
+static void spawn_first_run(void *arg);
+static void spawn_bench_thread(void *arg);
+void spawn_bench(uint32_t rounds);
+
+#endif
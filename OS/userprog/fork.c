@@ -0,0 +1,164 @@
+#include "fork.h"
+#include "process.h"
+#include "memory.h"
+#include "interrupt.h"
+#include "debug.h"
+#include "string.h"
+#include "thread.h"
+#include "global.h"
+#include "list.h"
+
+#define PG_SIZE 4096
+
+extern void intr_exit(void);
+
+/**
+ * @brief 把父进程的 PCB 连同用户虚拟地址池的位图复制给子进程，再改写子进程独有的信息
+ *
+ * PCB 整页复制，页顶的中断栈即父进程经 int 0x80 进入内核时保存的用户态上下文，子进程返回用户态时沿用它。
+ * 页框缓存 page_mag 中的页框属于父进程，子进程从空缓存开始。
+ *
+ * @return bool 位图内存申请失败时返回 false
+ */
+static bool copy_pcb_vaddrbitmap(struct task_struct *child_thread, struct task_struct *parent_thread)
+{
+    memcpy(child_thread, parent_thread, PG_SIZE);
+    child_thread->pid = fork_pid();
+    child_thread->elapsed_ticks = 0;
+    child_thread->status = TASK_READY;
+    child_thread->ticks = child_thread->priority;
+    child_thread->general_tag.prev = child_thread->general_tag.next = NULL;
+    child_thread->all_list_tag.prev = child_thread->all_list_tag.next = NULL;
+    child_thread->pgdir = NULL;
+    child_thread->joinable = false;
+    child_thread->join_waiter = NULL;
+    memset(child_thread->page_mag, 0, sizeof(child_thread->page_mag));
+
+    uint32_t bitmap_pg_cnt = DIV_ROUND_UP(parent_thread->userprog_vaddr.vaddr_bitmap.btmp_bytes_len, PG_SIZE);
+    void *vaddr_btmp = get_kernel_pages(bitmap_pg_cnt);
+    if (vaddr_btmp == NULL)
+    {
+        return false;
+    }
+    memcpy(vaddr_btmp, parent_thread->userprog_vaddr.vaddr_bitmap.bits, bitmap_pg_cnt * PG_SIZE);
+    child_thread->userprog_vaddr.vaddr_bitmap.bits = vaddr_btmp;
+    return true;
+}
+
+/**
+ * @brief 子进程第一次被调度时的入口（0 特权级），修正继承来的用户堆链表后经 intr_exit 返回用户态
+ *
+ * u_block_desc 中各 free_list 的首尾结点在 PCB 里，用户堆中第一个和最后一个空闲块仍指向父进程 PCB 中的结点，
+ * 按页内偏移改成指向自己的。这些块位于写时复制页上，写入时照常触发复制（CR0.WP 已开启）。
+ * 用户堆可被父进程随意改写，换算后的首尾结点若不是自己的链表结点、也不在已分配的用户页中，就把该链表置空（泄漏其中的块，而不是写入任意地址）。
+ */
+static void fork_child_return(void *parent_)
+{
+    struct task_struct *cur = running_thread();
+    uint32_t parent = (uint32_t)parent_;
+    uint32_t desc_idx;
+    for (desc_idx = 0; desc_idx < DESC_CNT; desc_idx++)
+    {
+        struct list *plist = &cur->u_block_desc[desc_idx].free_list;
+        if ((uint32_t)plist->head.next - parent < PG_SIZE) // 空链表时首尾结点互指，同样需要换算
+        {
+            plist->head.next = (struct list_elem *)((uint32_t)cur + ((uint32_t)plist->head.next - parent));
+        }
+        if ((uint32_t)plist->tail.prev - parent < PG_SIZE)
+        {
+            plist->tail.prev = (struct list_elem *)((uint32_t)cur + ((uint32_t)plist->tail.prev - parent));
+        }
+        if (!uheap_elem_ok(plist, plist->head.next) || !uheap_elem_ok(plist, plist->tail.prev) ||
+            plist->head.next == &plist->head || plist->tail.prev == &plist->tail)
+        {
+            list_init(plist);
+            continue;
+        }
+        plist->head.next->prev = &plist->head;
+        plist->tail.prev->next = &plist->tail;
+    }
+
+    struct intr_stack *proc_stack = (struct intr_stack *)((uint32_t)cur + PG_SIZE - sizeof(struct intr_stack));
+    asm volatile("movl %0, %%esp; jmp intr_exit" : : "g"(proc_stack) : "memory");
+}
+
+/**
+ * @brief 撤销尚未加入就绪队列的子进程：回收其用户页表、页目录表、虚拟地址位图和 PCB
+ */
+static void fork_undo(struct task_struct *child_thread)
+{
+    enum intr_status old_status = intr_disable();
+    if (child_thread->pgdir != NULL)
+    {
+        list_remove(&child_thread->all_list_tag);
+    }
+    intr_set_status(old_status);
+
+    if (child_thread->pgdir != NULL)
+    {
+        pgdir_release_user(child_thread->pgdir);
+        mfree_page(PF_KERNEL, child_thread->pgdir, 1);
+    }
+    uint32_t bitmap_pg_cnt = DIV_ROUND_UP(child_thread->userprog_vaddr.vaddr_bitmap.btmp_bytes_len, PG_SIZE);
+    mfree_page(PF_KERNEL, child_thread->userprog_vaddr.vaddr_bitmap.bits, bitmap_pg_cnt);
+    release_pid(child_thread->pid);
+    mfree_page(PF_KERNEL, child_thread, 1);
+}
+
+/**
+ * sys_fork - 复制当前用户进程，父进程返回子进程的 pid，子进程返回 0
+ * @param flags: 为 FORK_EAGER 时立即复制全部用户页，否则父子进程写时复制共享
+ *
+ * @return: 失败返回 -1
+ *
+ * 子进程的用户态上下文取自父进程 PCB 页顶的中断栈，只有经 int 0x80 进入内核时它才完整，
+ * sysenter 进入时（代码段为 SELECTOR_K_SYSENTER）用户态的 eip、esp 在用户栈上，不支持 fork。
+ * 子进程先加入全部队列再复制页表，期间若有 4MB 大页的内核页目录项同步，process_sync_kernel_pde 同样会更新它；
+ * 页表复制完才加入就绪队列。
+ */
+pid_t sys_fork(uint32_t flags)
+{
+    struct task_struct *parent_thread = running_thread();
+    uint32_t cs;
+    asm volatile("movl %%cs, %0" : "=r"(cs));
+    if (parent_thread->pgdir == NULL || (cs & 0xffff) != SELECTOR_K_CODE)
+    {
+        return -1;
+    }
+
+    struct task_struct *child_thread = get_kernel_pages(1);
+    if (child_thread == NULL)
+    {
+        return -1;
+    }
+    if (!copy_pcb_vaddrbitmap(child_thread, parent_thread))
+    {
+        release_pid(child_thread->pid);
+        mfree_page(PF_KERNEL, child_thread, 1);
+        return -1;
+    }
+    child_thread->self_kstack = (uint32_t *)((uint32_t)child_thread + PG_SIZE);
+    thread_create(child_thread, fork_child_return, parent_thread);
+    struct intr_stack *child_stack = (struct intr_stack *)((uint32_t)child_thread + PG_SIZE - sizeof(struct intr_stack));
+    child_stack->eax = 0; // 子进程中 fork 返回 0
+
+    enum intr_status old_status = intr_disable();
+    child_thread->pgdir = create_page_dir();
+    if (child_thread->pgdir != NULL)
+    {
+        ASSERT(!elem_find(&thread_all_list, &child_thread->all_list_tag));
+        list_append(&thread_all_list, &child_thread->all_list_tag);
+    }
+    intr_set_status(old_status);
+
+    if (child_thread->pgdir == NULL || !pgdir_copy_user(child_thread->pgdir, !(flags & FORK_EAGER)))
+    {
+        fork_undo(child_thread);
+        return -1;
+    }
+
+    old_status = intr_disable();
+    ready_enqueue(child_thread, false);
+    intr_set_status(old_status);
+    return child_thread->pid;
+}
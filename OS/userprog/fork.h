@@ -0,0 +1,13 @@
+#ifndef __USERPROG_FORK_H
+#define __USERPROG_FORK_H
+#include "thread.h"
+#include "stdint.h"
+
+#define FORK_EAGER 1 // sys_fork 的标志：立即复制父进程的全部用户页，而不是写时复制共享（用于对比测试）
+
+static bool copy_pcb_vaddrbitmap(struct task_struct *child_thread, struct task_struct *parent_thread);
+static void fork_child_return(void *parent_);
+static void fork_undo(struct task_struct *child_thread);
+pid_t sys_fork(uint32_t flags);
+
+#endif
@@ -0,0 +1,197 @@
+#include "process.h"
+#include "global.h"
+#include "debug.h"
+#include "memory.h"
+#include "thread.h"
+#include "list.h"
+#include "tss.h"
+#include "interrupt.h"
+#include "string.h"
+#include "console.h"
+
+#define PG_SIZE 4096
+
+extern void intr_exit(void);
+
+/**
+ * @brief 构建用户进程初始上下文信息，并通过 intr_exit 进入 3 特权级
+ *
+ * 由 kernel_thread 调用，此时仍处于 0 特权级。用户进程的上下文构造在中断栈 intr_stack 中：
+ * 段寄存器都是 DPL 为 3 的选择子，eip 为用户程序入口，eflags 中 IF 为 1（进入用户态后可以响应中断），
+ * 3 特权级栈在用户空间的最高页。最后让 esp 指向该中断栈，借 intr_exit 的 iretd 假装从中断返回，从而进入用户态。
+ *
+ * @param filename_ 用户程序的入口地址（目前用户程序就是内核映像中的函数，还没有从文件系统加载）
+ */
+void start_process(void *filename_)
+{
+    void *function = filename_;
+    struct task_struct *cur = running_thread();
+    cur->self_kstack += sizeof(struct thread_stack); // 跳过线程栈，指向中断栈
+    struct intr_stack *proc_stack = (struct intr_stack *)cur->self_kstack;
+    proc_stack->edi = proc_stack->esi = proc_stack->ebp = proc_stack->esp_dummy = 0;
+    proc_stack->ebx = proc_stack->edx = proc_stack->ecx = proc_stack->eax = 0;
+    proc_stack->gs = 0; // 用户态用不上显存段，直接置为 0
+    proc_stack->ds = proc_stack->es = proc_stack->fs = SELECTOR_U_DATA;
+    proc_stack->eip = function; // 待执行的用户程序地址
+    proc_stack->cs = SELECTOR_U_CODE;
+    proc_stack->eflags = (EFLAGS_IOPL_0 | EFLAGS_MBS | EFLAGS_IF_1); // IOPL 为 0，用户进程不能直接访问端口
+    void *stack_page = get_a_page(PF_USER, USER_STACK3_VADDR);
+    ASSERT(stack_page != NULL);
+    struct user_info *info = USER_INFO; // 栈顶留给进程信息，fork 时随用户栈一起复制
+    info->sysenter_enabled = sysenter_enabled;
+    info->arg = cur->user_arg;
+    proc_stack->esp = (void *)info;
+    proc_stack->ss = SELECTOR_U_DATA;
+    asm volatile("movl %0, %%esp; jmp intr_exit" : : "g"(proc_stack) : "memory");
+}
+
+/**
+ * @brief 激活页表：用户进程加载自己的页目录表，内核线程加载内核的页目录表（物理地址 0x100000）
+ *
+ * 内核线程也要重新加载页目录表，否则从进程切换过来的内核线程会沿用上一个进程的页表。
+ * 内核空间的映射都是全局页，重新加载 CR3 时不会被清出 TLB。
+ */
+void page_dir_activate(struct task_struct *p_thread)
+{
+    uint32_t pagedir_phy_addr = KERNEL_PGDIR_PHY;
+    if (p_thread->pgdir != NULL)
+    {
+        pagedir_phy_addr = addr_v2p((uint32_t)p_thread->pgdir);
+    }
+    uint32_t cr3;
+    asm volatile("movl %%cr3, %0" : "=r"(cr3));
+    if (cr3 != pagedir_phy_addr) // 前后是同一个地址空间时不必重新加载
+    {
+        asm volatile("movl %0, %%cr3" : : "r"(pagedir_phy_addr) : "memory");
+    }
+}
+
+/**
+ * @brief 激活线程或进程的页表，用户进程还要更新 TSS 中的 esp0 为其 0 级栈
+ */
+void process_activate(struct task_struct *p_thread)
+{
+    ASSERT(p_thread != NULL);
+    page_dir_activate(p_thread);
+    /* 内核线程特权级本身就是 0，处理器进入中断时不会从 TSS 中获取 0 特权级栈地址，故不需要更新 esp0 */
+    if (p_thread->pgdir)
+    {
+        update_tss_esp(p_thread);
+    }
+}
+
+/**
+ * @brief 创建页目录表，复制当前页表中表示内核空间的页目录项
+ *
+ * 内核空间的第 768~1022 个页目录项在 loader 中已全部建好，复制后所有进程共享内核的页表；
+ * 第 1023 个页目录项指向新页目录表自身，仅限特权级 0~2 访问，防止用户进程通过它改写自己的页表。
+ * 调用者需关中断，保证复制与 process_sync_kernel_pde 不交错。
+ *
+ * @return uint32_t* 成功返回页目录表的虚拟地址，失败返回 NULL
+ */
+uint32_t *create_page_dir(void)
+{
+    /* 用户进程的页表不能让用户直接访问到，所以在内核空间来申请 */
+    uint32_t *page_dir_vaddr = get_kernel_pages(1);
+    if (page_dir_vaddr == NULL)
+    {
+        console_put_str("create_page_dir: get_kernel_page failed!");
+        return NULL;
+    }
+
+    /* 1. 复制页表：0x300 是第 768 个页目录项，每项 4 字节；第 1023 项在下面单独填写 */
+    memcpy((uint32_t *)((uint32_t)page_dir_vaddr + 0x300 * 4), (uint32_t *)(0xfffff000 + 0x300 * 4), 255 * 4);
+
+    /* 2. 更新页目录地址 */
+    uint32_t new_page_dir_phy_addr = addr_v2p((uint32_t)page_dir_vaddr);
+    page_dir_vaddr[1023] = new_page_dir_phy_addr | PG_US_S | PG_RW_W | PG_P_1;
+    return page_dir_vaddr;
+}
+
+/**
+ * @brief 创建用户进程的虚拟地址池（从 USER_VADDR_START 到内核空间之下）
+ *
+ * @return bool 位图内存申请失败时返回 false
+ */
+static bool create_user_vaddr_bitmap(struct task_struct *user_prog)
+{
+    user_prog->userprog_vaddr.vaddr_start = USER_VADDR_START;
+    uint32_t bitmap_pg_cnt = DIV_ROUND_UP((0xc0000000 - USER_VADDR_START) / PG_SIZE / 8, PG_SIZE);
+    user_prog->userprog_vaddr.vaddr_bitmap.bits = get_kernel_pages(bitmap_pg_cnt);
+    if (user_prog->userprog_vaddr.vaddr_bitmap.bits == NULL)
+    {
+        return false;
+    }
+    user_prog->userprog_vaddr.vaddr_bitmap.btmp_bytes_len = (0xc0000000 - USER_VADDR_START) / PG_SIZE / 8;
+    user_prog->userprog_vaddr.vaddr_bitmap.summary = NULL;
+    bitmap_init(&user_prog->userprog_vaddr.vaddr_bitmap);
+    return true;
+}
+
+/**
+ * @brief 创建用户进程 name，入口为 filename，并加入就绪队列
+ */
+void process_execute(void *filename, char *name)
+{
+    process_execute_arg(filename, name, 0);
+}
+
+/**
+ * @brief 创建用户进程 name，入口为 filename，并加入就绪队列；arg 经用户栈顶的 USER_INFO->arg 传给用户程序
+ *
+ * 进程的 PCB 与内核线程一样从内核物理内存池申请，此外还拥有独立的虚拟地址池、页目录表和用户堆的内存块描述符。
+ */
+void process_execute_arg(void *filename, char *name, uint32_t arg)
+{
+    /* pcb 内核的数据结构，由内核来维护进程信息，因此要在内核内存池中申请 */
+    struct task_struct *thread = get_kernel_pages(1);
+    ASSERT(thread != NULL);
+    init_thread(thread, name, default_prio);
+    if (!create_user_vaddr_bitmap(thread))
+    {
+        PANIC("process_execute: no memory for user vaddr bitmap");
+    }
+    thread_create(thread, start_process, filename);
+    block_desc_init(thread->u_block_desc);
+    thread->u_desc_base = thread->u_block_desc;
+    thread->user_arg = arg;
+
+    /* 复制内核页目录项与加入全部队列之间不能插入大页的同步，否则新页目录表会漏掉这次更新 */
+    enum intr_status old_status = intr_disable();
+    thread->pgdir = create_page_dir();
+    if (thread->pgdir == NULL)
+    {
+        PANIC("process_execute: no memory for page directory");
+    }
+
+    ready_enqueue(thread, false);
+
+    ASSERT(!elem_find(&thread_all_list, &thread->all_list_tag));
+    list_append(&thread_all_list, &thread->all_list_tag);
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 把当前页目录表中 vaddr 所在的内核页目录项同步到内核页目录表和所有进程的页目录表
+ *
+ * 内核空间的页表由所有页目录表共享，写页表项无需同步；但 4MB 大页直接改写页目录项，
+ * 只改当前页目录表的话，其他地址空间中会看不到这次映射。调用者需关中断。
+ */
+void process_sync_kernel_pde(uint32_t vaddr)
+{
+    uint32_t pde_idx = vaddr >> 22;
+    ASSERT(intr_get_status() == INTR_OFF && pde_idx >= 0x300 && pde_idx < 1023);
+    uint32_t pde = *pde_ptr(vaddr);
+    kernel_pgdir[pde_idx] = pde;
+
+    struct list_elem *elem = thread_all_list.head.next;
+    while (elem != &thread_all_list.tail)
+    {
+        struct task_struct *pthread = elem2entry(struct task_struct, all_list_tag, elem);
+        if (pthread->pgdir != NULL)
+        {
+            pthread->pgdir[pde_idx] = pde;
+        }
+        elem = elem->next;
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef __USERPROG_PROCESS_H
+#define __USERPROG_PROCESS_H
+#include "thread.h"
+#include "stdint.h"
+
+#define default_prio 31
+#define USER_STACK3_VADDR (0xc0000000 - 0x1000) // 用户进程 3 特权级栈所在页的起始地址（用户空间的最高页）
+#define USER_VADDR_START 0x8048000               // 用户进程虚拟地址空间的起始地址（与 Linux 一致）
+
+/* start_process 放在用户栈顶的进程信息：内核映像的数据段对 3 特权级不可见，用户态的库函数和程序从这里读取内核的设置 */
+struct user_info
+{
+    uint32_t sysenter_enabled; // 内核是否开启了 sysenter 快速系统调用
+    uint32_t arg;              // process_execute_arg 传给用户程序的参数
+};
+#define USER_INFO ((struct user_info *)(0xc0000000 - sizeof(struct user_info)))
+
+extern struct list thread_all_list;
+
+void start_process(void *filename_);
+void page_dir_activate(struct task_struct *p_thread);
+void process_activate(struct task_struct *p_thread);
+uint32_t *create_page_dir(void);
+static bool create_user_vaddr_bitmap(struct task_struct *user_prog);
+void process_execute(void *filename, char *name);
+void process_execute_arg(void *filename, char *name, uint32_t arg);
+void process_sync_kernel_pde(uint32_t vaddr);
+
+#endif
@@ -0,0 +1,74 @@
+#include "syscall-init.h"
+#include "syscall.h"
+#include "stdint.h"
+#include "print.h"
+#include "thread.h"
+#include "console.h"
+#include "string.h"
+#include "memory.h"
+#include "fork.h"
+
+#define PG_SIZE 4096
+#define WRITE_MAX_LEN 1024 // sys_write 一次打印的字符串的最大长度
+
+typedef void *syscall;
+syscall syscall_table[syscall_nr]; // 系统调用表，由 kernel.S 中的 syscall_handler 按子功能号（eax）索引
+
+/**
+ * @brief 返回当前任务的 pid
+ */
+uint32_t sys_getpid(void)
+{
+    return running_thread()->pid;
+}
+
+/**
+ * @brief 打印字符串 str（未实现文件系统前的版本），返回打印的字符数
+ *
+ * 用户进程传入的 str 须整个位于进程已分配的用户页中且不超过 WRITE_MAX_LEN 字节，否则不打印并返回 -1。
+ */
+int32_t sys_write(char *str)
+{
+    if (running_thread()->pgdir != NULL && user_str_len(str, WRITE_MAX_LEN) == -1)
+    {
+        return -1;
+    }
+    console_put_str(str);
+    return strlen(str);
+}
+
+/**
+ * @brief 结束当前进程，不返回；进程的页表、用户页和 PCB 由 reaper 线程回收（还没有 wait，status 暂不使用）
+ */
+void sys_exit(int32_t status UNUSED)
+{
+    thread_exit();
+}
+
+/**
+ * @brief 未注册的子功能号统一由它处理，返回 -1
+ */
+static int32_t sys_nosys(void)
+{
+    return -1;
+}
+
+/**
+ * @brief 初始化系统调用表
+ */
+void syscall_init(void)
+{
+    put_str("syscall_init start\n");
+    uint32_t nr;
+    for (nr = 0; nr < syscall_nr; nr++)
+    {
+        syscall_table[nr] = sys_nosys;
+    }
+    syscall_table[SYS_GETPID] = sys_getpid;
+    syscall_table[SYS_WRITE] = sys_write;
+    syscall_table[SYS_MALLOC] = sys_malloc;
+    syscall_table[SYS_FREE] = sys_free;
+    syscall_table[SYS_FORK] = sys_fork;
+    syscall_table[SYS_EXIT] = sys_exit;
+    put_str("syscall_init done\n");
+}
@@ -0,0 +1,13 @@
+#ifndef __USERPROG_SYSCALLINIT_H
+#define __USERPROG_SYSCALLINIT_H
+#include "stdint.h"
+
+#define syscall_nr 32 // 系统调用表的容量，kernel.S 中的 SYSCALL_NR 须与之一致
+
+void syscall_init(void);
+uint32_t sys_getpid(void);
+int32_t sys_write(char *str);
+void sys_exit(int32_t status);
+static int32_t sys_nosys(void);
+
+#endif
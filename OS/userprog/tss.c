@@ -0,0 +1,166 @@
+#include "tss.h"
+#include "stdint.h"
+#include "global.h"
+#include "string.h"
+#include "print.h"
+
+#define PG_SIZE 4096
+
+#define GDT_BASE 0xc0000900 // loader 中 GDT 的起始地址（物理地址 0x900，开启分页后位于 0xc0000900）
+#define GDT_DESC_CNT 9      // 加入 TSS、sysenter 用的内核代码段与栈段、用户代码段与数据段后，GDT 中共 9 个描述符
+
+/**
+ * 任务状态段 tss 结构
+ *
+ * 处理器的任务切换机制我们并不使用（任务切换由 switch_to 完成），TSS 只用于特权级变化时获取 0 级栈：
+ * 用户进程在 3 特权级下被中断或执行系统调用时，处理器会从 TSS 的 ss0 和 esp0 中加载 0 特权级的栈，
+ * 因此 TSS 只需要一个，每次切换到用户进程时把 esp0 改为该进程 PCB 所在页的顶端即可。
+ */
+struct tss
+{
+    uint32_t backlink;
+    uint32_t *esp0;
+    uint32_t ss0;
+    uint32_t *esp1;
+    uint32_t ss1;
+    uint32_t *esp2;
+    uint32_t ss2;
+    uint32_t cr3;
+    uint32_t (*eip)(void);
+    uint32_t eflags;
+    uint32_t eax;
+    uint32_t ecx;
+    uint32_t edx;
+    uint32_t ebx;
+    uint32_t esp;
+    uint32_t ebp;
+    uint32_t esi;
+    uint32_t edi;
+    uint32_t es;
+    uint32_t cs;
+    uint32_t ss;
+    uint32_t ds;
+    uint32_t fs;
+    uint32_t gs;
+    uint32_t ldt;
+    uint32_t trace;
+    uint32_t io_base;
+};
+static struct tss tss;
+
+bool sysenter_enabled = false; // 处理器是否支持并已开启 sysenter/sysexit，为 false 时系统调用只能走 int 0x80
+
+extern void sysenter_entry(void); // sysenter 的内核入口，定义在 kernel.S 中
+
+/**
+ * @brief 更新 TSS 中的 esp0 为线程 pthread 的 0 级栈（PCB 所在页的顶端）
+ */
+void update_tss_esp(struct task_struct *pthread)
+{
+    tss.esp0 = (uint32_t *)((uint32_t)pthread + PG_SIZE);
+    if (sysenter_enabled)
+    {
+        /* sysenter 不经过 TSS，进入内核时的 esp 直接取自 IA32_SYSENTER_ESP，同样指向该进程的 0 级栈 */
+        wrmsr(IA32_SYSENTER_ESP, (uint32_t)tss.esp0);
+    }
+}
+
+/**
+ * @brief 把 value 写入模型专用寄存器 msr（高 32 位写 0）
+ */
+static void wrmsr(uint32_t msr, uint32_t value)
+{
+    asm volatile("wrmsr" : : "c"(msr), "a"(value), "d"(0));
+}
+
+/**
+ * @brief 检测处理器是否支持 sysenter/sysexit
+ *
+ * CPUID 1 号功能返回的 edx 第 11 位为 SEP 标志；早期的 Pentium Pro（family 6，model < 3，stepping < 3）
+ * 会置位 SEP 却并不支持这两条指令，需要排除。
+ */
+static bool sysenter_supported(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    if (!(edx & (1 << 11)))
+    {
+        return false;
+    }
+    uint32_t family = (eax >> 8) & 0xf;
+    uint32_t model = (eax >> 4) & 0xf;
+    uint32_t stepping = eax & 0xf;
+    return !(family == 6 && model < 3 && stepping < 3);
+}
+
+/**
+ * @brief 支持 sysenter 时设置 IA32_SYSENTER_CS 和 IA32_SYSENTER_EIP
+ *
+ * IA32_SYSENTER_ESP 随进程切换在 update_tss_esp 中更新。不支持时系统调用全部走 int 0x80 的中断门。
+ */
+static void sysenter_init(void)
+{
+    if (!sysenter_supported())
+    {
+        put_str("   sysenter not supported, system calls use int 0x80\n");
+        return;
+    }
+    wrmsr(IA32_SYSENTER_CS, SELECTOR_K_SYSENTER);
+    wrmsr(IA32_SYSENTER_EIP, (uint32_t)sysenter_entry);
+    sysenter_enabled = true;
+    put_str("   sysenter enabled\n");
+}
+
+/**
+ * @brief 创建 GDT 描述符
+ *
+ * @param desc_addr 段基址
+ * @param limit 段界限（20 位）
+ * @param attr_low 描述符高 32 位中的第 8~15 位（P、DPL、S、TYPE）
+ * @param attr_high 描述符高 32 位中的第 20~23 位（G、D/B、L、AVL），位于参数的高 4 位
+ * @return struct gdt_desc 构造好的描述符
+ */
+static struct gdt_desc make_gdt_desc(uint32_t *desc_addr, uint32_t limit, uint8_t attr_low, uint8_t attr_high)
+{
+    uint32_t desc_base = (uint32_t)desc_addr;
+    struct gdt_desc desc;
+    desc.limit_low_word = limit & 0x0000ffff;
+    desc.base_low_word = desc_base & 0x0000ffff;
+    desc.base_mid_byte = ((desc_base & 0x00ff0000) >> 16);
+    desc.attr_low_byte = (uint8_t)(attr_low);
+    desc.limit_high_attr_high = (((limit & 0x000f0000) >> 16) + (uint8_t)(attr_high));
+    desc.base_high_byte = desc_base >> 24;
+    return desc;
+}
+
+/**
+ * @brief 在 GDT 中创建 TSS 并重新加载 GDT，再用 ltr 加载 TSS
+ *
+ * loader 中的 GDT 已有 4 个描述符（空描述符、内核代码段、内核数据段、显存段），并预留了 60 个空位，
+ * 这里依次在第 4~8 个位置写入 TSS、sysenter 用的内核代码段和栈段、DPL 为 3 的用户代码段和用户数据段。
+ * sysenter 用的两个描述符与 loader 中的内核代码段、数据段内容相同，只是 sysenter/sysexit 要求它们与用户段相邻。
+ */
+void tss_init(void)
+{
+    put_str("tss_init start\n");
+    uint32_t tss_size = sizeof(tss);
+    memset(&tss, 0, tss_size);
+    tss.ss0 = SELECTOR_K_STACK;
+    tss.io_base = tss_size; // io 位图的偏移地址大于等于 TSS 大小，表示没有 io 位图
+
+    /* 在 GDT 中添加 dpl 为 0 的 TSS 描述符 */
+    *((struct gdt_desc *)(GDT_BASE + 4 * 8)) = make_gdt_desc((uint32_t *)&tss, tss_size - 1, TSS_ATTR_LOW, TSS_ATTR_HIGH);
+
+    /* 在 GDT 中添加 sysenter 用的 dpl 为 0 的代码段和栈段，再添加 dpl 为 3 的代码段和数据段（都是平坦模型，段界限 4GB） */
+    *((struct gdt_desc *)(GDT_BASE + 5 * 8)) = make_gdt_desc((uint32_t *)0, 0xfffff, GDT_CODE_ATTR_LOW_DPL0, GDT_ATTR_HIGH);
+    *((struct gdt_desc *)(GDT_BASE + 6 * 8)) = make_gdt_desc((uint32_t *)0, 0xfffff, GDT_DATA_ATTR_LOW_DPL0, GDT_ATTR_HIGH);
+    *((struct gdt_desc *)(GDT_BASE + 7 * 8)) = make_gdt_desc((uint32_t *)0, 0xfffff, GDT_CODE_ATTR_LOW_DPL3, GDT_ATTR_HIGH);
+    *((struct gdt_desc *)(GDT_BASE + 8 * 8)) = make_gdt_desc((uint32_t *)0, 0xfffff, GDT_DATA_ATTR_LOW_DPL3, GDT_ATTR_HIGH);
+
+    /* gdt 的 16 位 limit 和 32 位段基址 */
+    uint64_t gdt_operand = ((GDT_DESC_CNT * 8 - 1) | ((uint64_t)GDT_BASE << 16));
+    asm volatile("lgdt %0" : : "m"(gdt_operand));
+    asm volatile("ltr %w0" : : "r"(SELECTOR_TSS));
+    sysenter_init();
+    put_str("tss_init and ltr done\n");
+}
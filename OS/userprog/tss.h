@@ -0,0 +1,18 @@
+#ifndef __USERPROG_TSS_H
+#define __USERPROG_TSS_H
+#include "thread.h"
+
+#define IA32_SYSENTER_CS 0x174  // sysenter 进入的内核代码段选择子（栈段选择子为其加 8）
+#define IA32_SYSENTER_ESP 0x175 // sysenter 进入内核后的 esp
+#define IA32_SYSENTER_EIP 0x176 // sysenter 进入内核后的 eip
+
+extern bool sysenter_enabled;
+
+void update_tss_esp(struct task_struct *pthread);
+static struct gdt_desc make_gdt_desc(uint32_t *desc_addr, uint32_t limit, uint8_t attr_low, uint8_t attr_high);
+static void wrmsr(uint32_t msr, uint32_t value);
+static bool sysenter_supported(void);
+static void sysenter_init(void);
+void tss_init(void);
+
+#endif
@@ -0,0 +1,180 @@
+#include "user_bench.h"
+#include "syscall.h"
+#include "stdint.h"
+#include "process.h"
+#include "memstat.h"
+
+#define PG_SIZE 4096
+
+/*****************************  系统调用往返耗时  *********************************
+ * syscall_bench 创建一个用户进程，在 3 特权级下分别经由 int 0x80 和 sysenter 各重复 rounds 次 getpid，用时间戳计数器统计总周期数，
+ * 再通过 write 输出一行 "syscall pid=.. rounds=.. int_hi=.. int_lo=.. sysenter=.. fast_hi=.. fast_lo=.."
+ * （数值为十六进制，格式同 memstat_dump；不支持 sysenter 时 sysenter=0，fast_* 为 0）。
+ * 测得的是进入内核、查表调用、返回用户态的完整往返开销。
+ * 下面的函数除 syscall_bench 外都运行在用户态，只能通过系统调用与内核交互；内核的数据段对 3 特权级不可见，
+ * rounds 和是否开启了 sysenter 都从用户栈顶的 USER_INFO 中读取。
+ ***************************************************************************/
+
+/**
+ * @brief 把 num 以不带前导 0 的大写十六进制写入 buf，返回写入后的末尾
+ */
+static char *bench_put_hex(char *buf, uint32_t num)
+{
+    char digits[8];
+    int cnt = 0;
+    do
+    {
+        uint8_t digit = num & 0xf;
+        digits[cnt++] = (digit < 10) ? ('0' + digit) : ('A' + digit - 10);
+        num >>= 4;
+    } while (num != 0);
+    while (cnt > 0)
+    {
+        *buf++ = digits[--cnt];
+    }
+    return buf;
+}
+
+/**
+ * @brief 向 buf 写入 " key=num"，返回写入后的末尾
+ */
+static char *bench_put_field(char *buf, char *key, uint32_t num)
+{
+    *buf++ = ' ';
+    while (*key)
+    {
+        *buf++ = *key++;
+    }
+    *buf++ = '=';
+    return bench_put_hex(buf, num);
+}
+
+/**
+ * @brief 测试进程的入口（3 特权级）
+ */
+static void syscall_bench_proc(void)
+{
+    uint32_t rounds = USER_INFO->arg;
+    uint32_t pid = getpid_int80(); // 预热，同时取得 pid
+    uint64_t start = rdtsc();
+    uint32_t round;
+    for (round = 0; round < rounds; round++)
+    {
+        getpid_int80();
+    }
+    uint64_t int_cycles = rdtsc() - start;
+
+    uint64_t fast_cycles = 0;
+    if (USER_INFO->sysenter_enabled)
+    {
+        getpid_sysenter();
+        start = rdtsc();
+        for (round = 0; round < rounds; round++)
+        {
+            getpid_sysenter();
+        }
+        fast_cycles = rdtsc() - start;
+    }
+
+    char line[96];
+    char *end = line;
+    char *prefix = "syscall";
+    while (*prefix)
+    {
+        *end++ = *prefix++;
+    }
+    end = bench_put_field(end, "pid", pid);
+    end = bench_put_field(end, "rounds", rounds);
+    end = bench_put_field(end, "int_hi", (uint32_t)(int_cycles >> 32));
+    end = bench_put_field(end, "int_lo", (uint32_t)int_cycles);
+    end = bench_put_field(end, "sysenter", USER_INFO->sysenter_enabled);
+    end = bench_put_field(end, "fast_hi", (uint32_t)(fast_cycles >> 32));
+    end = bench_put_field(end, "fast_lo", (uint32_t)fast_cycles);
+    *end++ = '\n';
+    *end = 0;
+    write(line);
+    exit(0);
+}
+
+/**
+ * @brief 创建测试进程，测量两条路径上 rounds 次 getpid 系统调用的往返耗时
+ */
+void syscall_bench(uint32_t rounds)
+{
+    process_execute_arg(syscall_bench_proc, "syscall_bench", rounds);
+}
+
+/*******************************  fork 的耗时  ***********************************
+ * fork_bench 创建一个用户进程，对 4MB 和 64MB 两种大小的用户堆缓冲区（逐页写过，页框都已分配）各测一次：
+ * 写时复制的 fork 与立即复制全部页的 fork_eager 从调用到父进程返回所用的周期数，
+ * 每种大小输出一行 "fork kb=.. cow_hi=.. cow_lo=.. eager_hi=.. eager_lo=.."（失败的一项为 ffffffff）。
+ * 子进程 fork 返回后立即 exit，不会在之后几轮的计时中占用处理器，也不会一直持有复制或共享的页框。
+ *********************************************************************************/
+
+static const uint32_t fork_bench_kb[] = {4 * 1024, 64 * 1024};
+
+/**
+ * @brief 测一次 fork（eager 为真时用 fork_eager），返回父进程中的周期数，失败返回 0xffffffffffffffff
+ */
+static uint64_t fork_bench_once(bool eager)
+{
+    uint64_t start = rdtsc();
+    pid_t pid = eager ? fork_eager() : fork();
+    uint64_t cycles = rdtsc() - start;
+    if (pid == 0)
+    {
+        exit(0);
+    }
+    return (pid == -1) ? 0xffffffffffffffffULL : cycles;
+}
+
+/**
+ * @brief fork 测试进程的入口（3 特权级）
+ */
+static void fork_bench_proc(void)
+{
+    uint32_t idx;
+    for (idx = 0; idx < sizeof(fork_bench_kb) / sizeof(fork_bench_kb[0]); idx++)
+    {
+        uint32_t bytes = fork_bench_kb[idx] * 1024;
+        char *buf = malloc(bytes);
+        uint64_t cow_cycles = 0xffffffffffffffffULL;
+        uint64_t eager_cycles = 0xffffffffffffffffULL;
+        if (buf != NULL)
+        {
+            uint32_t offset;
+            for (offset = 0; offset < bytes; offset += PG_SIZE)
+            {
+                buf[offset] = 1;
+            }
+            cow_cycles = fork_bench_once(false);
+            eager_cycles = fork_bench_once(true);
+            free(buf);
+        }
+
+        char line[96];
+        char *end = line;
+        char *prefix = "fork";
+        while (*prefix)
+        {
+            *end++ = *prefix++;
+        }
+        end = bench_put_field(end, "kb", fork_bench_kb[idx]);
+        end = bench_put_field(end, "cow_hi", (uint32_t)(cow_cycles >> 32));
+        end = bench_put_field(end, "cow_lo", (uint32_t)cow_cycles);
+        end = bench_put_field(end, "eager_hi", (uint32_t)(eager_cycles >> 32));
+        end = bench_put_field(end, "eager_lo", (uint32_t)eager_cycles);
+        *end++ = '\n';
+        *end = 0;
+        write(line);
+    }
+    exit(0);
+}
+
+/**
+ * @brief 创建 fork 测试进程
+ */
+void fork_bench(void)
+{
+    process_execute(fork_bench_proc, "fork_bench");
+}
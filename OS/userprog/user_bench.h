@@ -0,0 +1,13 @@
+#ifndef __USERPROG_USER_BENCH_H
+#define __USERPROG_USER_BENCH_H
+#include "stdint.h"
+
+static char *bench_put_hex(char *buf, uint32_t num);
+static char *bench_put_field(char *buf, char *key, uint32_t num);
+static void syscall_bench_proc(void);
+void syscall_bench(uint32_t rounds);
+static uint64_t fork_bench_once(bool eager);
+static void fork_bench_proc(void);
+void fork_bench(void);
+
+#endif